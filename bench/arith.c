@@ -0,0 +1,55 @@
+/*
+ * Measures arithmetic: evaluating an expression on its own, one that
+ * assigns a variable, as a counter does, and expanding a line with a
+ * $((...)) in it, none of which starts a process.
+ *
+ * Usage: arith
+ */
+
+#include "harness.h"
+#include "../src/arith.h"
+#include "../src/parse.h"
+#include "../src/vars.h"
+#include <string.h>
+
+static void eval_once(void *ctx, long i) {
+    int64_t *sum = ctx;
+    int64_t value;
+
+    (void) i;
+    arith_eval("(width * 3 + 1) << 2 | width % 7", &value);
+    *sum += value;
+}
+
+static void count_once(void *ctx, long i) {
+    int64_t *sum = ctx;
+    int64_t value;
+
+    (void) i;
+    arith_eval("count += 1", &value);
+    *sum += value;
+}
+
+static void expand_once(void *ctx, long i) {
+    static struct arena arena;
+    const char *text = ctx;
+    char line[256];
+    struct pipeline p;
+
+    (void) i;
+    strcpy(line, text);
+    parse_line(line, strlen(line), &p, &arena);
+    arena_reset(&arena);
+}
+
+int main(void) {
+    int64_t sum = 0;
+
+    set_var("width", "80");
+    set_var("count", "0");
+
+    bench_adaptive("arith/(width * 3 + 1) << 2 | width % 7", eval_once, &sum);
+    bench_adaptive("arith/count += 1", count_once, &sum);
+    bench_adaptive("expand/echo $((width / 2 - 1))", expand_once, "echo $((width / 2 - 1))");
+    return sum < 0;
+}
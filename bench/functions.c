@@ -0,0 +1,53 @@
+/*
+ * Measures aliases and functions: tokenizing a line whose command is an
+ * alias, next to one that is not, among a few hundred aliases, and calling
+ * a function, whose body was parsed when it was defined, and only gets
+ * expanded and run here, in the process.
+ *
+ * Usage: functions
+ */
+
+#include "harness.h"
+#include "../src/functions.h"
+#include "../src/parse.h"
+#include <string.h>
+#include <unistd.h>
+
+#define ALIASES 300
+
+static void tokenize_once(void *ctx, long i) {
+    static struct arena arena;
+    const char *text = ctx;
+    char line[256];
+    struct pipeline p;
+
+    (void) i;
+    strcpy(line, text);
+    tokenize_line(line, strlen(line), &p, &arena);
+    arena_reset(&arena);
+}
+
+static void call_once(void *ctx, long i) {
+    static char *argv[] = {"set_two", "first", "second", NULL};
+    int *status = ctx;
+
+    (void) i;
+    call_function(argv, STDIN_FILENO, STDOUT_FILENO, status);
+}
+
+int main(void) {
+    char name[16], value[32];
+    int status = 0;
+
+    for (int i = 0; i < ALIASES; i++) {
+        snprintf(name, sizeof(name), "al%d", i);
+        snprintf(value, sizeof(value), "ls -l --color=%d", i);
+        set_alias(name, value);
+    }
+    define_function("set_two", "a=$1; b=$2");
+
+    bench_adaptive("tokenize/ls -l src | wc -l", tokenize_once, "ls -l src | wc -l");
+    bench_adaptive("tokenize/al150 src | wc -l", tokenize_once, "al150 src | wc -l");
+    bench_adaptive("function/set_two first second", call_once, &status);
+    return status;
+}
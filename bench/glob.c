@@ -0,0 +1,90 @@
+/*
+ * Measures glob expansion over a scratch directory of a few thousand
+ * files: a single glob, several globs on one line, which share their
+ * directory listings, a glob over subdirectories, and a "**" over a tree
+ * of 20000 more.  Also the compiled matcher on its own.
+ *
+ * Usage: glob
+ */
+
+#include "harness.h"
+#include "../src/parse.h"
+#include "../src/utils/pattern.h"
+#include <fcntl.h>
+#include <ftw.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define FILES 1000
+
+static void make_files(const char *dir, const char *ext, int count) {
+    char path[256];
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "%s/file%04d.%s", dir, i, ext);
+        close(open(path, O_CREAT | O_WRONLY, 0644));
+    }
+}
+
+static int remove_entry(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void) st;
+    (void) type;
+    (void) ftw;
+    return remove(path);
+}
+
+static void expand_once(void *ctx, long i) {
+    static struct arena arena;
+    const char *text = ctx;
+    char line[256];
+    struct pipeline p;
+
+    (void) i;
+    strcpy(line, text);
+    parse_line(line, strlen(line), &p, &arena);
+    arena_reset(&arena);
+}
+
+static void match_once(void *ctx, long i) {
+    static const char *names[] = {"file0001.c", "file0002.h", "README.md", "parse.c.orig"};
+    int *matched = ctx;
+    static struct arena arena;
+    static struct pattern pat;
+
+    if (!pat.count) compile_pattern(&pat, "file[0-9]*.[ch]", 15, &arena);
+    *matched += pattern_matches(&pat, names[i & 3]);
+}
+
+int main(void) {
+    char dir[] = "/tmp/thsh-glob-XXXXXX";
+    char sub[64];
+    int matched = 0;
+
+    if (!mkdtemp(dir)) return 1;
+    snprintf(sub, sizeof(sub), "%s/src", dir);
+    mkdir(sub, 0755);
+    make_files(dir, "c", FILES);
+    make_files(dir, "h", FILES);
+    make_files(dir, "o", FILES);
+    make_files(sub, "c", FILES);
+    snprintf(sub, sizeof(sub), "%s/tree", dir);
+    mkdir(sub, 0755);
+    for (int i = 0; i < 200; i++) {
+        snprintf(sub, sizeof(sub), "%s/tree/d%d", dir, i / 10);
+        mkdir(sub, 0755);
+        snprintf(sub, sizeof(sub), "%s/tree/d%d/e%d", dir, i / 10, i % 10);
+        mkdir(sub, 0755);
+        make_files(sub, i & 1 ? "c" : "txt", FILES / 10);
+    }
+    if (chdir(dir)) return 1;
+
+    bench_adaptive("glob/*.c", expand_once, "ls *.c");
+    bench_adaptive("glob/*.c *.h src/*.c", expand_once, "ls *.c *.h src/*.c");
+    bench_adaptive("glob/file00?[0-4].[ch]", expand_once, "ls file00?[0-4].[ch]");
+    bench_adaptive("glob/*/*.c", expand_once, "ls */*.c");
+    bench_adaptive("glob/tree/**/*.c", expand_once, "ls tree/**/*.c");
+    bench_adaptive("pattern/file[0-9]*.[ch]", match_once, &matched);
+
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return matched < 0;
+}
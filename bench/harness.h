@@ -0,0 +1,81 @@
+/*
+ * The harness shared by the microbenchmarks.  It times a loop of
+ * operations, and counts the allocations they make: this header
+ * interposes malloc(), calloc() and realloc() for the whole program, so
+ * allocations from inside the shell's code and libc count too.
+ *
+ * Include it from exactly one file per benchmark program.
+ */
+
+#ifndef BENCH_HARNESS_H
+#define BENCH_HARNESS_H
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Run an adaptive benchmark for at least this long */
+#define BENCH_MIN_SECONDS 0.2
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long long bench_allocs;
+
+void *malloc(size_t size) {
+    bench_allocs++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    bench_allocs++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    bench_allocs++;
+    return __libc_realloc(ptr, size);
+}
+
+static inline double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void bench_report(const char *name, long ops, double seconds,
+                                unsigned long long allocs) {
+    printf("%-44s %12.1f ns/op %9.2f allocs/op %10ld ops\n", name,
+           seconds * 1e9 / ops, (double) allocs / ops, ops);
+}
+
+/* Run op exactly ops times, and report the cost of one */
+static inline void bench_fixed(const char *name, void (*op)(void *ctx, long i),
+                               void *ctx, long ops) {
+    unsigned long long allocs = bench_allocs;
+    double start = bench_now();
+    for (long i = 0; i < ops; i++) op(ctx, i);
+    double elapsed = bench_now() - start;
+    bench_report(name, ops, elapsed, bench_allocs - allocs);
+}
+
+/* Run op in ever larger batches until one takes BENCH_MIN_SECONDS, and
+ * report the cost of one, from the last batch */
+static inline void bench_adaptive(const char *name, void (*op)(void *ctx, long i),
+                                  void *ctx) {
+    for (long ops = 1;; ops *= 2) {
+        unsigned long long allocs = bench_allocs;
+        double start = bench_now();
+        for (long i = 0; i < ops; i++) op(ctx, i);
+        double elapsed = bench_now() - start;
+        if (elapsed >= BENCH_MIN_SECONDS) {
+            bench_report(name, ops, elapsed, bench_allocs - allocs);
+            return;
+        }
+    }
+}
+
+#endif // BENCH_HARNESS_H
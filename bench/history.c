@@ -0,0 +1,72 @@
+/*
+ * Measures add_history_line() and load_history() with 10k to 1M entries.
+ * The history file is written to a scratch $HOME, never the real one.
+ *
+ * Usage: history
+ */
+
+#include "harness.h"
+#include "../src/history.h"
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *sizes[] = {"10k", "100k", "1M"};
+static const long counts[] = {10000, 100000, 1000000};
+
+static void add_one(void *ctx, long i) {
+    char line[64];
+    (void) ctx;
+    snprintf(line, sizeof(line), "grep -rn pattern%ld src/ | sort | uniq -c", i);
+    add_history_line(line);
+}
+
+/* A history file with count entries, in the format save_history() uses */
+static int write_history_file(const char *home, long count) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.thsh_history", home);
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+    for (long i = 0; i < count; i++)
+        fprintf(f, "grep -rn pattern%ld src/ | sort | uniq -c\1\2", i);
+    fclose(f);
+    return 0;
+}
+
+int main(void) {
+    char home[] = "/tmp/thsh-bench-XXXXXX";
+    char name[64];
+
+    if (!mkdtemp(home)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    setenv("HOME", home, 1);
+
+    for (int s = 0; s < 3; s++) {
+        snprintf(name, sizeof(name), "history/add_history_line/%s", sizes[s]);
+        bench_fixed(name, add_one, NULL, counts[s]);
+        clear_history();
+    }
+
+    /* One load per size; the cost is reported per entry in the file */
+    for (int s = 0; s < 3; s++) {
+        if (write_history_file(home, counts[s])) {
+            perror("history file");
+            return 1;
+        }
+        unsigned long long allocs = bench_allocs;
+        double start = bench_now();
+        load_history();
+        double elapsed = bench_now() - start;
+        snprintf(name, sizeof(name), "history/load_history/%s (per entry)", sizes[s]);
+        bench_report(name, counts[s], elapsed, bench_allocs - allocs);
+        clear_history();
+    }
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/.thsh_history", home);
+    unlink(path);
+    rmdir(home);
+    return 0;
+}
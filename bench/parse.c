@@ -0,0 +1,55 @@
+/*
+ * Measures parse_line() on a short and a long line, with and without
+ * a glob.
+ *
+ * Usage: parse
+ */
+
+#include "harness.h"
+#include "../src/parse.h"
+#include <string.h>
+
+struct parse_case {
+    const char *line;
+};
+
+static void parse_once(void *ctx, long i) {
+    static struct arena arena;
+    struct parse_case *c = ctx;
+    char line[4096];
+    struct pipeline p;
+    size_t len = strlen(c->line);
+
+    (void) i;
+    memcpy(line, c->line, len + 1);
+    parse_line(line, len, &p, &arena);
+    arena_reset(&arena);
+}
+
+int main(void) {
+    struct parse_case cases[] = {
+        {"ls -l"},
+        {"cat < input.txt | grep -v foo | sort -u > output.txt"},
+        {"cmd a1 a2 a3 a4 a5 a6 a7 a8 a9 a10 a11 a12 a13 a14 | "
+         "cmd b1 b2 b3 b4 b5 b6 b7 b8 b9 b10 b11 b12 b13 b14 | "
+         "cmd c1 c2 c3 c4 c5 c6 c7 c8 c9 c10 c11 c12 c13 c14 | "
+         "cmd d1 d2 d3 d4 d5 d6 d7 d8 d9 d10 d11 d12 d13 d14 | "
+         "cmd e1 e2 e3 e4 e5 e6 e7 e8 e9 e10 e11 e12 e13 e14 | "
+         "cmd f1 f2 f3 f4 f5 f6 f7 f8 f9 f10 f11 f12 f13 f14 | "
+         "cmd g1 g2 g3 g4 g5 g6 g7 g8 g9 g10 g11 g12 g13 g14 | "
+         "cmd h1 h2 h3 h4 h5 h6 h7 h8 h9 h10 h11 h12 h13 h14 > out &"},
+        {"ls *.nomatch"},
+        {"make clean && make -j8 > build.log || tail build.log; echo done"},
+    };
+    const char *names[] = {
+        "parse_line/short",
+        "parse_line/3-stage+redirects",
+        "parse_line/long (8x15 words)",
+        "parse_line/glob",
+        "parse_line/list",
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+        bench_adaptive(names[i], parse_once, &cases[i]);
+    return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * Measures PATH resolution, as run_command() does it before spawning:
+ * through the command hash when it is warm, and with a cold hash, which
+ * searches the path table.
+ *
+ * Usage: path
+ */
+
+#include "harness.h"
+#include "../src/jobs.h"
+#include "../src/utils/cmd_hash.h"
+
+static const char *names[] = {"ls", "cat", "grep", "sort", "sh", "env", "true", "wc"};
+#define NAME_COUNT (sizeof(names) / sizeof(names[0]))
+
+static void resolve_warm(void *ctx, long i) {
+    (void) ctx;
+    resolve_command(names[i % NAME_COUNT]);
+}
+
+static void resolve_cold(void *ctx, long i) {
+    (void) ctx;
+    cmd_hash_reset();
+    resolve_command(names[i % NAME_COUNT]);
+}
+
+static void resolve_missing(void *ctx, long i) {
+    (void) ctx;
+    cmd_hash_reset();
+    resolve_command("no-such-command-anywhere");
+}
+
+int main(void) {
+    if (init_path()) return 1;
+
+    bench_adaptive("path/resolve/hashed", resolve_warm, NULL);
+    bench_adaptive("path/resolve/cold", resolve_cold, NULL);
+    bench_adaptive("path/resolve/cold-miss", resolve_missing, NULL);
+    return 0;
+}
@@ -0,0 +1,96 @@
+/*
+ * Measures how many short-lived children each spawn backend can start per
+ * second, with and without a large resident set in the parent.
+ *
+ * Usage: spawn [-n count] [-m ballast_mb] [binary]
+ */
+
+#define _GNU_SOURCE
+
+#include "../src/spawn.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *backends[] = {"fork", "posix_spawn", "vfork"};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Spawn and reap count children, and return the rate in spawns/sec */
+static double run(const char *backend, char *binary, int count, int out) {
+    char *args[] = {binary, NULL};
+    pid_t pid;
+
+    set_spawn_backend(backend);
+    double start = now();
+    for (int i = 0; i < count; i++) {
+        int rv = spawn_process(binary, args, STDIN_FILENO, out, -1, &pid);
+        if (rv < 0) {
+            fprintf(stderr, "%s: spawn failed: %s\n", backend, strerror(-rv));
+            exit(1);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    return count / (now() - start);
+}
+
+int main(int argc, char **argv) {
+    int count = 2000;
+    long ballast_mb = 256;
+    char *binary = "/bin/true";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:m:")) != -1) {
+        switch (opt) {
+            case 'n':
+                count = atoi(optarg);
+                break;
+            case 'm':
+                ballast_mb = atol(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n count] [-m ballast_mb] [binary]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (optind < argc) binary = argv[optind];
+
+    int out = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (out < 0) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    printf("%-12s %10s %14s\n", "backend", "rss(MB)", "spawns/sec");
+    for (int pass = 0; pass < 2; pass++) {
+        long mb = pass ? ballast_mb : 0;
+        char *ballast = NULL;
+
+        /* Touch every page, so fork() has page tables to copy */
+        if (mb) {
+            ballast = malloc(mb << 20);
+            if (!ballast) {
+                perror("malloc ballast");
+                return 1;
+            }
+            memset(ballast, 1, mb << 20);
+        }
+
+        for (int i = 0; i < (int) (sizeof(backends) / sizeof(*backends)); i++) {
+            double rate = run(backends[i], binary, count, out);
+            printf("%-12s %10ld %14.0f\n", backends[i], mb, rate);
+        }
+        free(ballast);
+    }
+
+    close(out);
+    return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * Measures insert() and find_suggestion() on the completion trie, with the
+ * executables on this machine's PATH, and with a larger synthetic corpus.
+ *
+ * Usage: trie
+ */
+
+#include "harness.h"
+#include "../src/utils/trie.h"
+#include <ctype.h>
+#include <limits.h>
+
+#define SYNTHETIC_NAMES 20000
+
+struct corpus {
+    char **names;
+    int count;
+    int cap;
+    Trie *root;
+    int prefix_len; // Length of the queries for find_suggestion()
+};
+
+static void add_name(struct corpus *c, const char *name) {
+    for (const char *p = name; *p; p++)
+        if (!isascii((unsigned char) *p) || !isprint((unsigned char) *p)) return;
+    if (c->count == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 1024;
+        c->names = realloc(c->names, c->cap * sizeof(char *));
+    }
+    c->names[c->count++] = strdup(name);
+}
+
+/* Every executable name in the directories of PATH, as populate_trie()
+ * would see them */
+static void path_corpus(struct corpus *c) {
+    char *path = strdup(getenv("PATH") ?: "/usr/bin:/bin");
+
+    for (char *dir = strtok(path, ":"); dir; dir = strtok(NULL, ":")) {
+        DIR *d = opendir(dir);
+        struct dirent *ent;
+        if (!d) continue;
+        while ((ent = readdir(d))) {
+            char full[PATH_MAX];
+            snprintf(full, sizeof(full), "%s/%s", dir, ent->d_name);
+            if (ent->d_name[0] != '.' && access(full, X_OK) == 0) add_name(c, ent->d_name);
+        }
+        closedir(d);
+    }
+    free(path);
+}
+
+/* Names that share prefixes the way real tool suites do: git-*, x86_64-*,
+ * python3.*, and so on */
+static void synthetic_corpus(struct corpus *c) {
+    const char *stems[] = {"git-", "x86_64-linux-gnu-", "python3.", "perl", "lib",
+                           "ssh-", "gcc-", "systemd-", "k", "dpkg-"};
+    char name[64];
+    unsigned seed = 42;
+
+    for (int i = 0; i < SYNTHETIC_NAMES; i++) {
+        seed = seed * 1103515245 + 12345;
+        int len = snprintf(name, sizeof(name), "%s", stems[seed % 10]);
+        for (int k = 0; k < 3 + (int) (seed >> 8) % 8; k++) {
+            seed = seed * 1103515245 + 12345;
+            name[len++] = 'a' + (seed >> 16) % 26;
+        }
+        name[len] = '\0';
+        add_name(c, name);
+    }
+}
+
+static void free_trie(Trie *node) {
+    for (int i = 0; i < ALPHABET_SIZE; i++)
+        if (node->children[i]) free_trie(node->children[i]);
+    free(node);
+}
+
+static void insert_one(void *ctx, long i) {
+    struct corpus *c = ctx;
+    insert(c->root, c->names[i]);
+}
+
+static void find_one(void *ctx, long i) {
+    struct corpus *c = ctx;
+    char query[64];
+    int count;
+
+    /* Walk the corpus with a stride, so queries are spread over it */
+    snprintf(query, sizeof(query), "%.*s", c->prefix_len, c->names[(i * 7919) % c->count]);
+    char **suggestions = find_suggestion(c->root, query, &count);
+    for (int k = 0; k < count; k++) free(suggestions[k]);
+    free(suggestions);
+}
+
+static void run_corpus(const char *label, struct corpus *c) {
+    char name[64];
+
+    printf("# %s: %d names\n", label, c->count);
+    if (!c->count) return;
+
+    c->root = get_node();
+    snprintf(name, sizeof(name), "trie/insert/%s", label);
+    bench_fixed(name, insert_one, c, c->count);
+
+    for (c->prefix_len = 2; c->prefix_len <= 6; c->prefix_len += 2) {
+        snprintf(name, sizeof(name), "trie/find_suggestion/%s/prefix%d", label, c->prefix_len);
+        bench_adaptive(name, find_one, c);
+    }
+    free_trie(c->root);
+}
+
+int main(void) {
+    struct corpus path = {0}, synthetic = {0};
+
+    path_corpus(&path);
+    synthetic_corpus(&synthetic);
+    run_corpus("path", &path);
+    run_corpus("synthetic", &synthetic);
+    return 0;
+}
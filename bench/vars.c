@@ -0,0 +1,75 @@
+/*
+ * Measures the variable store: looking up a variable among a few hundred,
+ * setting one, handing the commands their environment while nothing
+ * exported changes, and while something does, and expanding a line with
+ * variables in it.
+ *
+ * Usage: vars
+ */
+
+#include "harness.h"
+#include "../src/parse.h"
+#include "../src/vars.h"
+#include <string.h>
+
+#define VARS 300
+
+static void get_once(void *ctx, long i) {
+    static const char *names[] = {"VAR0", "VAR150", "VAR299", "NOPE"};
+    long *found = ctx;
+    *found += get_var(names[i & 3]) != NULL;
+}
+
+static void set_once(void *ctx, long i) {
+    (void) ctx;
+    set_var("COUNTER", (i & 1) ? "odd" : "even");
+}
+
+static void environ_once(void *ctx, long i) {
+    long *count = ctx;
+    *count += vars_environ()[0] != NULL;
+}
+
+static void environ_changed(void *ctx, long i) {
+    long *count = ctx;
+    set_var("EXPORTED", (i & 1) ? "odd" : "even");
+    *count += vars_environ()[0] != NULL;
+}
+
+static void expand_once(void *ctx, long i) {
+    static struct arena arena;
+    const char *text = ctx;
+    char line[256];
+    struct pipeline p;
+
+    (void) i;
+    strcpy(line, text);
+    parse_line(line, strlen(line), &p, &arena);
+    arena_reset(&arena);
+}
+
+int main(void) {
+    char name[16], value[16];
+    long count = 0;
+
+    for (int i = 0; i < VARS; i++) {
+        snprintf(name, sizeof(name), "VAR%d", i);
+        snprintf(value, sizeof(value), "value%d", i);
+        set_var(name, value);
+        if (i % 3 == 0) export_var(name, true);
+    }
+    set_var("EXPORTED", "");
+    export_var("EXPORTED", true);
+    char *elements[] = {"a", "b", "c", "d"};
+    set_var_array("ARRAY", elements, 4);
+
+    bench_adaptive("vars/get", get_once, &count);
+    bench_adaptive("vars/set", set_once, NULL);
+    bench_adaptive("vars/environ (unchanged)", environ_once, &count);
+    bench_adaptive("vars/environ (exported var set)", environ_changed, &count);
+    bench_adaptive("expand/echo $VAR1 ${VAR2}", expand_once, "echo $VAR1 ${VAR2}");
+    bench_adaptive("expand/echo ${ARRAY[@]} ${#ARRAY[@]}", expand_once,
+                   "echo ${ARRAY[@]} ${#ARRAY[@]}");
+    bench_adaptive("expand/X=1 Y=$VAR3 cmd", expand_once, "X=1 Y=$VAR3 cmd");
+    return count < 0;
+}
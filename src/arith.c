@@ -0,0 +1,400 @@
+/*
+ * Implementation of arith.h.
+ *
+ * A recursive descent parser that evaluates as it parses, with no tree in
+ * between: each level of precedence is a function, and the binary
+ * operators are climbed from a table.  The operands that &&, || and ?:
+ * skip are still parsed, to find where they end, but with side effects
+ * and errors of value turned off.  The arithmetic is done on uint64_t, so
+ * overflow wraps around rather than being undefined.
+ */
+
+#define _GNU_SOURCE
+
+#include "arith.h"
+#include "vars.h"
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct arith {
+    const char *expr;  // The whole expression, to report errors with
+    const char *s;     // The next byte to parse
+    bool skip;         // In an operand that is not evaluated
+    int depth;         // How many variables' values this is inside of
+    int error;         // The first error, as -errno
+};
+
+/* A variable that can be assigned: name, or name[index] */
+struct lvalue {
+    const char *name;
+    size_t len;
+    bool indexed;
+    int64_t index;
+};
+
+/* The binary operators, longest first where one starts another, with the
+ * bytes that must not follow each one, as they would make it another */
+struct binary_op {
+    const char *text;
+    const char *not_before;
+    int prec;
+    char code;
+};
+
+static const struct binary_op binary_ops[] = {
+    {"||", "",   1,  'o'},
+    {"&&", "",   2,  'a'},
+    {"|",  "=",  3,  '|'},
+    {"^",  "=",  4,  '^'},
+    {"&",  "=",  5,  '&'},
+    {"==", "",   6,  'e'},
+    {"!=", "",   6,  'n'},
+    {"<<", "=",  8,  'L'},
+    {">>", "=",  8,  'R'},
+    {"<=", "",   7,  'l'},
+    {">=", "",   7,  'g'},
+    {"<",  "<",  7,  '<'},
+    {">",  ">",  7,  '>'},
+    {"+",  "=",  9,  '+'},
+    {"-",  "=",  9,  '-'},
+    {"**", "",   11, 'P'},
+    {"*",  "=",  10, '*'},
+    {"/",  "=",  10, '/'},
+    {"%",  "=",  10, '%'},
+    {NULL, NULL, 0,  0},
+};
+
+/* The assignment operators, and the binary operator each one applies */
+static const struct {
+    const char *text;
+    char code;
+} assign_ops[] = {
+    {"<<=", 'L'}, {">>=", 'R'}, {"+=", '+'}, {"-=", '-'}, {"*=", '*'}, {"/=", '/'},
+    {"%=", '%'}, {"&=", '&'}, {"^=", '^'}, {"|=", '|'}, {"=", '='}, {NULL, 0},
+};
+
+/* Record an error, reporting it if it is the first.  Returns 0, as the
+ * value of whatever failed. */
+static int64_t fail(struct arith *a, int error, const char *msg) {
+    if (a->error) return 0;
+    a->error = error;
+    if (*a->s)
+        dprintf(2, "thsh: %s: %s (error token is \"%s\")\n", a->expr, msg, a->s);
+    else
+        dprintf(2, "thsh: %s: %s\n", a->expr, msg);
+    return 0;
+}
+
+static void skip_space(struct arith *a) {
+    while (isspace((unsigned char) *a->s)) a->s++;
+}
+
+/* Take op if it comes next, and none of the bytes of not_before after it */
+static bool accept(struct arith *a, const char *op, const char *not_before) {
+    skip_space(a);
+    size_t len = strlen(op);
+    if (strncmp(a->s, op, len) != 0 || (a->s[len] && strchr(not_before, a->s[len])))
+        return false;
+    a->s += len;
+    return true;
+}
+
+static int64_t comma(struct arith *a);
+static int64_t assignment(struct arith *a);
+static int64_t unary(struct arith *a);
+
+/* The value of a digit, in any base up to 64, or 64 for none */
+static int digit_value(char c, int base) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'Z') return c - 'A' + (base <= 36 ? 10 : 36);
+    if (c == '@') return 62;
+    if (c == '_') return 63;
+    return 64;
+}
+
+static int64_t number(struct arith *a) {
+    const char *s = a->s;
+    int base = 10;
+
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        base = 16;
+        s += 2;
+    } else if (s[0] == '0') {
+        base = 8;
+    } else {
+        /* base#digits */
+        const char *hash = s;
+        while (isdigit((unsigned char) *hash)) hash++;
+        if (*hash == '#') {
+            base = atoi(s);
+            if (base < 2 || base > 64) return fail(a, -EINVAL, "invalid arithmetic base");
+            s = hash + 1;
+        }
+    }
+
+    uint64_t value = 0;
+    const char *digits = s;
+    for (; isalnum((unsigned char) *s) || *s == '@' || *s == '_'; s++) {
+        int d = digit_value(*s, base);
+        if (d >= base) return fail(a, -EINVAL, "value too great for base");
+        value = value * base + d;
+    }
+    if (s == digits && base != 8) return fail(a, -EINVAL, "invalid number");
+    a->s = s;
+    return (int64_t) value;
+}
+
+/* Parse a name, or name[index], if one comes next */
+static bool lvalue(struct arith *a, struct lvalue *lv) {
+    skip_space(a);
+    size_t len = var_name_length(a->s);
+    if (!len) return false;
+
+    lv->name = a->s;
+    lv->len = len;
+    lv->indexed = false;
+    a->s += len;
+    if (*a->s == '[') {
+        a->s++;
+        lv->index = comma(a);
+        if (!accept(a, "]", "")) fail(a, -EINVAL, "`]' expected");
+        lv->indexed = true;
+    }
+    return true;
+}
+
+static int64_t value_of(struct arith *a, const struct lvalue *lv) {
+    char name[lv->len + 1];
+    memcpy(name, lv->name, lv->len);
+    name[lv->len] = '\0';
+
+    const char *text;
+    if (lv->indexed) {
+        char key[24];
+        snprintf(key, sizeof(key), "%" PRId64, lv->index);
+        text = get_var_element(name, key);
+    } else {
+        text = get_var(name);
+    }
+    if (!text || !*text) return 0;
+
+    /* A plain decimal number, as counters hold, needs no parsing */
+    char *end;
+    errno = 0;
+    long long value = strtoll(text, &end, 10);
+    if (!*end && !errno && (text[0] != '0' || !text[1]) && !isspace((unsigned char) text[0]))
+        return value;
+
+    /* Anything else is an expression of its own; its text is copied, as
+     * evaluating it may change the variable */
+    if (a->depth == ARITH_MAX_DEPTH)
+        return fail(a, -ELOOP, "expression recursion level exceeded");
+    char *copy = strdup(text);
+    if (!copy) return fail(a, -ENOMEM, "out of memory");
+
+    struct arith inner = {copy, copy, a->skip, a->depth + 1, 0};
+    int64_t result = comma(&inner);
+    skip_space(&inner);
+    if (!inner.error && *inner.s) fail(&inner, -EINVAL, "syntax error in expression");
+    free(copy);
+    if (inner.error && !a->error) a->error = inner.error;
+    return result;
+}
+
+static void store(struct arith *a, const struct lvalue *lv, int64_t value) {
+    if (a->skip || a->error) return;
+
+    char name[lv->len + 1], text[24];
+    memcpy(name, lv->name, lv->len);
+    name[lv->len] = '\0';
+    snprintf(text, sizeof(text), "%" PRId64, value);
+
+    int rv;
+    if (lv->indexed) {
+        char key[24];
+        snprintf(key, sizeof(key), "%" PRId64, lv->index);
+        rv = set_var_element(name, key, text);
+    } else {
+        rv = set_var(name, text);
+    }
+    if (rv < 0) fail(a, rv, "cannot assign");
+}
+
+/* Apply a binary operator, as its code in binary_ops has it */
+static int64_t apply(struct arith *a, char code, int64_t x, int64_t y) {
+    uint64_t ux = x, uy = y;
+
+    switch (code) {
+        case 'o': return x || y;
+        case 'a': return x && y;
+        case '|': return x | y;
+        case '^': return x ^ y;
+        case '&': return x & y;
+        case 'e': return x == y;
+        case 'n': return x != y;
+        case 'l': return x <= y;
+        case 'g': return x >= y;
+        case '<': return x < y;
+        case '>': return x > y;
+        case 'L': return (int64_t) (ux << (uy & 63));
+        case 'R': return x >> (uy & 63);
+        case '+': return (int64_t) (ux + uy);
+        case '-': return (int64_t) (ux - uy);
+        case '*': return (int64_t) (ux * uy);
+        case '/':
+        case '%':
+            if (!y) return a->skip ? 0 : fail(a, -EDOM, "division by zero");
+            /* The one quotient that does not fit */
+            if (x == INT64_MIN && y == -1) return code == '/' ? x : 0;
+            return code == '/' ? x / y : x % y;
+        case 'P': {
+            if (y < 0) return a->skip ? 0 : fail(a, -EDOM, "exponent less than 0");
+            uint64_t result = 1;
+            for (; uy; uy >>= 1, ux *= ux)
+                if (uy & 1) result *= ux;
+            return (int64_t) result;
+        }
+    }
+    return 0;
+}
+
+/* The operand of a binary operator: anything that binds tighter */
+static int64_t operand(struct arith *a) {
+    skip_space(a);
+
+    if (accept(a, "(", "")) {
+        int64_t value = comma(a);
+        if (!accept(a, ")", "")) return fail(a, -EINVAL, "`)' expected");
+        return value;
+    }
+    if (isdigit((unsigned char) *a->s)) return number(a);
+
+    struct lvalue lv;
+    if (!lvalue(a, &lv)) return fail(a, -EINVAL, "syntax error: operand expected");
+    int64_t value = value_of(a, &lv);
+    if (accept(a, "++", "")) store(a, &lv, (int64_t) ((uint64_t) value + 1));
+    else if (accept(a, "--", "")) store(a, &lv, (int64_t) ((uint64_t) value - 1));
+    return value;
+}
+
+static int64_t unary(struct arith *a) {
+    skip_space(a);
+
+    /* ++name and --name, or else two signs */
+    if ((a->s[0] == '+' || a->s[0] == '-') && a->s[1] == a->s[0]) {
+        const char *sign = a->s;
+        struct lvalue lv;
+        a->s += 2;
+        if (lvalue(a, &lv)) {
+            int64_t value = (int64_t) ((uint64_t) value_of(a, &lv) + (*sign == '+' ? 1 : -1));
+            store(a, &lv, value);
+            return value;
+        }
+        a->s = sign + 1;
+        int64_t value = unary(a);
+        return *sign == '+' ? value : (int64_t) (0 - (uint64_t) value);
+    }
+
+    if (accept(a, "-", "=")) return (int64_t) (0 - (uint64_t) unary(a));
+    if (accept(a, "+", "=")) return unary(a);
+    if (accept(a, "!", "=")) return !unary(a);
+    if (accept(a, "~", "")) return ~unary(a);
+    return operand(a);
+}
+
+/* The binary operators from min_prec up, by precedence climbing; only **
+ * groups to the right */
+static int64_t binary(struct arith *a, int min_prec) {
+    int64_t x = unary(a);
+
+    while (!a->error) {
+        const struct binary_op *op = binary_ops;
+        skip_space(a);
+        for (; op->text; op++)
+            if (op->text[0] == *a->s && op->prec >= min_prec &&
+                accept(a, op->text, op->not_before))
+                break;
+        if (!op->text) break;
+
+        /* The right of && and || only counts if the left does not decide */
+        bool skip = a->skip;
+        if ((op->code == 'o' && x) || (op->code == 'a' && !x)) a->skip = true;
+        int64_t y = binary(a, op->code == 'P' ? op->prec : op->prec + 1);
+        a->skip = skip;
+        x = apply(a, op->code, x, y);
+    }
+    return x;
+}
+
+static int64_t ternary(struct arith *a) {
+    int64_t cond = binary(a, 1);
+    if (a->error || !accept(a, "?", "")) return cond;
+
+    bool skip = a->skip;
+    a->skip = skip || !cond;
+    int64_t then = assignment(a);
+    a->skip = skip;
+    if (!accept(a, ":", "")) return fail(a, -EINVAL, "`:' expected for conditional expression");
+    a->skip = skip || cond;
+    int64_t otherwise = ternary(a);
+    a->skip = skip;
+    return cond ? then : otherwise;
+}
+
+static int64_t assignment(struct arith *a) {
+    const char *start = a->s;
+    bool skip = a->skip;
+    struct lvalue lv;
+
+    /* Look for name = first, without the side effects of an index, which
+     * is parsed again, for real, if it is an assignment */
+    a->skip = true;
+    bool found = lvalue(a, &lv);
+    a->skip = skip;
+    if (!found || a->error) {
+        a->s = start;
+        return ternary(a);
+    }
+
+    int op = 0;
+    for (; assign_ops[op].text; op++)
+        if (accept(a, assign_ops[op].text, assign_ops[op].code == '=' ? "=" : ""))
+            break;
+    a->s = start;
+    if (!assign_ops[op].text) return ternary(a);
+
+    lvalue(a, &lv);
+    accept(a, assign_ops[op].text, "");
+    int64_t value = assignment(a);
+    if (assign_ops[op].code != '=')
+        value = apply(a, assign_ops[op].code, value_of(a, &lv), value);
+    store(a, &lv, value);
+    return value;
+}
+
+static int64_t comma(struct arith *a) {
+    int64_t value = assignment(a);
+    while (!a->error && accept(a, ",", "")) value = assignment(a);
+    return value;
+}
+
+int arith_eval(const char *expr, int64_t *result) {
+    struct arith a = {expr, expr, false, 0, 0};
+
+    skip_space(&a);
+    *result = 0;
+    if (!*a.s) return 0;
+
+    int64_t value = comma(&a);
+    skip_space(&a);
+    if (!a.error && *a.s) fail(&a, -EINVAL, "syntax error in expression");
+    if (a.error) return a.error;
+    *result = value;
+    return 0;
+}
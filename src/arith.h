@@ -0,0 +1,42 @@
+/*
+ *  Shell arithmetic, as $((...)) and let evaluate it: 64-bit signed
+ *  integers, the operators of C with ** for powers, and assignments to the
+ *  shell's variables, all in the shell's own process.
+ */
+
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stdint.h>
+
+/**
+ * How deep the value of a variable may be an expression naming another
+ * variable, whose value is one in turn, before evaluation gives up on
+ * what is likely a loop, such as a=b b=a.
+ */
+#define ARITH_MAX_DEPTH 64
+
+/**
+ * Evaluates an arithmetic expression, with bash's operators and their
+ * precedence: ++ and -- before or after a variable, the unary + - ! ~,
+ * then **, * / %, + -, << >>, < <= > >=, == !=, &, ^, |, &&, ||, ?:, the
+ * assignments = += -= *= /= %= <<= >>= &= ^= |=, and ','.  The numbers
+ * are decimal, 0x hexadecimal, 0 octal, or base#digits for bases 2 to 64,
+ * and overflow wraps around.
+ *
+ * A variable, or an element of an array, name[expr], stands for its value,
+ * evaluated as an expression in turn; an unset or empty one is 0.  The
+ * assignments set them as they go, except in an operand that &&, || or
+ * ?: skip.  Errors are reported on stderr, with the expression.
+ *
+ * @param expr The expression, NUL-terminated, with its $ expansions done.
+ *             An empty one is 0.
+ * @param result Returns the value.
+ * @return 0 on success, -EINVAL for a syntax error or a number that does
+ *         not fit its base, -EDOM for a division by 0 or a negative
+ *         exponent, -ELOOP past ARITH_MAX_DEPTH, or -errno if a variable
+ *         cannot be set.
+ */
+int arith_eval(const char *expr, int64_t *result);
+
+#endif // ARITH_H
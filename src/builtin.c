@@ -3,6 +3,7 @@
  */
 
 #include "builtin.h"
+#include "functions.h"
 #include "history.h"
 #include "utils/path_manager.h"
 #include <errno.h>
@@ -86,6 +87,21 @@ static struct builtin builtins[] = {{"cd",      handle_cd},
 //                                    {"goheels", handle_goheels},
                                     {"history", handle_history},
                                     {"clear",   handle_clear},
+                                    {"hash",    handle_hash},
+                                    {"jobs",    handle_jobs},
+                                    {"fg",      handle_fg},
+                                    {"bg",      handle_bg},
+                                    {"wait",    handle_wait},
+                                    {"parallel", handle_parallel},
+                                    {"bench",   handle_bench},
+                                    {"echo",    handle_echo},
+                                    {"pwd",     handle_pwd},
+                                    {"export",  handle_export},
+                                    {"unset",   handle_unset},
+                                    {"declare", handle_declare},
+                                    {"alias",   handle_alias},
+                                    {"unalias", handle_unalias},
+                                    {"let",     handle_let},
                                     {NULL,      NULL}};
 
 /*
@@ -110,6 +126,17 @@ char **get_builtin_names() {
     return command_names;
 }
 
+/*
+ * This function returns whether a command name is a builtin, or a function,
+ * which runs like one.
+ */
+bool is_builtin(const char *name) {
+    if (is_function(name)) return true;
+    for (int i = 0; builtins[i].cmd != NULL; ++i)
+        if (strcmp(builtins[i].cmd, name) == 0) return true;
+    return false;
+}
+
 /* This function checks if the command (args[0]) is a built-in.
  * If so, call the appropriate handler, and return 1.
  * If not, return 0.
@@ -117,13 +144,24 @@ char **get_builtin_names() {
  * stdin and stdout are the file handles for standard in and standard out,
  * respectively. These may or may not be used by individual builtin commands.
  *
- * Places the return value of the command in *retval.
+ * Places the return value of the command in *retval: 0 on success,
+ * -errno on failure, or a positive exit status for a builtin that, like a
+ * test, fails without an error.  A function comes before a builtin of the
+ * same name; its return value is its exit status, or -errno if it could
+ * not be called.
  *
  * stdin and stdout should not be closed by this command.
  *
  * In the case of "exit", this function will not return.
  */
 int handle_builtin(char *args[MAX_ARG_SIZE], int stdin, int stdout, int *retval) {
+    if (is_function(args[0])) {
+        int status;
+        int rv = call_function(args, stdin, stdout, &status);
+        *retval = rv ? rv : status;
+        return 1;
+    }
+
     /* Since an array of builtins is already provided, checking is a matter
      * of a looping and checking if the command matches.
      */
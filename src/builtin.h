@@ -1,3 +1,5 @@
+#include <stdbool.h>
+
 #define MAX_ARG_SIZE 256
 
 int handle_builtin(char *args[MAX_ARG_SIZE], int stdin, int stdout, int *retval);
@@ -6,6 +8,38 @@ int print_prompt(void);
 
 char **get_builtin_names(void);
 
+bool is_builtin(const char *name);
+
 int handle_cd(char *args[MAX_ARG_SIZE], int stdin, int stdout);
 
 int handle_exit(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_hash(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_jobs(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_fg(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_bg(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_wait(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_parallel(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_bench(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_echo(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_pwd(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_export(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_unset(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_declare(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_alias(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_unalias(char *args[MAX_ARG_SIZE], int stdin, int stdout);
+
+int handle_let(char *args[MAX_ARG_SIZE], int stdin, int stdout);
@@ -0,0 +1,87 @@
+#include "../builtin.h"
+#include "../functions.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The length of the alias name a NAME=value argument starts with, or 0 if
+ * it is not one */
+static size_t definition_name(const char *arg) {
+    const char *eq = strchr(arg, '=');
+    if (!eq || eq == arg || arg[0] == '-') return 0;
+    return eq - arg;
+}
+
+/* Handle an alias command.
+ *
+ * alias                   lists the aliases
+ * alias name...           prints each one
+ * alias name=value...     defines each one
+ *
+ * The shell has no quotes, so the words after a name=value that do not
+ * define an alias of their own are the rest of its value: `alias ll=ls -l`
+ * stands for "ls -l".  The arguments are left as they are: they may be the
+ * text of a compiled script.
+ */
+int handle_alias(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    int i = 1, rv = 0;
+
+    if (args[i] && strcmp(args[i], "-p") == 0) i++;
+    if (!args[i]) return print_aliases(stdout, NULL);
+
+    while (args[i]) {
+        size_t n = definition_name(args[i]);
+        if (!n) {
+            if (print_aliases(stdout, args[i]) < 0) {
+                dprintf(2, "thsh: alias: %s: not found\n", args[i]);
+                rv = -ENOENT;
+            }
+            i++;
+            continue;
+        }
+
+        /* The value, and the words that go on with it */
+        size_t len = strlen(args[i]);
+        int last = i + 1;
+        for (; args[last] && !definition_name(args[last]); last++)
+            len += strlen(args[last]) + 1;
+
+        char *name = malloc(len + 1);
+        if (!name) return -ENOMEM;
+        char *value = name + n + 1, *at = stpcpy(name, args[i]);
+        name[n] = '\0';
+        for (int k = i + 1; k < last; k++) {
+            *at++ = ' ';
+            at = stpcpy(at, args[k]);
+        }
+
+        int err = set_alias(name, value);
+        if (err == -EINVAL) dprintf(2, "thsh: alias: `%s': invalid alias name\n", name);
+        if (err) rv = err;
+        free(name);
+        i = last;
+    }
+    return rv;
+}
+
+/* Handle an unalias command: forget each alias, or with -a, all of them. */
+int handle_unalias(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    int rv = 0;
+
+    if (!args[1]) {
+        dprintf(2, "usage: unalias [-a] name [name ...]\n");
+        return -EINVAL;
+    }
+    if (strcmp(args[1], "-a") == 0) {
+        clear_aliases();
+        return 0;
+    }
+    for (int i = 1; args[i]; i++) {
+        if (unset_alias(args[i]) < 0) {
+            dprintf(2, "thsh: unalias: %s: not found\n", args[i]);
+            rv = -ENOENT;
+        }
+    }
+    return rv;
+}
@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+
+#include "../builtin.h"
+#include "../jobs.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_SEPARATOR "--"
+#define BENCH_DEFAULT_RUNS 10
+
+/* Beyond this modified Z-score, a run counts as an outlier */
+#define OUTLIER_SCORE 3.5
+
+/* The statistics of one benchmarked command */
+struct bench_stats {
+    char **args;
+    int runs;
+    double mean;
+    double stddev;
+    double median;
+    double min;
+    double max;
+    double user;   // Mean user time
+    double sys;    // Mean system time
+    int outliers;
+};
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+static double median_of(double *sorted, int n) {
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+/* Run the command once, as its own job, with stdin and stdout on
+ * /dev/null.  Returns the exit code, or negative errno. */
+static int run_once(char **args, int devnull, struct proc_usage *usage) {
+    int job_id = create_job(args[0]);
+    if (job_id < 0) return job_id;
+
+    int rv = run_command(args, devnull, devnull, job_id);
+    if (rv < 0) {
+        await_job(job_id, NULL);
+        return rv;
+    }
+
+    int code, count = 1;
+    wait_on_job_usage(job_id, &code, usage, &count);
+    return count ? code : 128 + SIGTSTP;
+}
+
+static void print_args(int fd, char **args) {
+    for (int i = 0; args[i]; i++)
+        dprintf(fd, "%s%s", i ? " " : "", args[i]);
+}
+
+/* Pick a unit the times read well in */
+static const char *time_unit(double seconds, double *scale) {
+    if (seconds < 1e-3) {
+        *scale = 1e6;
+        return "us";
+    }
+    if (seconds < 1) {
+        *scale = 1e3;
+        return "ms";
+    }
+    *scale = 1;
+    return "s";
+}
+
+static int bench_command(struct bench_stats *st, int runs, int warmups, int devnull,
+                         int stdout) {
+    double *times = malloc(runs * sizeof(double));
+    struct proc_usage usage;
+    int code = 0;
+
+    if (!times) return -ENOMEM;
+
+    for (int i = 0; i < warmups + runs; i++) {
+        code = run_once(st->args, devnull, &usage);
+        if (code) break;
+        if (i < warmups) continue;
+
+        times[st->runs++] = usage.real;
+        st->user += usage.usage.ru_utime.tv_sec + usage.usage.ru_utime.tv_usec / 1e6;
+        st->sys += usage.usage.ru_stime.tv_sec + usage.usage.ru_stime.tv_usec / 1e6;
+    }
+
+    if (code) {
+        dprintf(2, "thsh: bench: ");
+        print_args(2, st->args);
+        if (code < 0) dprintf(2, ": %s\n", strerror(-code));
+        else dprintf(2, ": exited with %d, stopping\n", code);
+        free(times);
+        return code < 0 ? code : -ECANCELED;
+    }
+
+    int n = st->runs;
+    for (int i = 0; i < n; i++) st->mean += times[i] / n;
+    for (int i = 0; i < n; i++) st->stddev += (times[i] - st->mean) * (times[i] - st->mean);
+    st->stddev = n > 1 ? sqrt(st->stddev / (n - 1)) : 0;
+    st->user /= n;
+    st->sys /= n;
+
+    qsort(times, n, sizeof(double), compare_doubles);
+    st->min = times[0];
+    st->max = times[n - 1];
+    st->median = median_of(times, n);
+
+    /* Outliers by the modified Z-score, which, unlike the mean and standard
+     * deviation, is not dragged along by the outliers themselves */
+    double *deviations = malloc(n * sizeof(double));
+    if (deviations) {
+        for (int i = 0; i < n; i++) deviations[i] = fabs(times[i] - st->median);
+        qsort(deviations, n, sizeof(double), compare_doubles);
+        double mad = median_of(deviations, n);
+        for (int i = 0; mad > 0 && i < n; i++)
+            if (0.6745 * fabs(times[i] - st->median) / mad > OUTLIER_SCORE) st->outliers++;
+        free(deviations);
+    }
+    free(times);
+
+    double scale;
+    const char *unit = time_unit(st->mean, &scale);
+    dprintf(stdout, "  Time (mean +/- sd):  %8.3f %s +/- %7.3f %s    [User: %.3f %s, System: %.3f %s]\n",
+            st->mean * scale, unit, st->stddev * scale, unit, st->user * scale, unit,
+            st->sys * scale, unit);
+    dprintf(stdout, "  Range (min ... max): %8.3f %s ... %7.3f %s    %d runs\n",
+            st->min * scale, unit, st->max * scale, unit, n);
+    dprintf(stdout, "  Median:              %8.3f %s\n", st->median * scale, unit);
+    if (st->outliers)
+        dprintf(stdout, "  Warning: %d statistical outlier%s; the system may have been busy\n",
+                st->outliers, st->outliers == 1 ? "" : "s");
+    return 0;
+}
+
+/* Rank the commands against the fastest one */
+static void print_summary(struct bench_stats *stats, int count, int stdout) {
+    int best = 0;
+    for (int i = 1; i < count; i++)
+        if (stats[i].mean < stats[best].mean) best = i;
+
+    struct bench_stats *b = &stats[best];
+    dprintf(stdout, "Summary\n  ");
+    print_args(stdout, b->args);
+    dprintf(stdout, " ran\n");
+    for (int i = 0; i < count; i++) {
+        if (i == best) continue;
+        struct bench_stats *s = &stats[i];
+        double ratio = s->mean / b->mean;
+        /* Propagate the relative errors of both means */
+        double error = ratio * sqrt(pow(s->stddev / s->mean, 2) + pow(b->stddev / b->mean, 2));
+        dprintf(stdout, "    %6.2f +/- %.2f times faster than ", ratio, error);
+        print_args(stdout, s->args);
+        dprintf(stdout, "\n");
+    }
+}
+
+/* Handle a bench command.
+ *
+ * bench [-n runs] [-w warmups] cmd [args...] [-- cmd2 [args...]]...
+ *
+ * Runs each command `runs` times (default 10) after `warmups` untimed runs,
+ * through the same spawn path as any other command, so the numbers do not
+ * include the startup of a wrapper process.  Every run is timed from
+ * launch to reaping, with wait4() rusage for user and system time.  The
+ * report has the mean, standard deviation, median, range and outliers,
+ * and with several commands, how much faster the fastest one is.
+ *
+ * The commands run with stdin and stdout on /dev/null.  Benchmarking stops
+ * at the first run that fails.
+ */
+int handle_bench(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    struct bench_stats *stats;
+    int runs = BENCH_DEFAULT_RUNS, warmups = 0, count = 0;
+    int i = 1, rv = 0;
+
+    for (; args[i] && args[i][0] == '-' && args[i + 1]; i += 2) {
+        if (strcmp(args[i], "-n") == 0 && (runs = atoi(args[i + 1])) > 0) continue;
+        if (strcmp(args[i], "-w") == 0 && (warmups = atoi(args[i + 1])) >= 0) continue;
+        break;
+    }
+    if (!args[i] || args[i][0] == '-' || runs <= 0 || warmups < 0) {
+        dprintf(2, "usage: bench [-n runs] [-w warmups] cmd [args...] [-- cmd [args...]]...\n");
+        return -EINVAL;
+    }
+
+    /* Split the rest into commands at every "--" */
+    int separators = 0;
+    for (int k = i; args[k]; k++)
+        separators += strcmp(args[k], BENCH_SEPARATOR) == 0;
+    if (!(stats = calloc(separators + 1, sizeof(*stats)))) return -ENOMEM;
+
+    for (char **start = &args[i]; *start;) {
+        char **end = start;
+        while (*end && strcmp(*end, BENCH_SEPARATOR) != 0) end++;
+        bool more = *end != NULL;
+        *end = NULL;
+        if (*start) stats[count++].args = start;
+        if (!more) break;
+        start = end + 1;
+    }
+
+    for (int c = 0; c < count; c++) {
+        if (is_builtin(stats[c].args[0])) {
+            dprintf(2, "thsh: bench: %s is a builtin\n", stats[c].args[0]);
+            free(stats);
+            return -EINVAL;
+        }
+    }
+
+    int devnull = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (devnull < 0) {
+        rv = -errno;
+        free(stats);
+        return rv;
+    }
+
+    for (int c = 0; c < count && !rv; c++) {
+        dprintf(stdout, "Benchmark %d: ", c + 1);
+        print_args(stdout, stats[c].args);
+        dprintf(stdout, "\n");
+        rv = bench_command(&stats[c], runs, warmups, devnull, stdout);
+    }
+    close(devnull);
+
+    if (!rv && count > 1) print_summary(stats, count, stdout);
+    free(stats);
+    return rv;
+}
@@ -1,5 +1,6 @@
 #include "../builtin.h"
 #include "../utils/path_manager.h"
+#include "../vars.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,7 +14,7 @@ int handle_cd(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
     char *cur_path = get_current_path();
 
     if (!args[1]) {
-        const char *home = getenv("HOME");
+        const char *home = get_var("HOME");
         if (home == NULL) {
             perror("thsh: cd: HOME not set");
             return -errno;
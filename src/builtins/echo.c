@@ -0,0 +1,79 @@
+#include "../builtin.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Copy one argument to out, interpreting backslash escapes.  Returns false
+ * at \c, which ends the output. */
+static bool unescape(const char *arg, char **out) {
+    static const char from[] = "abefnrtv\\", to[] = "\a\b\x1b\f\n\r\t\v\\";
+
+    for (; *arg; arg++) {
+        if (*arg != '\\' || !arg[1]) {
+            *(*out)++ = *arg;
+            continue;
+        }
+        arg++;
+        if (*arg == 'c') return false;
+
+        const char *escape = strchr(from, *arg);
+        if (escape) {
+            *(*out)++ = to[escape - from];
+        } else if (*arg == '0') {
+            /* \0nnn: up to three octal digits */
+            int value = 0;
+            for (int i = 0; i < 3 && arg[1] >= '0' && arg[1] <= '7'; i++)
+                value = value * 8 + (*++arg - '0');
+            *(*out)++ = value;
+        } else {
+            *(*out)++ = '\\';
+            *(*out)++ = *arg;
+        }
+    }
+    return true;
+}
+
+/* Handle an echo command.
+ *
+ * echo [-neE] [arg...]
+ *
+ * Like coreutils echo: -n drops the final newline, -e interprets backslash
+ * escapes, and -E (the default) does not.  The line goes out in a single
+ * write, so it is not interleaved with other output into the same pipe.
+ */
+int handle_echo(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    bool newline = true, escapes = false;
+    size_t len = 2;
+    int i = 1;
+
+    /* Only words made entirely of these flags are options */
+    for (; args[i] && args[i][0] == '-' && args[i][1]
+           && strspn(args[i] + 1, "neE") == strlen(args[i] + 1); i++) {
+        for (char *flag = args[i] + 1; *flag; flag++) {
+            if (*flag == 'n') newline = false;
+            else escapes = *flag == 'e';
+        }
+    }
+
+    for (int j = i; args[j]; j++) len += strlen(args[j]) + 1;
+    char *line = malloc(len);
+    if (!line) return -ENOMEM;
+
+    char *cursor = line;
+    bool more = true;
+    for (int j = i; args[j] && more; j++) {
+        if (j > i) *cursor++ = ' ';
+        if (escapes) {
+            more = unescape(args[j], &cursor);
+        } else {
+            cursor = stpcpy(cursor, args[j]);
+        }
+    }
+    if (newline && more) *cursor++ = '\n';
+
+    int rv = write(stdout, line, cursor - line) < 0 ? -errno : 0;
+    free(line);
+    return rv;
+}
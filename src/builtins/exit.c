@@ -1,12 +1,21 @@
 #include "../builtin.h"
 #include "../history.h"
+#include "../jobs.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
 int handle_exit(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
-    (void) args;
+    int status = args[1] ? atoi(args[1]) & 0xff : 0;
+
+    /* A copy of the shell, as in $(exit 3), only ends itself, and its
+     * output may be captured */
+    if (in_subshell()) {
+        fflush(NULL);
+        _exit(status);
+    }
     save_history();
     char pre = '\r';
     write(STDOUT_FILENO, &pre, 1);
-    exit(0);
+    exit(status);
 }
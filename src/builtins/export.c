@@ -0,0 +1,139 @@
+#include "../builtin.h"
+#include "../functions.h"
+#include "../vars.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Split a NAME or NAME=value argument into name, which has room for it,
+ * and *value, NULL for a NAME alone.  The argument is left as it is: it
+ * may be the text of a compiled script.  Complains, and returns -EINVAL,
+ * if the name is not one. */
+static int name_value(const char *cmd, const char *arg, char *name, const char **value) {
+    size_t len = var_name_length(arg);
+
+    *value = NULL;
+    if (!len || (arg[len] && arg[len] != '=')) {
+        dprintf(2, "thsh: %s: `%s': not a valid identifier\n", cmd, arg);
+        return -EINVAL;
+    }
+    memcpy(name, arg, len);
+    name[len] = '\0';
+    if (arg[len] == '=') *value = arg + len + 1;
+    return 0;
+}
+
+/* Handle an export command.
+ *
+ * export                 lists the exported variables
+ * export name[=value]... exports each variable, setting it first if given
+ *                        a value
+ * export -n name...      stops exporting each one
+ */
+int handle_export(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    bool exported = true;
+    int i = 1, rv = 0;
+
+    for (; args[i] && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "-n") == 0) {
+            exported = false;
+        } else if (strcmp(args[i], "-p") != 0) {
+            dprintf(2, "usage: export [-n] [-p] [name[=value] ...]\n");
+            return -EINVAL;
+        }
+    }
+    if (!args[i]) {
+        print_vars(stdout, true);
+        return 0;
+    }
+
+    for (; args[i]; i++) {
+        char name[strlen(args[i]) + 1];
+        const char *value;
+        int err = name_value("export", args[i], name, &value);
+        if (!err && value) err = set_var(name, value);
+        if (!err) err = export_var(name, exported);
+        if (err) rv = err;
+    }
+    return rv;
+}
+
+/* Handle an unset command: unset each variable, or with name[key], each
+ * element of an array, or with -f, each function.  A variable that is not
+ * set is not an error. */
+int handle_unset(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    int i = 1, rv = 0;
+
+    if (args[i] && strcmp(args[i], "-f") == 0) {
+        for (i++; args[i]; i++) unset_function(args[i]);
+        return 0;
+    }
+    if (args[i] && strcmp(args[i], "-v") == 0) i++;
+    for (; args[i]; i++) {
+        size_t len = var_name_length(args[i]);
+        const char *close = args[i][len] == '[' ? strchr(args[i], ']') : NULL;
+
+        if (len && close && !close[1]) {
+            char name[len + 1], key[close - args[i] - len];
+            memcpy(name, args[i], len);
+            name[len] = '\0';
+            memcpy(key, args[i] + len + 1, close - args[i] - len - 1);
+            key[close - args[i] - len - 1] = '\0';
+            unset_var_element(name, key);
+        } else if (len && !args[i][len]) {
+            unset_var(args[i]);
+        } else {
+            dprintf(2, "thsh: unset: `%s': not a valid identifier\n", args[i]);
+            rv = -EINVAL;
+        }
+    }
+    return rv;
+}
+
+/* Handle a declare command.
+ *
+ * declare                 lists every variable
+ * declare -a name...      makes each one an indexed array
+ * declare -A name...      makes each one an associative array
+ * declare -x name...      exports each one, and +x stops exporting it
+ *
+ * A name=value sets the variable too, once it has its attributes.
+ */
+int handle_declare(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    enum var_kind kind = VAR_SCALAR;
+    int exported = -1; // Left as it is
+    int i = 1, rv = 0;
+
+    for (; args[i] && (args[i][0] == '-' || args[i][0] == '+') && args[i][1]; i++) {
+        for (char *f = args[i] + 1; *f; f++) {
+            if (*f == 'a' && args[i][0] == '-') kind = VAR_ARRAY;
+            else if (*f == 'A' && args[i][0] == '-') kind = VAR_ASSOC;
+            else if (*f == 'x') exported = args[i][0] == '-';
+            else if (*f != 'p') {
+                dprintf(2, "usage: declare [-aAx] [+x] [-p] [name[=value] ...]\n");
+                return -EINVAL;
+            }
+        }
+    }
+    if (!args[i]) {
+        print_vars(stdout, exported == 1);
+        return 0;
+    }
+
+    for (; args[i]; i++) {
+        char name[strlen(args[i]) + 1];
+        const char *value;
+        int err = name_value("declare", args[i], name, &value);
+        if (err) {
+            rv = err;
+            continue;
+        }
+        if (kind != VAR_SCALAR && (err = declare_var(name, kind)) == -EINVAL)
+            dprintf(2, "thsh: declare: %s: cannot convert\n", name);
+        if (!err && exported >= 0) err = export_var(name, exported);
+        if (!err && value) err = set_var(name, value);
+        if (err) rv = err;
+    }
+    return rv;
+}
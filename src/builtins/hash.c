@@ -0,0 +1,35 @@
+#include "../builtin.h"
+#include "../jobs.h"
+#include "../utils/cmd_hash.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Handle a hash command.
+ *
+ * hash          lists the cached commands and their hit counts
+ * hash -r       forgets every cached command
+ * hash name...  resolves each name now, and caches the result
+ */
+int handle_hash(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    int rv = 0;
+
+    if (!args[1]) {
+        cmd_hash_print(stdout);
+        return 0;
+    }
+
+    if (strcmp(args[1], "-r") == 0) {
+        cmd_hash_reset();
+        return 0;
+    }
+
+    for (int i = 1; args[i]; i++) {
+        cmd_hash_remove(args[i]);
+        if (!resolve_command(args[i])) {
+            dprintf(2, "thsh: hash: %s: not found\n", args[i]);
+            rv = -ENOENT;
+        }
+    }
+    return rv;
+}
@@ -0,0 +1,65 @@
+#include "../builtin.h"
+#include "../jobs.h"
+#include <errno.h>
+#include <stdio.h>
+
+/* Handle a jobs command: list the background jobs. */
+int handle_jobs(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    (void) args;
+    print_jobs(stdout);
+    return 0;
+}
+
+/* Look up the job named by args[1] (the current job if absent) for fg/bg,
+ * and complain on stderr if there is none. */
+static int job_arg(char *args[MAX_ARG_SIZE]) {
+    int job_id = find_job_spec(args[1], false);
+    if (job_id < 0)
+        dprintf(2, "thsh: %s: %s: no such job\n", args[0], args[1] ?: "current");
+    return job_id;
+}
+
+/* Handle a fg command: continue a job in the foreground, and wait on it. */
+int handle_fg(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    int job_id = job_arg(args);
+    if (job_id < 0) return job_id;
+    return resume_job(job_id, true, NULL);
+}
+
+/* Handle a bg command: continue a stopped job in the background. */
+int handle_bg(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    int job_id = job_arg(args);
+    if (job_id < 0) return job_id;
+    return resume_job(job_id, false, NULL);
+}
+
+/* Handle a wait command.
+ *
+ * wait               waits for every background job
+ * wait %n | pid ...  waits for the given jobs, or the jobs of the given pids
+ */
+int handle_wait(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    int job_id;
+
+    if (!args[1]) {
+        while ((job_id = find_job_spec(NULL, false)) > 0) {
+            if (await_job(job_id, NULL) == -EAGAIN) {
+                // Stopped jobs would never finish; leave them be
+                dprintf(2, "thsh: wait: job %d is stopped\n", job_id);
+                return -EAGAIN;
+            }
+        }
+        return 0;
+    }
+
+    for (int i = 1; args[i]; i++) {
+        job_id = find_job_spec(args[i], true);
+        if (job_id < 0) {
+            dprintf(2, "thsh: wait: %s: no such job\n", args[i]);
+            return job_id;
+        }
+        int rv = await_job(job_id, NULL);
+        if (rv < 0) return rv;
+    }
+    return 0;
+}
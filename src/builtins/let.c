@@ -0,0 +1,23 @@
+#include "../builtin.h"
+#include "../arith.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Handle a let command: evaluate each argument as an arithmetic
+ * expression, as $((...)) does, assignments included.  The status is 0
+ * if the last one is not 0, and 1 if it is or if one fails, so `let i++`
+ * and `let x < y` work as tests. */
+int handle_let(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    int64_t value = 0;
+
+    if (!args[1]) {
+        dprintf(2, "thsh: let: expression expected\n");
+        return -EINVAL;
+    }
+    for (int i = 1; args[i]; i++) {
+        // arith_eval() reports the error, which fails the command as bash's does
+        if (arith_eval(args[i], &value)) return 1;
+    }
+    return value == 0;
+}
@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+
+#include "../builtin.h"
+#include "../jobs.h"
+#include "../spawn.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ARG_SEPARATOR ":::"
+#define OUTPUT_CHUNK 4096
+
+/* What a task writes to one of its outputs */
+struct output {
+    int fd;             // Read end of the pipe, or -1 once it is closed
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+/* One invocation of the command template */
+struct task {
+    int seq;            // 1-based position in the argument list
+    char **args;        // NULL-terminated, NULL until the task is built
+    int job_id;
+    struct output out;  // Its stdout
+    struct output err;  // Its stderr
+    struct timespec start;
+    double elapsed;
+    int exit_code;
+    int error;          // Negative errno if the task could not be started
+    bool finished;
+};
+
+static double seconds_since(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Split the lines read from fd into a NULL-terminated array */
+static char **read_arg_lines(int fd, int *count) {
+    size_t len = 0, cap = OUTPUT_CHUNK;
+    char *buf = malloc(cap);
+    ssize_t n;
+
+    while (buf && (n = read(fd, buf + len, cap - len - 1)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        len += n;
+        if (cap - len - 1 == 0) {
+            char *bigger = realloc(buf, cap *= 2);
+            if (!bigger) break;
+            buf = bigger;
+        }
+    }
+    if (!buf) return NULL;
+    buf[len] = '\0';
+
+    char **lines = malloc((len / 2 + 2) * sizeof(char *));
+    *count = 0;
+    if (!lines) {
+        free(buf);
+        return NULL;
+    }
+    for (char *line = strtok(buf, "\n"); line; line = strtok(NULL, "\n"))
+        lines[(*count)++] = strdup(line);
+    lines[*count] = NULL;
+    free(buf);
+    return lines;
+}
+
+/* Instantiate the command template for one argument: every "{}" is replaced
+ * by the argument, or the argument is appended if there is no "{}". */
+static int build_task(struct task *t, char *template[], int words, const char *arg) {
+    bool placed = false;
+    int n = 0;
+
+    /* Room for every word, the argument if it is appended, and the NULL */
+    t->args = calloc(words + 2, sizeof(char *));
+    if (!t->args) return -ENOMEM;
+
+    for (int i = 0; i < words; i++) {
+        char *hole = strstr(template[i], "{}");
+        if (!hole) {
+            t->args[n++] = strdup(template[i]);
+            continue;
+        }
+        size_t len = strlen(template[i]) + strlen(arg);
+        char *word = malloc(len + 1);
+        if (!word) return -ENOMEM;
+        sprintf(word, "%.*s%s%s", (int) (hole - template[i]), template[i], arg, hole + 2);
+        t->args[n++] = word;
+        placed = true;
+    }
+    if (!placed) t->args[n++] = strdup(arg);
+    t->args[n] = NULL;
+    return 0;
+}
+
+static void free_task(struct task *t) {
+    for (int i = 0; t->args && t->args[i]; i++)
+        free(t->args[i]);
+    free(t->args);
+    free(t->out.data);
+    free(t->err.data);
+}
+
+/* Start the task with its stdout and its stderr each going into a pipe of
+ * their own, so neither mixes with the other tasks' */
+static int start_task(struct task *t, int devnull) {
+    int out[2], err[2];
+
+    if (pipe2(out, O_CLOEXEC) < 0) return -errno;
+    if (pipe2(err, O_CLOEXEC) < 0) {
+        close(out[0]);
+        close(out[1]);
+        return -errno;
+    }
+
+    char desc[256];
+    snprintf(desc, sizeof(desc), "parallel: %s", t->args[0]);
+    t->job_id = create_job(desc);
+
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+    set_spawn_stderr(err[1]);
+    int rv = t->job_id < 0 ? t->job_id : run_command(t->args, devnull, out[1], t->job_id);
+    set_spawn_stderr(-1);
+    close(out[1]);
+    close(err[1]);
+    if (rv < 0) {
+        close(out[0]);
+        close(err[0]);
+        if (t->job_id > 0) await_job(t->job_id, NULL);
+        return rv;
+    }
+    t->out.fd = out[0];
+    t->err.fd = err[0];
+    return 0;
+}
+
+/* Read whatever the task wrote to one of its outputs, and close it once
+ * the task has closed its end */
+static void collect_output(struct output *o) {
+    if (o->cap - o->len < OUTPUT_CHUNK) {
+        size_t cap = o->cap ? o->cap * 2 : OUTPUT_CHUNK * 2;
+        char *bigger = realloc(o->data, cap);
+        if (!bigger) goto closed;
+        o->data = bigger;
+        o->cap = cap;
+    }
+
+    ssize_t n = read(o->fd, o->data + o->len, o->cap - o->len);
+    if (n < 0 && errno == EINTR) return;
+    if (n > 0) {
+        o->len += n;
+        return;
+    }
+closed:
+    close(o->fd);
+    o->fd = -1;
+}
+
+static void report_task(struct task *t, int stdout) {
+    if (t->out.len) write(stdout, t->out.data, t->out.len);
+    if (t->err.len) write(STDERR_FILENO, t->err.data, t->err.len);
+
+    dprintf(2, "parallel: [%d] ", t->seq);
+    if (t->error)
+        dprintf(2, "failed to start (%s)", strerror(-t->error));
+    else
+        dprintf(2, "exit %d in %.3fs", t->exit_code, t->elapsed);
+    for (int i = 0; t->args && t->args[i]; i++)
+        dprintf(2, "%s%s", i ? " " : ": ", t->args[i]);
+    dprintf(2, "\n");
+}
+
+/* Print tasks that are finished: right away, or with keep_order, only once
+ * every task before them has been printed.  Returns the number of failed
+ * tasks that got printed. */
+static int flush_tasks(struct task *tasks, struct task *done, int *printed,
+                       bool keep_order, int stdout) {
+    int failed = 0;
+
+    if (!keep_order) {
+        report_task(done, stdout);
+        return done->error || done->exit_code;
+    }
+
+    for (; tasks[*printed].finished; (*printed)++) {
+        report_task(&tasks[*printed], stdout);
+        failed += tasks[*printed].error || tasks[*printed].exit_code;
+    }
+    return failed;
+}
+
+/* Handle a parallel command.
+ *
+ * parallel [-j N] [-k] cmd [args...] ::: arg...
+ * parallel [-j N] [-k] cmd [args...] < lines
+ *
+ * Runs cmd once per argument, at most N (default: the number of online
+ * CPUs) at a time.  Whenever a task finishes, the next argument is handed
+ * to the free slot.  Each task's stdout and stderr are collected in full
+ * and printed in one piece each, in completion order (or argument order
+ * with -k), followed by a line on stderr with its exit status and run
+ * time.
+ *
+ * Returns the number of tasks that failed, at most 101.
+ */
+int handle_parallel(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    long slots = sysconf(_SC_NPROCESSORS_ONLN);
+    bool keep_order = false;
+    char **template;
+    int i = 1, n = 0;
+
+    for (; args[i] && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "-k") == 0) {
+            keep_order = true;
+        } else if (strncmp(args[i], "-j", 2) == 0) {
+            const char *num = args[i][2] ? args[i] + 2 : args[++i];
+            char *end = NULL;
+            if (num) slots = strtol(num, &end, 10);
+            if (!num || end == num || *end || slots < 1 || slots > INT_MAX) {
+                dprintf(2, "thsh: parallel: -j expects a positive number\n");
+                return -EINVAL;
+            }
+        } else {
+            break;
+        }
+    }
+
+    /* The template is the words up to the separator, in args itself */
+    template = &args[i];
+    for (; args[i] && strcmp(args[i], ARG_SEPARATOR) != 0; i++)
+        n++;
+    if (!n) {
+        dprintf(2, "usage: parallel [-j N] [-k] cmd [args...] [::: arg...]\n");
+        return -EINVAL;
+    }
+
+    char **arg_list;
+    int count = 0;
+    bool own_list = false;
+
+    if (args[i]) {
+        arg_list = &args[i + 1];
+        while (arg_list[count]) count++;
+    } else {
+        arg_list = read_arg_lines(stdin, &count);
+        if (!arg_list) return -ENOMEM;
+        own_list = true;
+    }
+
+    struct task *tasks = calloc(count + 1, sizeof(struct task));
+    struct pollfd *pfds = calloc(2 * slots, sizeof(struct pollfd));
+    int *running = calloc(slots, sizeof(int));
+    int devnull = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    int next = 0, active = 0, printed = 0, failed = 0;
+
+    if (!tasks || !pfds || !running || devnull < 0) {
+        failed = -ENOMEM;
+        goto out;
+    }
+
+    /* The pool: fill every free slot from the shared queue of arguments,
+     * then sleep until some task has output or finishes.  Each task polls
+     * two descriptors, its stdout and its stderr; poll() skips the ones
+     * already closed, at -1. */
+    while (next < count || active) {
+        while (active < slots && next < count) {
+            struct task *t = &tasks[next];
+            t->seq = ++next;
+            t->error = build_task(t, template, n, arg_list[t->seq - 1]);
+            if (!t->error) t->error = start_task(t, devnull);
+            if (t->error) {
+                t->finished = true;
+                failed += flush_tasks(tasks, t, &printed, keep_order, stdout);
+                continue;
+            }
+            running[active++] = t->seq - 1;
+        }
+
+        for (int s = 0; s < active; s++) {
+            pfds[2 * s] = (struct pollfd) {tasks[running[s]].out.fd, POLLIN, 0};
+            pfds[2 * s + 1] = (struct pollfd) {tasks[running[s]].err.fd, POLLIN, 0};
+        }
+        if (active && poll(pfds, 2 * active, -1) < 0) {
+            /* The revents are those of the last call; poll again */
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (int s = 0; s < active; s++) {
+            struct task *t = &tasks[running[s]];
+            if (pfds[2 * s].revents) collect_output(&t->out);
+            if (pfds[2 * s + 1].revents) collect_output(&t->err);
+            if (t->out.fd >= 0 || t->err.fd >= 0) continue;
+
+            /* Both outputs closed: the task is (about to be) done */
+            await_job(t->job_id, &t->exit_code);
+            t->elapsed = seconds_since(&t->start);
+            t->finished = true;
+            failed += flush_tasks(tasks, t, &printed, keep_order, stdout);
+
+            running[s] = running[--active];
+            pfds[2 * s] = pfds[2 * active];
+            pfds[2 * s + 1] = pfds[2 * active + 1];
+            s--;
+        }
+    }
+
+out:
+    for (int k = 0; k < count && tasks; k++)
+        free_task(&tasks[k]);
+    free(tasks);
+    free(pfds);
+    free(running);
+    if (devnull >= 0) close(devnull);
+    if (own_list) {
+        for (int k = 0; k < count; k++)
+            free(arg_list[k]);
+        free(arg_list);
+    }
+    return failed > 101 ? 101 : failed;
+}
@@ -0,0 +1,10 @@
+#include "../builtin.h"
+#include "../utils/path_manager.h"
+#include <errno.h>
+#include <stdio.h>
+
+/* Handle a pwd command: print the directory the shell is in. */
+int handle_pwd(char *args[MAX_ARG_SIZE], int stdin, int stdout) {
+    (void) args;
+    return dprintf(stdout, "%s\n", get_current_path()) < 0 ? -errno : 0;
+}
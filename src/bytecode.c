@@ -0,0 +1,529 @@
+/*
+ * This file implements the script compiler and its on-disk cache.
+ *
+ * Every line with commands becomes a record of its text, then one record
+ * per pipeline of its list, or a single error record:
+ *
+ *   OP_SOURCE   text
+ *   OP_PIPELINE flags expand op stages [infile] [outfile] [delim] [here]
+ *               [body] { argc word... } * stages
+ *   OP_ERROR    errno
+ *
+ * where flags, expand and op are single bytes, expand being the EXPAND_*
+ * flags of the pipeline and op the list_op after it, LIST_END for the last
+ * one, stages and argc are uint32s, errno is an int32, and a word is a
+ * uint32 length followed by the bytes and a NUL.  here is the text of a
+ * here-document or here-string, stored like a word; delim is the
+ * delimiter of a here-document, only kept to describe the job.  body is
+ * the text of the body of a function definition, stored like a word, and
+ * tokenized when the definition runs.  The text is the whole line, stored
+ * like a word, as the aliases are left unexpanded: a list whose commands
+ * name an alias when it runs is tokenized again from it.  The cache file
+ * is a header, the script path, and then the records as they are, which
+ * are all checked before a cached script is used.
+ */
+
+#define _GNU_SOURCE
+
+#include "bytecode.h"
+#include "functions.h"
+#include "parse.h"
+#include "script.h"
+#include "subst.h"
+#include "utils/arena.h"
+#include "utils/trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define OP_PIPELINE 1
+#define OP_ERROR    2
+#define OP_SOURCE   3
+
+#define PIPE_BACKGROUND 0x1
+#define PIPE_INFILE     0x2
+#define PIPE_OUTFILE    0x4
+#define PIPE_HERE       0x8
+#define PIPE_HEREDOC    0x10
+#define PIPE_FUNCTION   0x20
+#define PIPE_FLAGS      0x3f
+
+#define CACHE_MAGIC   "TSBC"
+#define CACHE_VERSION 11
+
+struct cache_header {
+    char magic[4];
+    uint32_t version;
+    char build[32];       // Build of the shell that compiled it
+    int64_t mtime_sec;    // The script's mtime and size when compiled
+    int64_t mtime_nsec;
+    int64_t size;
+    uint32_t path_len;    // The path, and its NUL, follow the header
+    uint64_t code_len;    // Then the code
+};
+
+/* Any rebuild of the shell may change how lines parse: the Makefile
+ * stamps the build with a checksum of all of its sources */
+#ifndef BUILD_STAMP
+#define BUILD_STAMP __DATE__ " " __TIME__
+#endif
+static const char build_stamp[32] = BUILD_STAMP;
+
+static int reserve(struct bytecode *bc, size_t more) {
+    if (bc->len + more <= bc->cap) return 0;
+
+    size_t cap = bc->cap ? bc->cap : 4096;
+    while (cap < bc->len + more) cap *= 2;
+    char *bigger = realloc(bc->code, cap);
+    if (!bigger) return -ENOMEM;
+    bc->code = bigger;
+    bc->cap = cap;
+    return 0;
+}
+
+static int emit(struct bytecode *bc, const void *data, size_t len) {
+    if (reserve(bc, len)) return -ENOMEM;
+    memcpy(bc->code + bc->len, data, len);
+    bc->len += len;
+    return 0;
+}
+
+static int emit_byte(struct bytecode *bc, unsigned char byte) {
+    return emit(bc, &byte, 1);
+}
+
+static int emit_count(struct bytecode *bc, uint32_t count) {
+    return emit(bc, &count, sizeof(count));
+}
+
+static int emit_text(struct bytecode *bc, const char *text, uint32_t len) {
+    if (emit(bc, &len, sizeof(len))) return -ENOMEM;
+    return emit(bc, text, len + 1);
+}
+
+static int emit_word(struct bytecode *bc, const char *word) {
+    return emit_text(bc, word, strlen(word));
+}
+
+/* Emit the record of one pipeline of a list */
+static int emit_pipeline(struct bytecode *bc, struct pipeline *p) {
+    unsigned char flags = (p->background ? PIPE_BACKGROUND : 0) |
+                          (p->infile ? PIPE_INFILE : 0) |
+                          (p->outfile ? PIPE_OUTFILE : 0) |
+                          (p->here.text ? PIPE_HERE : 0) |
+                          (p->here.delim ? PIPE_HEREDOC : 0) |
+                          (p->body ? PIPE_FUNCTION : 0);
+
+    if (emit_byte(bc, OP_PIPELINE) || emit_byte(bc, flags) || emit_byte(bc, p->expand) ||
+        emit_byte(bc, p->op) ||
+        emit_count(bc, p->count) ||
+        (p->infile && emit_word(bc, p->infile)) || (p->outfile && emit_word(bc, p->outfile)) ||
+        (p->here.delim && emit_word(bc, p->here.delim)) ||
+        (p->here.text && emit_text(bc, p->here.text, p->here.len)) ||
+        (p->body && emit_word(bc, p->body)))
+        return -ENOMEM;
+    for (int i = 0; i < p->count; i++) {
+        if (emit_count(bc, p->stages[i].argc)) return -ENOMEM;
+        for (int a = 0; a < p->stages[i].argc; a++)
+            if (emit_word(bc, p->stages[i].argv[a])) return -ENOMEM;
+    }
+    return 0;
+}
+
+int compile_line(struct bytecode *bc, char *line, size_t len, line_reader next,
+                 void *ctx) {
+    static struct arena arena; // Only lives as long as the line
+    struct pipeline p;
+    int rv = 0;
+
+    if (line[0] == '#') return 0;
+
+    if (!(line = join_continued_lines(line, &len, next, ctx, &arena))) {
+        rv = -ENOMEM;
+        goto out;
+    }
+
+    /* The text goes first, before tokenizing splits it up, and is dropped
+     * again if the line has no commands */
+    size_t start = bc->len;
+    if (emit_byte(bc, OP_SOURCE) || emit_text(bc, line, len)) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    int count = tokenize_line_unaliased(line, len, &p, &arena);
+    /* Even after an error, so the bodies do not run as commands */
+    if (read_here_docs(&p, next, ctx, &arena)) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    if (count <= 0) bc->len = start;
+    if (count < 0) {
+        int32_t error = count;
+        if (emit_byte(bc, OP_ERROR) || emit(bc, &error, sizeof(error))) rv = -ENOMEM;
+        goto out;
+    }
+    for (struct pipeline *each = count ? &p : NULL; each && !rv; each = each->next)
+        rv = emit_pipeline(bc, each);
+
+out:
+    arena_reset(&arena);
+    return rv;
+}
+
+static char *next_text(struct bytecode *bc, size_t *pc, size_t *text_len) {
+    uint32_t len;
+    memcpy(&len, bc->code + *pc, sizeof(len));
+    char *word = bc->code + *pc + sizeof(len);
+    *pc += sizeof(len) + len + 1;
+    if (text_len) *text_len = len;
+    return word;
+}
+
+static char *next_word(struct bytecode *bc, size_t *pc) {
+    return next_text(bc, pc, NULL);
+}
+
+static uint32_t next_count(struct bytecode *bc, size_t *pc) {
+    uint32_t count;
+    memcpy(&count, bc->code + *pc, sizeof(count));
+    *pc += sizeof(count);
+    return count;
+}
+
+/* Decode the record of one pipeline, past its opcode */
+static int next_pipeline(struct bytecode *bc, size_t *pc, struct pipeline *p,
+                         struct arena *arena) {
+    char *code = bc->code;
+    unsigned char flags = code[(*pc)++];
+
+    memset(p, 0, sizeof(*p));
+    p->arena = arena;
+    p->expand = code[(*pc)++];
+    p->op = code[(*pc)++];
+    p->count = next_count(bc, pc);
+
+    p->background = flags & PIPE_BACKGROUND;
+    p->infile = flags & PIPE_INFILE ? next_word(bc, pc) : NULL;
+    p->outfile = flags & PIPE_OUTFILE ? next_word(bc, pc) : NULL;
+    p->here.delim = flags & PIPE_HEREDOC ? next_word(bc, pc) : NULL;
+    p->here.text = flags & PIPE_HERE ? next_text(bc, pc, &p->here.len) : NULL;
+    p->body = flags & PIPE_FUNCTION ? next_word(bc, pc) : NULL;
+
+    p->stages = arena_alloc(arena, p->count * sizeof(struct command));
+    if (!p->stages) return -ENOMEM;
+    for (int i = 0; i < p->count; i++) {
+        struct command *stage = &p->stages[i];
+        stage->argc = next_count(bc, pc);
+        stage->assigns = NULL;
+        stage->assign_count = 0;
+        stage->argv = arena_alloc(arena, (stage->argc + 1) * sizeof(char *));
+        if (!stage->argv) return -ENOMEM;
+        for (int a = 0; a < stage->argc; a++)
+            stage->argv[a] = next_word(bc, pc);
+        stage->argv[stage->argc] = NULL;
+    }
+    return 0;
+}
+
+/* Whether any command of the list starts with an alias */
+static bool names_alias(struct pipeline *p) {
+    for (; p; p = p->next)
+        for (int i = 0; i < p->count; i++) {
+            const char *name = p->stages[i].argv[0];
+            if (name && get_alias(name, strlen(name))) return true;
+        }
+    return false;
+}
+
+/* Tokenize the text of a list again, with the aliases as they are now.
+ * The bodies of its here-documents were read when it was compiled, and are
+ * handed out to its here-documents in order. */
+static int retokenize(const char *source, size_t len, struct pipeline *p,
+                      struct arena *arena) {
+    struct pipeline compiled = *p;
+    char *line = arena_strndup(arena, source, len);
+    if (!line) return -ENOMEM;
+
+    int count = tokenize_line(line, len, p, arena);
+    struct pipeline *from = &compiled;
+    for (struct pipeline *each = count > 0 ? p : NULL; each; each = each->next) {
+        if (!each->here.delim || each->here.text) continue;
+        while (from && !from->here.delim) from = from->next;
+        if (!from) break;
+        each->here.text = from->here.text;
+        each->here.len = from->here.len;
+        from = from->next;
+    }
+    return count;
+}
+
+int next_list(struct bytecode *bc, size_t *pc, struct pipeline *p, struct arena *arena) {
+    uint64_t trace_start = trace_now();
+    struct pipeline *first = p;
+    char *source = NULL;
+    size_t source_len = 0;
+    int count = 0;
+
+    if (bc->code[*pc] == OP_SOURCE) {
+        (*pc)++;
+        source = next_text(bc, pc, &source_len);
+    }
+    if (bc->code[*pc] == OP_ERROR) {
+        int32_t error;
+        memcpy(&error, bc->code + *pc + 1, sizeof(error));
+        *pc += 1 + sizeof(error);
+        return error;
+    }
+
+    /* The records of a list follow each other, up to the one that ends it */
+    for (;;) {
+        (*pc)++;
+        if (next_pipeline(bc, pc, p, arena)) return -ENOMEM;
+        count++;
+        if (p->op == LIST_END) break;
+        if (!(p->next = arena_alloc(arena, sizeof(*p)))) return -ENOMEM;
+        p = p->next;
+    }
+    if (source && names_alias(first)) count = retokenize(source, source_len, first, arena);
+    trace_span("decode", trace_start, NULL);
+    return count;
+}
+
+/* Reading the code of a cache, which may be damaged: each step checks that
+ * what it reads is within the code */
+struct checker {
+    const char *code;
+    size_t len;
+    size_t pc;
+};
+
+static bool check_count(struct checker *c, uint32_t *count) {
+    if (c->len - c->pc < sizeof(*count)) return false;
+    memcpy(count, c->code + c->pc, sizeof(*count));
+    c->pc += sizeof(*count);
+    return true;
+}
+
+static bool check_text(struct checker *c) {
+    uint32_t len;
+    if (!check_count(c, &len) || len >= c->len - c->pc || c->code[c->pc + len]) return false;
+    c->pc += len + 1;
+    return true;
+}
+
+/* Check the record of one pipeline, past its opcode */
+static bool check_pipeline(struct checker *c, unsigned char *op) {
+    uint32_t count, argc;
+
+    if (c->len - c->pc < 3) return false;
+    unsigned char flags = c->code[c->pc];
+    *op = c->code[c->pc + 2];
+    c->pc += 3;
+    if ((flags & ~PIPE_FLAGS) || *op > LIST_OR) return false;
+
+    /* Every stage takes at least its argc, and every word its length and
+     * NUL, so the counts cannot ask for more than the code holds */
+    if (!check_count(c, &count) || !count || count > (c->len - c->pc) / sizeof(argc))
+        return false;
+    /* Each of the flags but PIPE_BACKGROUND comes with a text */
+    for (int flag = PIPE_INFILE; flag <= PIPE_FUNCTION; flag <<= 1)
+        if ((flags & flag) && !check_text(c)) return false;
+    for (uint32_t i = 0; i < count; i++) {
+        if (!check_count(c, &argc) || !argc || argc > (c->len - c->pc) / (sizeof(argc) + 1))
+            return false;
+        for (uint32_t a = 0; a < argc; a++)
+            if (!check_text(c)) return false;
+    }
+    return true;
+}
+
+/* Whether the code is made of whole records that next_list() can decode */
+static bool code_is_valid(const char *code, size_t len) {
+    struct checker c = {code, len, 0};
+    unsigned char op = LIST_END; // The list_op of the last pipeline
+
+    while (c.pc < len) {
+        unsigned char opcode = code[c.pc++];
+        int32_t error;
+
+        if (op != LIST_END && opcode != OP_PIPELINE) return false;
+        switch (opcode) {
+            case OP_SOURCE:
+                if (!check_text(&c) || c.pc == len || code[c.pc] != OP_PIPELINE) return false;
+                break;
+            case OP_ERROR:
+                if (len - c.pc < sizeof(error)) return false;
+                memcpy(&error, code + c.pc, sizeof(error));
+                c.pc += sizeof(error);
+                if (error >= 0) return false;
+                break;
+            case OP_PIPELINE:
+                if (!check_pipeline(&c, &op)) return false;
+                break;
+            default:
+                return false;
+        }
+    }
+    return op == LIST_END;
+}
+
+/* Where the compiled form of a script is cached: one file per script
+ * path, named after the hash of the path */
+static int cache_path(const char *script, char *path, size_t size) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[PATH_MAX];
+
+    if (base && *base) snprintf(dir, sizeof(dir), "%s", base);
+    else if (home && *home) snprintf(dir, sizeof(dir), "%s/.cache", home);
+    else return -ENOENT;
+
+    mkdir(dir, 0700);
+    strncat(dir, "/thsh", sizeof(dir) - strlen(dir) - 1);
+    if (mkdir(dir, 0700) < 0 && errno != EEXIST) return -errno;
+
+    /* FNV-1a, as the command hash uses */
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char *c = script; *c; c++) {
+        hash ^= (unsigned char) *c;
+        hash *= 1099511628211ULL;
+    }
+    snprintf(path, size, "%s/%016llx.tbc", dir, (unsigned long long) hash);
+    return 0;
+}
+
+static bool header_matches(struct cache_header *h, const char *script, struct stat *st) {
+    return memcmp(h->magic, CACHE_MAGIC, 4) == 0 &&
+           h->version == CACHE_VERSION &&
+           memcmp(h->build, build_stamp, sizeof(h->build)) == 0 &&
+           h->mtime_sec == st->st_mtim.tv_sec &&
+           h->mtime_nsec == st->st_mtim.tv_nsec &&
+           h->size == st->st_size &&
+           h->path_len == strlen(script);
+}
+
+/* Map the cached code of the script, if it is still up to date */
+static int load_cache(const char *cache, const char *script, struct stat *st,
+                      struct bytecode *bc) {
+    struct cache_header h;
+    struct stat cst;
+    int fd = open(cache, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -errno;
+
+    int rv = -ESTALE;
+    if (read(fd, &h, sizeof(h)) != sizeof(h) || !header_matches(&h, script, st) ||
+        fstat(fd, &cst) < 0 || h.code_len > (uint64_t) cst.st_size ||
+        (uint64_t) cst.st_size != sizeof(h) + h.path_len + 1 + h.code_len)
+        goto out;
+
+    void *map = mmap(NULL, cst.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        rv = -errno;
+        goto out;
+    }
+
+    /* Hash collisions are told apart by the path, and a damaged cache is
+     * compiled again like a stale one */
+    char *stored = (char *) map + sizeof(h);
+    if (memcmp(stored, script, h.path_len + 1) != 0 ||
+        !code_is_valid(stored + h.path_len + 1, h.code_len)) {
+        munmap(map, cst.st_size);
+        goto out;
+    }
+
+    bc->mapping = map;
+    bc->map_len = cst.st_size;
+    bc->code = stored + h.path_len + 1;
+    bc->len = h.code_len;
+    bc->cap = 0;
+    rv = 0;
+out:
+    close(fd);
+    return rv;
+}
+
+/* Write the cache to a temporary file, and move it in place, so a
+ * concurrent shell never maps a half-written one */
+static void save_cache(const char *cache, const char *script, struct stat *st,
+                       struct bytecode *bc) {
+    struct cache_header h = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .mtime_sec = st->st_mtim.tv_sec,
+        .mtime_nsec = st->st_mtim.tv_nsec,
+        .size = st->st_size,
+        .path_len = strlen(script),
+        .code_len = bc->len,
+    };
+    memcpy(h.build, build_stamp, sizeof(h.build));
+
+    char tmp[PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%d", cache, getpid());
+    int fd = open(tmp, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) return;
+
+    struct iovec parts[] = {
+        {&h, sizeof(h)},
+        {(char *) script, h.path_len + 1},
+        {bc->code, bc->len},
+    };
+    ssize_t total = sizeof(h) + h.path_len + 1 + bc->len;
+    bool ok = writev(fd, parts, 3) == total;
+    close(fd);
+
+    if (!ok || rename(tmp, cache) < 0) unlink(tmp);
+}
+
+/* Compile all of a script before any of it runs, so its cache is written
+ * even if it exits, or is killed, before its end */
+static int compile_script(const char *path, struct bytecode *bc) {
+    struct script script;
+    char *line;
+    size_t len;
+
+    int rv = open_script_file(&script, path);
+    if (rv) return rv;
+    while (!rv && (line = next_script_line(&script, &len)))
+        rv = compile_line(bc, line, len, script_line_reader, &script);
+    close_script(&script);
+    return rv;
+}
+
+int load_script(const char *path, struct bytecode *bc) {
+    char script[PATH_MAX];
+    char cache[PATH_MAX];
+    struct stat st;
+
+    memset(bc, 0, sizeof(*bc));
+    if (!realpath(path, script)) return -errno;
+    if (stat(script, &st) < 0) return -errno;
+
+    bool cached = cache_path(script, cache, sizeof(cache)) == 0;
+    if (cached && load_cache(cache, script, &st, bc) == 0) return 0;
+
+    int rv = compile_script(script, bc);
+    if (rv) {
+        free_bytecode(bc);
+        return rv;
+    }
+    if (cached) save_cache(cache, script, &st, bc);
+    return 0;
+}
+
+bool more_code(struct bytecode *bc, size_t pc) {
+    return pc < bc->len;
+}
+
+void free_bytecode(struct bytecode *bc) {
+    if (bc->mapping) munmap(bc->mapping, bc->map_len);
+    else free(bc->code);
+    memset(bc, 0, sizeof(*bc));
+}
@@ -0,0 +1,96 @@
+/*
+ *  Compiles scripts to a compact bytecode, and caches it on disk.
+ */
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "parse.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A compiled script: the tokenized pipelines of all of its lines, one
+ * record after the other in a flat buffer.  The words are stored in line,
+ * NUL-terminated, so running a pipeline points the commands table straight
+ * into the buffer, and a cached script is used right from its mapping.
+ * A script that is not cached is compiled whole before it runs, and cached
+ * right away.
+ */
+struct bytecode {
+    char *code;
+    size_t len;
+    size_t cap;
+    void *mapping;  // The mapped cache file the code lives in, or NULL
+    size_t map_len;
+};
+
+/**
+ * Tokenizes one line, with the lines that continue it, and appends the
+ * pipelines of its list to the bytecode.  A line that does not parse is
+ * compiled to a record of the error, which is reported when it is reached,
+ * like it would be when running the line.
+ * The body of a here-document is compiled into the record of its command.
+ * Aliases are not expanded, as they may differ when the line runs; the text
+ * of the line is kept for next_list() to expand them.
+ *
+ * @param bc The bytecode to append to.
+ * @param line The line, NUL-terminated.
+ * @param len The length of the line.
+ * @param next Reads the lines after this one, for a continuation or a
+ *             here-document.
+ * @param ctx Passed on to next.
+ * @return 0 on success, or -ENOMEM.
+ */
+int compile_line(struct bytecode *bc, char *line, size_t len, line_reader next,
+                 void *ctx);
+
+/**
+ * Decodes the list at *pc, and advances *pc past it.  The words are not
+ * copied, nor expanded, as expansions depend on the state when each
+ * pipeline runs: the pipelines keep their EXPAND_* flags for
+ * expand_pipeline().  If a command of the list starts with an alias, the
+ * text of the line is tokenized again instead, in the arena.
+ *
+ * @param bc The bytecode.
+ * @param pc Offset of the next record, starting at 0, for which
+ *           more_code() returned true.
+ * @param p The first pipeline of the list, to fill in, as tokenize_line()
+ *          does.  Its words and here text point into the bytecode.
+ * @param arena Where the pipelines are allocated.
+ * @return The number of pipelines, or the (negative) parsing error of the
+ *         line.
+ */
+int next_list(struct bytecode *bc, size_t *pc, struct pipeline *p, struct arena *arena);
+
+/**
+ * Whether there is more code at pc.
+ *
+ * @param bc The bytecode.
+ * @param pc Offset of the next record.
+ * @return true if there is a record at pc, false at the end of the script.
+ */
+bool more_code(struct bytecode *bc, size_t pc);
+
+/**
+ * Loads the compiled form of a script file.  The cache, under
+ * $XDG_CACHE_HOME/thsh or ~/.cache/thsh, is used if it was compiled from
+ * the same path, with the same mtime and size, by the same build of the
+ * shell, and all of its records are whole.  Otherwise the whole script is
+ * compiled, and the cache updated, before any of it runs.
+ *
+ * @param path The path of the script.
+ * @param bc The bytecode to initialize.
+ * @return 0 on success, or negative errno if the script cannot be read or
+ *         compiled.
+ */
+int load_script(const char *path, struct bytecode *bc);
+
+/**
+ * Releases the bytecode, or its mapping.
+ *
+ * @param bc The bytecode.
+ */
+void free_bytecode(struct bytecode *bc);
+
+#endif // BYTECODE_H
@@ -0,0 +1,627 @@
+/*
+ * This file implements the pipeline executor: it wires the stages of a
+ * parsed command line together and runs them as a single job.
+ */
+
+#define _GNU_SOURCE
+
+#include "exec.h"
+#include "builtin.h"
+#include "functions.h"
+#include "jobs.h"
+#include "pipe_monitor.h"
+#include "placement.h"
+#include "spawn.h"
+#include "subst.h"
+#include "time_report.h"
+#include "utils/trace.h"
+#include "vars.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static int exec_flags = 0;
+/* Set by run_pipeline_into() and join_pipeline() for run_pipeline() */
+static int capture_in = -1;
+static int capture_out = -1;
+static int join_job = -1;
+
+void set_exec_flags(int flags) {
+    exec_flags = flags;
+}
+
+/* Print the wall clock time since start, and the user/sys time that the
+ * children accumulated since usage_start. */
+static void print_times(struct timeval *start_time, struct rusage *usage_start) {
+    struct timeval end_time;
+    struct rusage usage_end;
+
+    gettimeofday(&end_time, NULL);
+    getrusage(RUSAGE_CHILDREN, &usage_end);
+
+    // Calculate elapsed time, then print it
+    long real_time = (end_time.tv_sec - start_time->tv_sec) * 1000 +
+                     (end_time.tv_usec - start_time->tv_usec) / 1000;
+    long user_time = (usage_end.ru_utime.tv_sec - usage_start->ru_utime.tv_sec) * 1000 +
+                     (usage_end.ru_utime.tv_usec - usage_start->ru_utime.tv_usec) / 1000;
+    long sys_time = (usage_end.ru_stime.tv_sec - usage_start->ru_stime.tv_sec) * 1000 +
+                    (usage_end.ru_stime.tv_usec - usage_start->ru_stime.tv_usec) / 1000;
+
+    printf("TIMES: real=%.1fs user=%.1fs sys=%.1fs\n",
+           real_time / 1000.0, user_time / 1000.0, sys_time / 1000.0);
+}
+
+/* Strip a leading `time [-j] [-o file] [--]` off the first stage.
+ * Returns 1 if the pipeline is to be timed, 0 if not, or -EINVAL. */
+static int time_keyword(struct command *stage, bool *json, char **file) {
+    char **args = stage->argv;
+    int i = 1, n = 0;
+
+    if (!args[0] || strcmp(args[0], "time") != 0) return 0;
+
+    for (; args[i] && args[i][0] == '-'; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(args[i], "-j") == 0) {
+            *json = true;
+        } else if (strcmp(args[i], "-o") == 0 && args[i + 1]) {
+            *file = args[++i];
+        } else {
+            dprintf(STDERR_FILENO, "usage: time [-j] [-o file] pipeline\n");
+            return -EINVAL;
+        }
+    }
+
+    for (; args[i]; i++) args[n++] = args[i];
+    args[n] = NULL;
+    stage->argc = n;
+    return 1;
+}
+
+static double seconds_since(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* What the shell itself spent since before, for a builtin stage */
+static void usage_since(struct rusage *before, struct rusage *usage) {
+    getrusage(RUSAGE_SELF, usage);
+    timersub(&usage->ru_utime, &before->ru_utime, &usage->ru_utime);
+    timersub(&usage->ru_stime, &before->ru_stime, &usage->ru_stime);
+    usage->ru_nvcsw -= before->ru_nvcsw;
+    usage->ru_nivcsw -= before->ru_nivcsw;
+    usage->ru_minflt -= before->ru_minflt;
+    usage->ru_majflt -= before->ru_majflt;
+}
+
+/* Hand every stage that ran as a process the usage wait4() collected for
+ * it, and print the report */
+static void report_timed(struct stage_time *times, int stages, struct proc_usage *usage,
+                         int count, const char *desc, struct timespec *start,
+                         int status, bool json, const char *file) {
+    int fd = STDERR_FILENO;
+
+    for (int i = 0, k = 0; i < stages; i++) {
+        if (!times[i].ran || !times[i].pid) continue;
+        if (k < count) {
+            times[i].pid = usage[k].pid;
+            times[i].real = usage[k].real;
+            times[i].usage = usage[k].usage;
+            k++;
+        }
+    }
+
+    if (file) {
+        fd = open(file, O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC,
+                  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (fd < 0) {
+            perror("time: error opening report file");
+            return;
+        }
+    }
+    report_stage_times(times, stages, desc ? desc : "", seconds_since(start), status,
+                       json, fd);
+    if (fd != STDERR_FILENO) close(fd);
+}
+
+/* Strip the sched prefixes off the stages, and work out the attributes each
+ * stage starts with, placing the stages on cores with EXEC_PLACE.  Leaves
+ * *scheds NULL if no stage needs any.  Returns 0, or -EINVAL. */
+static int stage_scheds(struct command *commands, int stages,
+                        struct sched_attrs **scheds) {
+    bool any = (exec_flags & EXEC_PLACE) && stages > 1;
+    bool pipeline = false;
+
+    *scheds = NULL;
+    for (int i = 0; i < stages && !any; i++)
+        any = strcmp(commands[i].argv[0], "sched") == 0;
+    if (!any) return 0;
+
+    struct sched_attrs *attrs = calloc(stages, sizeof(struct sched_attrs));
+    if (!attrs) return -ENOMEM;
+
+    struct sched_attrs whole;
+    for (int i = 0; i < stages; i++) {
+        /* A stage's own prefix goes on top of the pipeline's */
+        if (pipeline) attrs[i] = whole;
+        int rv = sched_keyword(commands[i].argv, &attrs[i], i ? &(bool) {false} : &pipeline);
+        if (rv < 0) {
+            free(attrs);
+            return rv;
+        }
+        for (commands[i].argc = 0; commands[i].argv[commands[i].argc];) commands[i].argc++;
+        if (i == 0) whole = attrs[0];
+        if ((exec_flags & EXEC_PLACE) && stages > 1 && !attrs[i].set_cpus)
+            attrs[i].set_cpus = place_stage(i, &attrs[i].cpus) == 0;
+    }
+    *scheds = attrs;
+    return 0;
+}
+
+/* Set the shell's variables, for a stage with nothing but assignments */
+static int assign_variables(struct command *stage) {
+    for (int i = 0; i < stage->assign_count; i++) {
+        struct assignment *a = &stage->assigns[i];
+        int rv = a->list ? set_var_array(a->name, a->values, a->count)
+                 : a->key ? set_var_element(a->name, a->key, a->values[0])
+                 : set_var(a->name, a->values[0]);
+        if (rv < 0) return rv;
+    }
+    return 0;
+}
+
+/* The environment of a command with assignments in front of it: the one
+ * of the exported variables, with them on top.  As in bash, the elements
+ * of arrays do not go in.  Returns NULL if out of memory. */
+static char **command_environ(struct command *stage, struct arena *arena) {
+    char **base = vars_environ();
+    int count = 0;
+
+    while (base[count]) count++;
+    char **env = arena_alloc(arena, (count + stage->assign_count + 1) * sizeof(char *));
+    if (!env) return NULL;
+    memcpy(env, base, count * sizeof(char *));
+
+    for (int i = 0; i < stage->assign_count; i++) {
+        struct assignment *a = &stage->assigns[i];
+        if (a->list || a->key) continue;
+
+        size_t len = strlen(a->name);
+        char *entry = arena_alloc(arena, len + strlen(a->values[0]) + 2);
+        if (!entry) return NULL;
+        sprintf(entry, "%s=%s", a->name, a->values[0]);
+
+        int k = 0;
+        while (k < count && (strncmp(env[k], a->name, len) != 0 || env[k][len] != '=')) k++;
+        env[k] = entry;
+        if (k == count) count++;
+    }
+    env[count] = NULL;
+    return env;
+}
+
+/* Rebuild a printable command line from the parsed pipeline, for `jobs` */
+static char *describe_pipeline(struct command *commands, int stages, char *infile,
+                               char *outfile, struct here_text *here) {
+    size_t len = 1;
+    for (int i = 0; i < stages; i++)
+        for (int j = 0; commands[i].argv[j] != NULL; j++)
+            len += strlen(commands[i].argv[j]) + 3;
+    if (infile) len += strlen(infile) + 3;
+    if (here && here->delim) len += strlen(here->delim) + 5;
+    else if (here && here->text) len += here->len + 5;
+    if (outfile) len += strlen(outfile) + 3;
+
+    char *desc = malloc(len);
+    if (!desc) return NULL;
+
+    char *cursor = desc;
+    for (int i = 0; i < stages; i++) {
+        if (i) cursor = stpcpy(cursor, " | ");
+        for (int j = 0; commands[i].argv[j] != NULL; j++) {
+            if (j) *cursor++ = ' ';
+            cursor = stpcpy(cursor, commands[i].argv[j]);
+        }
+        if (i == 0 && infile) cursor += sprintf(cursor, " < %s", infile);
+        if (i == 0 && here && here->delim)
+            cursor += sprintf(cursor, " <<%s%s", here->strip_tabs ? "-" : "", here->delim);
+        else if (i == 0 && here && here->text)
+            cursor += sprintf(cursor, " <<< %.*s", (int) here->len - 1, here->text);
+    }
+    if (outfile) cursor += sprintf(cursor, " > %s", outfile);
+    *cursor = '\0';
+    return desc;
+}
+
+/* Open the text of a here-document or here-string for reading.  Text
+ * that fits in a pipe without blocking goes through one; anything larger
+ * goes into a memfd, so nothing ever lands on disk, and no process is
+ * needed to feed it.  Returns the descriptor, or negative errno. */
+static int open_here_text(struct here_text *here) {
+    int fd[2];
+
+    if (here->len <= PIPE_BUF) {
+        if (pipe2(fd, O_CLOEXEC) < 0) return -errno;
+    } else {
+        fd[0] = fd[1] = memfd_create("thsh-here", MFD_CLOEXEC);
+        if (fd[0] < 0) return -errno;
+    }
+
+    for (size_t done = 0; done < here->len;) {
+        ssize_t n = write(fd[1], here->text + done, here->len - done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            int err = -errno;
+            close(fd[0]);
+            if (fd[1] != fd[0]) close(fd[1]);
+            return err;
+        }
+        done += n;
+    }
+
+    if (fd[1] != fd[0]) close(fd[1]);
+    else lseek(fd[0], 0, SEEK_SET);
+    return fd[0];
+}
+
+/* Create the pipe between stage i and i + 1, interposing a monitoring relay
+ * on it when edges is not NULL */
+static int open_stage_pipe(struct command *commands, int i, struct pipe_edge *edges,
+                           int fd[2]) {
+    if (edges) {
+        char label[64];
+        snprintf(label, sizeof(label), "%d:%s -> %d:%s",
+                 i, commands[i].argv[0], i + 1, commands[i + 1].argv[0]);
+        if (monitored_pipe(&edges[i], fd, label) == 0) return 0;
+    }
+    return pipe2(fd, O_CLOEXEC) < 0 ? -errno : 0;
+}
+
+int run_pipeline(struct pipeline *p, bool background, int *exit_code) {
+    int ret = 0;
+    int status = 0;
+    int builtin_status = -1; // Set if the last stage is a builtin
+    int stages = 0;
+    struct pipe_edge *edges = NULL;
+    int fd[2];
+    int in_fd = STDIN_FILENO;
+    int out_fd = STDOUT_FILENO;
+    struct timeval start_time;
+    struct rusage usage_start;
+    struct stage_time *times = NULL; // Set when the pipeline is timed
+    struct timespec timed_start;
+    bool json = false;
+    char *time_file = NULL;
+    int processes = 0;
+
+    uint64_t trace_start = trace_now();
+    int feed = capture_in, capture = capture_out, joining = join_job;
+    capture_in = capture_out = join_job = -1;
+    if (joining >= 0) background = true;
+
+    /* A function definition: its body is tokenized now, once */
+    if (p->body) {
+        int rv = define_function(p->stages[0].argv[0], p->body);
+        if (exit_code) *exit_code = rv < 0 ? 1 : 0;
+        return rv;
+    }
+
+    /* Nothing but assignments: they set the shell's variables, and the
+     * status is that of their last command substitution */
+    if (p->count == 1 && !p->stages[0].argv[0]) {
+        int rv = assign_variables(&p->stages[0]);
+        if (exit_code) *exit_code = rv < 0 ? 1 : substitution_status();
+        return rv;
+    }
+
+    struct command *commands = p->stages;
+    char *infile = p->infile;
+    char *outfile = p->outfile;
+    struct here_text *here = &p->here;
+
+    int timed = p->count ? time_keyword(&commands[0], &json, &time_file) : 0;
+    if (timed < 0) return timed;
+
+    while (stages < p->count && commands[stages].argv[0] != NULL) stages++;
+
+    struct sched_attrs *scheds;
+    int rv = stage_scheds(commands, stages, &scheds);
+    if (rv < 0) return rv;
+
+    /* Notes on the `open` function, for "<" redirection:
+     * `O_RDONLY`: This flag opens the file for reading only.
+     * `O_CLOEXEC`: The descriptor is only meant for the first stage, which
+     *  gets its own copy on stdin; no other stage should inherit it.
+     *
+     * Ensures that our input file is readable for workable input.
+     * */
+    if (infile) {
+        in_fd = open(infile, O_RDONLY | O_CLOEXEC);
+        if (in_fd < 0) {
+            perror("in_fd: error opening file");
+            free(scheds);
+            return -errno;
+        }
+    } else if (here && here->text) {
+        in_fd = open_here_text(here);
+        if (in_fd < 0) {
+            free(scheds);
+            return in_fd;
+        }
+    } else if (feed >= 0) {
+        in_fd = fcntl(feed, F_DUPFD_CLOEXEC, 0);
+        if (in_fd < 0) {
+            free(scheds);
+            return -errno;
+        }
+    }
+
+    /* Notes on the `open` function, for ">" redirection:
+     * `O_CREAT`: This flag tells the `open` function to create the file if
+     *  it does not already exist.
+     * `O_WRONLY`: This flag opens the file for writing only.
+     * `S_IRUSR`: This flag gives the owner of the file read permission.
+     * `S_IWUSR`: This flag gives the owner of the file write permission.
+     * `S_IRGRP`: This flag gives the group of the file read permission.
+     * `S_IROTH`: This flag gives others read permission.
+     *
+     * Ensures that our output file has the correct permissions for
+     * workable output.
+    */
+    if (outfile) {
+        out_fd = open(outfile,
+                      O_CREAT | O_WRONLY | O_CLOEXEC,
+                      S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        if (out_fd < 0) {
+            perror("out_fd: error opening file");
+            if (in_fd != STDIN_FILENO) close(in_fd);
+            free(scheds);
+            return -errno;
+        }
+    } else if (capture >= 0) {
+        out_fd = fcntl(capture, F_DUPFD_CLOEXEC, 0);
+        if (out_fd < 0) {
+            if (in_fd != STDIN_FILENO) close(in_fd);
+            free(scheds);
+            return -errno;
+        }
+    }
+
+    if (exec_flags & EXEC_TIME) {
+        gettimeofday(&start_time, NULL);
+        getrusage(RUSAGE_CHILDREN, &usage_start);
+    }
+
+    /* A background job outlives this call; only time what we wait on */
+    if (timed && !background) {
+        times = calloc(stages ?: 1, sizeof(struct stage_time));
+        clock_gettime(CLOCK_MONOTONIC, &timed_start);
+    }
+
+    /* The relays outlive this call if the job gets stopped, so their
+     * statistics live on the heap */
+    if ((exec_flags & EXEC_MONITOR) && !background && stages > 1)
+        edges = calloc(stages - 1, sizeof(struct pipe_edge));
+
+    /* Keep the stages from being reaped until all of them are launched: the
+     * job's process group lives only as long as its leader, so a reaped
+     * leader would leave the later stages nowhere to join */
+    sigset_t launching, unblocked;
+    sigemptyset(&launching);
+    sigaddset(&launching, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &launching, &unblocked);
+
+    char *desc = describe_pipeline(commands, stages, infile, outfile, here);
+    int job_id = joining >= 0 ? joining : create_job(desc);
+    if (job_id < 0) {
+        sigprocmask(SIG_SETMASK, &unblocked, NULL);
+        if (in_fd != STDIN_FILENO) close(in_fd);
+        if (out_fd != STDOUT_FILENO) close(out_fd);
+        free(desc);
+        free(times);
+        free(scheds);
+        return job_id;
+    }
+
+    /* The commands of <(...) and >(...) go first, so the stages find their
+     * pipes ready; if they cannot all start, no stage is launched */
+    struct proc_substs subs;
+    int extra = start_process_substitutions(p, job_id, &subs);
+    bool launch = extra >= 0;
+    if (!launch) {
+        ret = extra;
+        extra = 0;
+    }
+
+    /*
+     * This loop launches every stage of the pipeline without waiting on any
+     * of them.  It sets up piping between consecutive commands, ensuring the
+     * output of one command is passed as input to the next.
+     *
+     * Pipes are created close-on-exec: each stage only gets its own ends
+     * (dup'ed onto stdin/stdout), so a writer sees EPIPE as soon as its
+     * reader goes away, and a reader sees EOF as soon as its writer exits.
+     *
+     * If it's the last command and an outfile is specified, the output is
+     * redirected to the given outfile.
+     */
+    for (int i = 0; launch && i < stages; i++) {
+        int next_in = STDIN_FILENO;
+        int next_out;
+        int rv = 0;
+
+        /* If it's the last command and outfile is specified, use out_fd as
+         * output, otherwise use a fresh pipe to the next stage */
+        if (i + 1 == stages) {
+            next_out = out_fd;
+        } else {
+            int rv = open_stage_pipe(commands, i, edges, fd);
+            if (rv < 0) {
+                ret = ret ?: rv;
+                if (in_fd != STDIN_FILENO) close(in_fd);
+                in_fd = STDIN_FILENO;
+                break;
+            }
+            next_in = fd[0];
+            next_out = fd[1];
+        }
+
+        if (exec_flags & EXEC_DEBUG)
+            fprintf(stderr, "RUNNING: [%s]\n", commands[i].argv[0]);
+
+        struct timespec stage_start;
+        struct rusage self_start;
+        if (times) {
+            times[i].command = commands[i].argv[0];
+            clock_gettime(CLOCK_MONOTONIC, &stage_start);
+            getrusage(RUSAGE_SELF, &self_start);
+        }
+
+        if (scheds) set_spawn_sched(&scheds[i]);
+
+        uint64_t trace_stage = trace_now();
+        char **args = commands[i].argv;
+        bool last = i + 1 == stages;
+        bool function = is_function(args[0]);
+        bool prefixed = scheds && scheds[i].prefixed;
+        if ((!last || joining >= 0 || (background && function) || prefixed) &&
+            is_builtin(args[0])) {
+            /* Run in the shell, a builtin writing into the pipe could fill
+             * it before the stage reading it is even launched; a function
+             * in the background has to run alongside the shell too, and
+             * the shell itself does not take the attributes of a sched
+             * prefix */
+            rv = run_builtin(args, in_fd, next_out, last ? -1 : next_in, job_id);
+            if (!rv) processes++;
+            if (times) {
+                times[i].ran = !rv;
+                times[i].pid = -1;
+            }
+        } else if (function) {
+            /* Its status is that of the last command of its body */
+            int function_status;
+            rv = call_function(args, in_fd, next_out, &function_status);
+            trace_span("function", trace_stage, args[0]);
+            if (last) builtin_status = rv ? 1 : function_status;
+            if (times) {
+                times[i].ran = true;
+                times[i].real = seconds_since(&stage_start);
+                usage_since(&self_start, &times[i].usage);
+            }
+        } else if (handle_builtin(args, in_fd, next_out, &rv)) {
+            trace_span("builtin", trace_stage, args[0]);
+            /* A positive value is the builtin's status, not a failure */
+            if (last) builtin_status = rv < 0 ? 1 : rv;
+            if (rv > 0) rv = 0;
+            if (times) {
+                times[i].ran = true;
+                times[i].real = seconds_since(&stage_start);
+                usage_since(&self_start, &times[i].usage);
+            }
+        } else {
+            struct command *stage = &commands[i];
+            set_spawn_env(stage->assign_count ? command_environ(stage, p->arena) : NULL);
+            rv = run_command(args, in_fd, next_out, job_id);
+            if (!rv) processes++;
+            if (times) {
+                /* Filled in from wait4() once the job is done */
+                times[i].ran = !rv;
+                times[i].pid = -1;
+            }
+        }
+        if (rv && !ret) ret = rv;
+
+        /* The stage now holds its own copies, so release ours */
+        if (in_fd != STDIN_FILENO) close(in_fd);
+        if (next_out != out_fd) close(next_out);
+        in_fd = next_in;
+    }
+
+    /* We need to make sure to close any file descriptors that we opened
+     * for input and output redirection, if not already set to STDIN_FILENO
+     * and STDOUT_FILENO, respectively.
+     */
+    if (in_fd != STDIN_FILENO) close(in_fd);
+    if (out_fd != STDOUT_FILENO) close(out_fd);
+    close_process_substitutions(&subs);
+    sigprocmask(SIG_SETMASK, &unblocked, NULL);
+    set_spawn_sched(NULL);
+    set_spawn_env(NULL);
+    free(scheds);
+
+    if (background) {
+        if (joining < 0) background_job(job_id);
+        trace_span("pipeline", trace_start, desc);
+        free(desc);
+        if (exit_code) *exit_code = 0;
+        return joining >= 0 && !ret ? extra + processes : ret;
+    }
+
+    int count = extra + processes;
+    struct proc_usage *usage = times ? calloc(count ?: 1, sizeof(struct proc_usage)) : NULL;
+    uint64_t trace_wait = trace_now();
+    int waited = wait_on_job_usage(job_id, &status, usage, &count);
+    /* The shell is waiting on the output; carry on */
+    while (capture >= 0 && waited == -EAGAIN) waited = wait_on_job(job_id, &status);
+    trace_span("wait", trace_wait, NULL);
+    if (builtin_status >= 0) status = builtin_status;
+
+    /* Nothing to report on a job that got stopped instead.  The processes
+     * of the substitutions come first; they are not stages. */
+    if (usage && waited != -EAGAIN)
+        report_timed(times, stages, usage + extra, count > extra ? count - extra : 0,
+                     desc, &timed_start, status, json, time_file);
+    free(usage);
+    free(times);
+    trace_span("pipeline", trace_start, desc);
+    free(desc);
+
+    if (edges) {
+        if (waited == -EAGAIN) {
+            /* Stopped: the relays carry on with the job, unreported */
+            for (int i = 0; i < stages - 1; i++)
+                if (edges[i].running) pthread_detach(edges[i].relay);
+        } else {
+            report_pipe_edges(edges, stages - 1, STDERR_FILENO);
+            free(edges);
+        }
+    }
+
+    if (exec_flags & EXEC_DEBUG) {
+        for (int i = 0; i < stages; i++)
+            fprintf(stderr, "ENDED: [%s] (ret=%d)\n", commands[i].argv[0], ret);
+    }
+
+    if (exec_flags & EXEC_TIME)
+        print_times(&start_time, &usage_start);
+
+    if (exit_code) *exit_code = status;
+    return ret;
+}
+
+int run_pipeline_into(struct pipeline *p, int out, int *exit_code) {
+    capture_out = out;
+    int ret = run_pipeline(p, false, exit_code);
+    capture_out = -1;
+    return ret;
+}
+
+int join_pipeline(struct pipeline *p, int in, int out, int job_id) {
+    capture_in = in;
+    capture_out = out;
+    join_job = job_id;
+    int ret = run_pipeline(p, true, NULL);
+    capture_in = capture_out = join_job = -1;
+    return ret;
+}
@@ -0,0 +1,83 @@
+#ifndef EXEC_H
+#define EXEC_H
+
+#include "parse.h"
+#include <stdbool.h>
+
+/**
+ * Print a RUNNING/ENDED trace line to stderr for every pipeline stage.
+ */
+#define EXEC_DEBUG 0x1
+
+/**
+ * Report real/user/sys time for every pipeline that is run.
+ */
+#define EXEC_TIME  0x2
+
+/**
+ * Interpose a relay on every pipe of a foreground pipeline, and report the
+ * throughput and stall time of each edge once the pipeline is done.
+ */
+#define EXEC_MONITOR 0x4
+
+/**
+ * Pin consecutive stages of every pipeline to neighbouring cores, unless a
+ * stage asks for CPUs of its own with `sched -c`.
+ */
+#define EXEC_PLACE 0x8
+
+/**
+ * Sets the option flags (EXEC_*) used by every subsequent pipeline.
+ *
+ * @param flags Bitwise OR of the EXEC_* flags.
+ */
+void set_exec_flags(int flags);
+
+/**
+ * Runs one parsed pipeline to completion, or starts it in the background.
+ *
+ * Every stage is launched up front, connected to its neighbours with
+ * pipes, and recorded as a child of a single job.  Only once all stages
+ * are running does the shell wait on the job, so data streams between
+ * the stages instead of piling up in a pipe nobody reads yet.
+ *
+ * @param p The pipeline, as filled in by parse_line(), with the file to
+ *          redirect into the first stage, the file to redirect the last
+ *          stage into, and the here-document or here-string to feed the
+ *          first stage instead.
+ * @param background Leave the job running in the background (`&`) instead
+ *                   of waiting on it.
+ * @param exit_code Pointer to store the exit code of the last stage, may be NULL.
+ * @return 0 on success, or the (negative) error of the first stage that
+ *         could not be launched, or the return value of a failed builtin.
+ */
+int run_pipeline(struct pipeline *p, bool background, int *exit_code);
+
+/**
+ * Runs one parsed pipeline to completion, like run_pipeline(), but with the
+ * output of the last stage going to out instead of stdout, unless the
+ * pipeline has an outfile of its own.  The job cannot be stopped: ^Z
+ * only pauses it until the shell continues it.
+ *
+ * @param out Where the output goes.  The caller keeps, and closes, out.
+ * @return As run_pipeline().
+ */
+int run_pipeline_into(struct pipeline *p, int out, int *exit_code);
+
+/**
+ * Launches one parsed pipeline as more processes of an existing job, and
+ * returns without waiting on it, for commands that run alongside the
+ * job's own.  Every stage is a process; builtins run in forked copies of
+ * the shell.
+ *
+ * @param in Where the first stage reads from, unless the pipeline has an
+ *           input redirection of its own, or -1 for stdin.
+ * @param out Where the last stage writes to, unless the pipeline has an
+ *            outfile of its own, or -1 for stdout.  The caller keeps, and
+ *            closes, in and out.
+ * @param job_id The job to join.
+ * @return The number of processes started, or negative errno.
+ */
+int join_pipeline(struct pipeline *p, int in, int out, int job_id);
+
+#endif // EXEC_H
@@ -0,0 +1,312 @@
+/*
+ * Implementation of functions.h.
+ *
+ * Aliases and functions live in two open-addressing tables (linear
+ * probing) keyed by name, as the variables do.  A function's body is
+ * tokenized into an arena of its own when it is defined; a call copies
+ * the list, whose words expansion replaces, into an arena of the call's,
+ * and runs the copy.
+ */
+
+#define _GNU_SOURCE
+
+#include "functions.h"
+#include "exec.h"
+#include "parse.h"
+#include "utils/arena.h"
+#include "vars.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TABLE_INITIAL_SIZE 16
+
+/* The bytes an alias name cannot have: the tokenizer would never see the
+ * name as one word, or it would be an expansion, a path or an assignment */
+#define ALIAS_INVALID " \t\n#|><&;$`/="
+
+struct entry {
+    char *name;  // NULL marks an empty slot
+    void *value; // The text of an alias, or a struct function
+};
+
+struct table {
+    struct entry *slots;
+    size_t size;
+    size_t used;
+};
+
+/* A function, shared by the table and the calls running it, so a call
+ * outlives its function being redefined or unset */
+struct function {
+    struct arena arena;   // The text of the body, and its list
+    struct pipeline body;
+    int count;            // The pipelines of the body, 0 for an empty one
+    int refs;
+};
+
+static struct table aliases;
+static struct table functions;
+static int depth = 0; // The calls under way
+
+static uint64_t hash_name(const char *name, size_t len) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) name[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static struct entry *find_slot(struct entry *slots, size_t size, const char *name,
+                               size_t len) {
+    size_t i = hash_name(name, len) & (size - 1);
+    while (slots[i].name && (strncmp(slots[i].name, name, len) != 0 || slots[i].name[len]))
+        i = (i + 1) & (size - 1);
+    return &slots[i];
+}
+
+static struct entry *lookup(struct table *t, const char *name, size_t len) {
+    if (!t->used) return NULL;
+    struct entry *e = find_slot(t->slots, t->size, name, len);
+    return e->name ? e : NULL;
+}
+
+static int grow(struct table *t) {
+    size_t size = t->size ? t->size * 2 : TABLE_INITIAL_SIZE;
+    struct entry *slots = calloc(size, sizeof(struct entry));
+    if (!slots) return -ENOMEM;
+
+    for (size_t i = 0; i < t->size; i++) {
+        struct entry *e = &t->slots[i];
+        if (e->name) *find_slot(slots, size, e->name, strlen(e->name)) = *e;
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->size = size;
+    return 0;
+}
+
+/* Find an entry, adding it, with no value, if it is not there */
+static struct entry *insert(struct table *t, const char *name) {
+    size_t len = strlen(name);
+    struct entry *e = lookup(t, name, len);
+    if (e) return e;
+
+    // Keep the load factor under 3/4
+    if ((t->used + 1) * 4 > t->size * 3 && grow(t) < 0) return NULL;
+    e = find_slot(t->slots, t->size, name, len);
+    if (!(e->name = strdup(name))) return NULL;
+    e->value = NULL;
+    t->used++;
+    return e;
+}
+
+/* Take an entry out of its table, and return its value */
+static void *remove_entry(struct table *t, struct entry *e) {
+    void *value = e->value;
+    free(e->name);
+    e->name = NULL;
+    t->used--;
+
+    /* Re-insert the rest of the probe run, so no entry after the hole
+     * becomes unreachable */
+    size_t i = (e - t->slots + 1) & (t->size - 1);
+    while (t->slots[i].name) {
+        struct entry moved = t->slots[i];
+        t->slots[i].name = NULL;
+        *find_slot(t->slots, t->size, moved.name, strlen(moved.name)) = moved;
+        i = (i + 1) & (t->size - 1);
+    }
+    return value;
+}
+
+int set_alias(const char *name, const char *value) {
+    if (!*name || name[strcspn(name, ALIAS_INVALID)]) return -EINVAL;
+
+    char *copy = strdup(value);
+    if (!copy) return -ENOMEM;
+    struct entry *e = insert(&aliases, name);
+    if (!e) {
+        free(copy);
+        return -ENOMEM;
+    }
+    free(e->value);
+    e->value = copy;
+    return 0;
+}
+
+const char *get_alias(const char *name, size_t len) {
+    struct entry *e = lookup(&aliases, name, len);
+    return e ? e->value : NULL;
+}
+
+int unset_alias(const char *name) {
+    struct entry *e = lookup(&aliases, name, strlen(name));
+    if (!e) return -ENOENT;
+    free(remove_entry(&aliases, e));
+    return 0;
+}
+
+void clear_aliases(void) {
+    for (size_t i = 0; i < aliases.size; i++) {
+        free(aliases.slots[i].name);
+        free(aliases.slots[i].value);
+    }
+    free(aliases.slots);
+    memset(&aliases, 0, sizeof(aliases));
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp((*(struct entry *const *) a)->name, (*(struct entry *const *) b)->name);
+}
+
+int print_aliases(int fd, const char *name) {
+    if (name) {
+        struct entry *e = lookup(&aliases, name, strlen(name));
+        if (!e) return -ENOENT;
+        dprintf(fd, "alias %s='%s'\n", e->name, (char *) e->value);
+        return 0;
+    }
+
+    struct entry **sorted = malloc((aliases.used + 1) * sizeof(struct entry *));
+    size_t count = 0;
+    if (!sorted) return -ENOMEM;
+    for (size_t i = 0; i < aliases.size; i++)
+        if (aliases.slots[i].name) sorted[count++] = &aliases.slots[i];
+    if (count) qsort(sorted, count, sizeof(*sorted), compare_names);
+
+    for (size_t i = 0; i < count; i++)
+        dprintf(fd, "alias %s='%s'\n", sorted[i]->name, (char *) sorted[i]->value);
+    free(sorted);
+    return 0;
+}
+
+/* Drop a reference to a function, freeing it with the last one */
+static void release(struct function *fn) {
+    if (--fn->refs) return;
+    arena_free(&fn->arena);
+    free(fn);
+}
+
+int define_function(const char *name, const char *body) {
+    struct function *fn = calloc(1, sizeof(*fn));
+    if (!fn) return -ENOMEM;
+    fn->refs = 1;
+
+    /* The body gets a copy of its own: the text it came from may be the
+     * line, or a compiled script */
+    size_t len = strlen(body);
+    char *text = arena_strndup(&fn->arena, body, len);
+    int count = text ? tokenize_line(text, len, &fn->body, &fn->arena) : -ENOMEM;
+    /* There are no lines to read the body of a here-document from */
+    for (struct pipeline *p = count > 0 ? &fn->body : NULL; p; p = p->next)
+        if (p->here.delim) count = -EINVAL;
+    if (count < 0) {
+        release(fn);
+        return count;
+    }
+    fn->count = count;
+
+    struct entry *e = insert(&functions, name);
+    if (!e) {
+        release(fn);
+        return -ENOMEM;
+    }
+    if (e->value) release(e->value);
+    e->value = fn;
+    return 0;
+}
+
+bool is_function(const char *name) {
+    return lookup(&functions, name, strlen(name)) != NULL;
+}
+
+int unset_function(const char *name) {
+    struct entry *e = lookup(&functions, name, strlen(name));
+    if (!e) return -ENOENT;
+    release(remove_entry(&functions, e));
+    return 0;
+}
+
+/* Put fd in place of target, and return a copy of what target was, to
+ * put back once the call is done */
+static int redirect(int fd, int target) {
+    int saved = fcntl(target, F_DUPFD_CLOEXEC, 10);
+    if (saved < 0) return -errno;
+    if (dup2(fd, target) < 0) {
+        int err = -errno;
+        close(saved);
+        return err;
+    }
+    return saved;
+}
+
+static void restore(int saved, int target) {
+    if (saved < 0) return;
+    dup2(saved, target);
+    close(saved);
+}
+
+/* Run the list of a body, each pipeline once the one before it lets it, as
+ * the shell runs a line, reporting what fails the same way */
+static void run_body(struct pipeline *p, int *status) {
+    for (bool run = true; p; run = list_runs_next(p->op, *status), p = p->next) {
+        if (!run) continue;
+
+        int steps = expand_pipeline(p);
+        if (steps < 0) {
+            // An arithmetic error was reported as it was found
+            if (steps != -EDOM)
+                dprintf(STDERR_FILENO, "Parsing error.  Cannot execute command. %d\n", -steps);
+            *status = 1;
+        } else if (steps > 0) {
+            *status = 127;
+            int ret = run_pipeline(p, p->background, status);
+            if (ret) dprintf(STDOUT_FILENO, "Failed to run command - error %d\n", ret);
+        }
+        set_last_status(*status);
+    }
+}
+
+int call_function(char **argv, int stdin, int stdout, int *status) {
+    struct entry *e = lookup(&functions, argv[0], strlen(argv[0]));
+    if (!e) return -ENOENT;
+    if (depth == FUNCTION_MAX_DEPTH) return -ELOOP;
+
+    /* The commands of the body use the standard descriptors, so the ones
+     * of the call go there while it runs */
+    int saved_in = -1, saved_out = -1;
+    fflush(NULL);
+    if (stdin != STDIN_FILENO && (saved_in = redirect(stdin, STDIN_FILENO)) < 0)
+        return saved_in;
+    if (stdout != STDOUT_FILENO && (saved_out = redirect(stdout, STDOUT_FILENO)) < 0) {
+        restore(saved_in, STDIN_FILENO);
+        return saved_out;
+    }
+
+    struct function *fn = e->value;
+    struct arena arena = {0};
+    struct pipeline body;
+    int rv = 0;
+
+    fn->refs++;
+    depth++;
+    char **outer = set_positional(argv);
+    *status = 0;
+    if (fn->count && !(rv = copy_list(&fn->body, &body, &arena))) run_body(&body, status);
+    set_positional(outer);
+    depth--;
+    release(fn);
+    arena_free(&arena);
+
+    fflush(NULL);
+    restore(saved_out, STDOUT_FILENO);
+    restore(saved_in, STDIN_FILENO);
+    return rv;
+}
@@ -0,0 +1,106 @@
+/*
+ *  Aliases and shell functions: the names a command word may stand for
+ *  besides a builtin or a program.  An alias is text the tokenizer puts in
+ *  place of the word; a function is a list parsed once, when it is defined,
+ *  and run in the shell each time it is called.
+ */
+
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * How many aliases may expand one after the other at the start of a
+ * command, `alias a=b b=c ...`, before the tokenizer gives up on it.
+ */
+#define ALIAS_MAX_DEPTH 16
+
+/**
+ * How deep function calls may nest before a call fails with -ELOOP,
+ * rather than the shell running out of stack.
+ */
+#define FUNCTION_MAX_DEPTH 256
+
+/**
+ * Defines an alias, replacing any previous one of that name.
+ *
+ * @param name The name, which must not hold a delimiter, a '$', a '/' or
+ *        a '='.
+ * @param value The text the name stands for, copied.
+ * @return 0 on success, -EINVAL for a name that cannot be an alias, or
+ *         -ENOMEM.
+ */
+int set_alias(const char *name, const char *value);
+
+/**
+ * Looks up an alias, as the tokenizer does for the first word of every
+ * command.  With no aliases defined, this costs nothing but a test.
+ *
+ * @param name The word, not necessarily NUL-terminated.
+ * @param len Its length.
+ * @return The text of the alias, or NULL if there is none.
+ */
+const char *get_alias(const char *name, size_t len);
+
+/**
+ * Forgets an alias.
+ *
+ * @return 0 on success, or -ENOENT if there was no such alias.
+ */
+int unset_alias(const char *name);
+
+/**
+ * Forgets every alias, as `unalias -a` does.
+ */
+void clear_aliases(void);
+
+/**
+ * Prints aliases as the alias commands that would define them again,
+ * sorted by name.
+ *
+ * @param fd The file descriptor to print to.
+ * @param name The only alias to print, or NULL for all of them.
+ * @return 0 on success, or -ENOENT if name is not an alias.
+ */
+int print_aliases(int fd, const char *name);
+
+/**
+ * Defines a function, replacing any previous one of that name.  The body
+ * is tokenized here, once; each call only expands and runs it.  A call of
+ * the function being replaced carries on with the body it started with.
+ *
+ * @param name The name.
+ * @param body The commands, as a list on one line, which is copied.
+ * @return 0 on success, -EINVAL if the body does not parse, or -ENOMEM.
+ */
+int define_function(const char *name, const char *body);
+
+/**
+ * @return Whether name is a function.
+ */
+bool is_function(const char *name);
+
+/**
+ * Calls a function in the shell: its positional parameters are the
+ * arguments of the call while its body runs, one pipeline of the list
+ * after another, as a line of input would.
+ *
+ * @param argv The function's name and its arguments, NULL-terminated.
+ * @param stdin File descriptor for the standard input of the body.
+ * @param stdout File descriptor for its standard output.
+ * @param status Returns the exit status of the last pipeline that ran.
+ * @return 0 on success, -ENOENT if argv[0] is not a function, -ELOOP past
+ *         FUNCTION_MAX_DEPTH, or -errno if the descriptors cannot be set up.
+ */
+int call_function(char **argv, int stdin, int stdout, int *status);
+
+/**
+ * Forgets a function.  A call of it that is running carries on.
+ *
+ * @return 0 on success, or -ENOENT if there was no such function.
+ */
+int unset_function(const char *name);
+
+#endif // FUNCTIONS_H
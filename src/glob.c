@@ -0,0 +1,518 @@
+/*
+ * This file implements filename expansion.
+ *
+ * A glob is split at its slashes, and every segment compiled once.  The
+ * segments are then matched one directory level at a time: a literal
+ * segment is just appended to the path, and a pattern is matched against
+ * the listing of the directory so far.  Listings are read once per
+ * pipeline, and kept in its arena.  Only the paths that match are sorted,
+ * once they are all found, not the listings.
+ *
+ * A "**" walks the whole tree under the path so far, on several threads.
+ * Each thread reads directories with getdents64() in large blocks, and
+ * opens the ones under them relative to their parent's descriptor; it
+ * goes depth first on its own, and hands directories to the shared queue
+ * only while another thread is idle.  d_type tells the directories apart,
+ * so nothing is stat()ed on the filesystems that fill it in.  The segment
+ * after the "**" is matched against each directory as it is read, and
+ * what follows that is matched afterwards, one level at a time, only under
+ * the directories the segment matched.  Each thread keeps its own paths,
+ * and they are all sorted together in the end, so the result does not
+ * depend on which thread got where first.
+ */
+
+#define _GNU_SOURCE
+
+#include "glob.h"
+#include "utils/pattern.h"
+#include "utils/trace.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Bytes of directory entries read at once */
+#define DENTS_BUF 32768
+
+struct dir_entry {
+    char *name;
+    unsigned char type; // d_type: DT_UNKNOWN if the filesystem does not say
+};
+
+struct dir_listing {
+    char *path;         // As the glob spells it, with its trailing '/'; "" for "."
+    struct dir_entry *entries;
+    int count;
+};
+
+struct segment {
+    char *text;         // NUL-terminated
+    struct pattern pattern;
+    bool recursive;     // "**"
+};
+
+/* One expansion under way */
+struct glob_walk {
+    struct glob_cache *cache;
+    struct segment *segments;
+    int count;
+    bool dirs_only;     // The glob ends with a '/'
+    char **paths;
+    int found;
+    int cap;
+};
+
+void glob_cache_init(struct glob_cache *cache, struct arena *arena) {
+    memset(cache, 0, sizeof(*cache));
+    cache->arena = arena;
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* Read a directory, unless it has been already.  A directory that
+ * cannot be read is listed as empty.  The listing is copied out, as later
+ * reads may move the table. */
+static int list_dir(struct glob_cache *cache, const char *path, struct dir_listing *out) {
+    for (int i = 0; i < cache->count; i++) {
+        if (strcmp(cache->dirs[i].path, path) == 0) {
+            *out = cache->dirs[i];
+            return 0;
+        }
+    }
+
+    if (cache->count == cache->cap) {
+        int more = cache->cap ? cache->cap * 2 : 8;
+        struct dir_listing *dirs = arena_grow(cache->arena, cache->dirs,
+                                              cache->cap * sizeof(*dirs),
+                                              more * sizeof(*dirs));
+        if (!dirs) return -ENOMEM;
+        cache->dirs = dirs;
+        cache->cap = more;
+    }
+    struct dir_listing *dir = &cache->dirs[cache->count];
+    memset(dir, 0, sizeof(*dir));
+    if (!(dir->path = arena_strndup(cache->arena, path, strlen(path)))) return -ENOMEM;
+
+    uint64_t trace_start = trace_now();
+    DIR *dirp = opendir(*path ? path : ".");
+    struct dirent *dp;
+    int cap = 0;
+    while (dirp && (dp = readdir(dirp))) {
+        if (dp->d_name[0] == '.' &&
+            (!dp->d_name[1] || (dp->d_name[1] == '.' && !dp->d_name[2])))
+            continue;
+
+        if (dir->count == cap) {
+            int more = cap ? cap * 2 : 64;
+            struct dir_entry *entries = arena_grow(cache->arena, dir->entries,
+                                                   cap * sizeof(*entries),
+                                                   more * sizeof(*entries));
+            if (!entries) {
+                closedir(dirp);
+                return -ENOMEM;
+            }
+            dir->entries = entries;
+            cap = more;
+        }
+        struct dir_entry *entry = &dir->entries[dir->count++];
+        entry->type = dp->d_type;
+        if (!(entry->name = arena_strndup(cache->arena, dp->d_name, strlen(dp->d_name)))) {
+            closedir(dirp);
+            return -ENOMEM;
+        }
+    }
+    if (dirp) closedir(dirp);
+    trace_span("readdir", trace_start, *path ? path : ".");
+
+    cache->count++;
+    *out = *dir;
+    return 0;
+}
+
+static char *join(struct arena *arena, const char *prefix, const char *name, bool slash) {
+    size_t prefix_len = strlen(prefix), name_len = strlen(name);
+    char *path = arena_alloc(arena, prefix_len + name_len + 2);
+    if (!path) return NULL;
+
+    memcpy(path, prefix, prefix_len);
+    memcpy(path + prefix_len, name, name_len);
+    if (slash) path[prefix_len + name_len++] = '/';
+    path[prefix_len + name_len] = '\0';
+    return path;
+}
+
+static int add_path(struct glob_walk *w, char *path) {
+    if (w->found == GLOB_MAX_PATHS) return -E2BIG;
+    if (w->found == w->cap) {
+        int more = w->cap ? w->cap * 2 : 16;
+        char **paths = arena_grow(w->cache->arena, w->paths, w->cap * sizeof(char *),
+                                  more * sizeof(char *));
+        if (!paths) return -ENOMEM;
+        w->paths = paths;
+        w->cap = more;
+    }
+    w->paths[w->found++] = path;
+    return 0;
+}
+
+/* Whether an entry may be a directory, without a stat() if d_type says */
+static bool maybe_dir(const struct dir_entry *entry) {
+    return entry->type == DT_DIR || entry->type == DT_LNK || entry->type == DT_UNKNOWN;
+}
+
+static bool is_dir(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* As the kernel hands out directory entries */
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/* What the walk of a tree found: a path, or a directory to match the
+ * segments from seg on under */
+struct tree_hit {
+    char *path;
+    int seg;            // -1 for a path
+};
+
+/* A directory waiting in the shared queue */
+struct tree_job {
+    char *path;         // With its trailing '/'
+    struct tree_job *next;
+};
+
+/* The walk of a tree, for one "**" */
+struct tree_walk {
+    struct glob_walk *glob;
+    int seg;            // The "**"
+    struct segment *next; // The segment after it, or NULL if it is last
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct tree_job *jobs;
+    int busy;           // Threads walking a directory
+    int idle;           // Threads waiting for one
+    int hits;           // Found by all threads so far
+    int error;
+};
+
+/* One thread of the walk.  Everything it allocates, the paths it found
+ * included, lives in its own arena until the walk is over. */
+struct tree_worker {
+    struct tree_walk *t;
+    pthread_t thread;
+    struct arena arena;
+    struct tree_hit *hits;
+    int count;
+    int cap;
+    char buf[DENTS_BUF];
+};
+
+static void tree_fail(struct tree_walk *t, int error) {
+    __atomic_store_n(&t->error, error, __ATOMIC_RELAXED);
+}
+
+static bool tree_failed(struct tree_walk *t) {
+    return __atomic_load_n(&t->error, __ATOMIC_RELAXED) != 0;
+}
+
+static void tree_hit(struct tree_worker *wk, char *path, int seg) {
+    if (__atomic_add_fetch(&wk->t->hits, 1, __ATOMIC_RELAXED) > GLOB_MAX_PATHS) {
+        tree_fail(wk->t, -E2BIG);
+        return;
+    }
+    if (wk->count == wk->cap) {
+        int more = wk->cap ? wk->cap * 2 : 64;
+        struct tree_hit *hits = arena_grow(&wk->arena, wk->hits, wk->cap * sizeof(*hits),
+                                           more * sizeof(*hits));
+        if (!hits) {
+            tree_fail(wk->t, -ENOMEM);
+            return;
+        }
+        wk->hits = hits;
+        wk->cap = more;
+    }
+    wk->hits[wk->count++] = (struct tree_hit) {path, seg};
+}
+
+static void push_job(struct tree_worker *wk, char *path) {
+    struct tree_walk *t = wk->t;
+    struct tree_job *job = arena_alloc(&wk->arena, sizeof(*job));
+    if (!job) {
+        tree_fail(t, -ENOMEM);
+        return;
+    }
+    job->path = path;
+
+    pthread_mutex_lock(&t->lock);
+    job->next = t->jobs;
+    t->jobs = job;
+    pthread_cond_signal(&t->wake);
+    pthread_mutex_unlock(&t->lock);
+}
+
+/* Whether a symbolic link, or anything d_type does not tell, is a
+ * directory once followed */
+static bool entry_is_dir(int dirfd, const char *name, unsigned char type) {
+    struct stat st;
+    if (type == DT_DIR) return true;
+    if (type != DT_LNK && type != DT_UNKNOWN) return false;
+    return fstatat(dirfd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+/* Walk the directory open on fd, at path, and everything under it that is
+ * not handed to another thread */
+static void walk_dir(struct tree_worker *wk, int fd, const char *path) {
+    struct tree_walk *t = wk->t;
+    struct segment *next = t->next;
+    bool last = !next || t->seg + 1 == t->glob->count - 1;
+    bool dirs_only = t->glob->dirs_only;
+    char **subdirs = NULL;
+    int count = 0, cap = 0;
+    long n;
+
+    while (!tree_failed(t) && (n = syscall(SYS_getdents64, fd, wk->buf, DENTS_BUF)) > 0) {
+        for (long at = 0; at < n;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *) (wk->buf + at);
+            const char *name = d->d_name;
+            unsigned char type = d->d_type;
+            at += d->d_reclen;
+
+            if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+            if (type == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+                    type = IFTODT(st.st_mode);
+            }
+            bool hidden = name[0] == '.';
+
+            /* The segment after the "**", if any, is matched right here */
+            bool matched = next ? (!hidden || next->pattern.leading_dot) &&
+                                  pattern_matches(&next->pattern, name)
+                                : !hidden;
+            if (matched && (last ? !dirs_only || entry_is_dir(fd, name, type)
+                                 : type == DT_DIR || type == DT_LNK)) {
+                char *found = join(&wk->arena, path, name, !last || dirs_only);
+                if (found) tree_hit(wk, found, last ? -1 : t->seg + 2);
+                else tree_fail(t, -ENOMEM);
+            }
+
+            /* Symbolic links are not walked into, so a loop cannot be */
+            if (hidden || type != DT_DIR) continue;
+            if (count == cap) {
+                int more = cap ? cap * 2 : 16;
+                char **bigger = arena_grow(&wk->arena, subdirs, cap * sizeof(char *),
+                                           more * sizeof(char *));
+                if (!bigger) {
+                    tree_fail(t, -ENOMEM);
+                    return;
+                }
+                subdirs = bigger;
+                cap = more;
+            }
+            if (!(subdirs[count++] = arena_strndup(&wk->arena, name, strlen(name)))) {
+                tree_fail(t, -ENOMEM);
+                return;
+            }
+        }
+    }
+
+    /* Then the directories under it: to a thread with nothing to do, or
+     * else right here */
+    for (int i = 0; i < count && !tree_failed(t); i++) {
+        char *sub = join(&wk->arena, path, subdirs[i], true);
+        if (!sub) {
+            tree_fail(t, -ENOMEM);
+            return;
+        }
+        if (__atomic_load_n(&t->idle, __ATOMIC_RELAXED) > 0) {
+            push_job(wk, sub);
+            continue;
+        }
+        int subfd = openat(fd, subdirs[i], O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (subfd < 0) continue;
+        walk_dir(wk, subfd, sub);
+        close(subfd);
+    }
+}
+
+static void *tree_thread(void *arg) {
+    struct tree_worker *wk = arg;
+    struct tree_walk *t = wk->t;
+
+    pthread_mutex_lock(&t->lock);
+    for (;;) {
+        while (!t->jobs && t->busy && !tree_failed(t)) {
+            /* Read without the lock, by the threads deciding whether to
+             * hand out work */
+            __atomic_add_fetch(&t->idle, 1, __ATOMIC_RELAXED);
+            pthread_cond_wait(&t->wake, &t->lock);
+            __atomic_sub_fetch(&t->idle, 1, __ATOMIC_RELAXED);
+        }
+        /* Nothing queued, and nobody left to queue anything */
+        if (!t->jobs || tree_failed(t)) break;
+
+        struct tree_job *job = t->jobs;
+        t->jobs = job->next;
+        t->busy++;
+        pthread_mutex_unlock(&t->lock);
+
+        int fd = open(*job->path ? job->path : ".",
+                      O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            walk_dir(wk, fd, job->path);
+            close(fd);
+        }
+
+        pthread_mutex_lock(&t->lock);
+        t->busy--;
+    }
+    pthread_cond_broadcast(&t->wake);
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+
+static int walk(struct glob_walk *w, const char *prefix, int seg);
+
+/* Match a "**" segment, and the ones after it, under prefix */
+static int walk_tree(struct glob_walk *w, const char *prefix, int seg) {
+    uint64_t trace_start = trace_now();
+    struct tree_walk t = {
+        .glob = w,
+        .seg = seg,
+        .next = seg + 1 < w->count ? &w->segments[seg + 1] : NULL,
+        .lock = PTHREAD_MUTEX_INITIALIZER,
+        .wake = PTHREAD_COND_INITIALIZER,
+    };
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+    if (threads > GLOB_THREADS) threads = GLOB_THREADS;
+
+    struct tree_worker *workers = calloc(threads, sizeof(*workers));
+    if (!workers) return -ENOMEM;
+
+    /* The "**" matches no directory at all, too */
+    int rv = 0;
+    if (!t.next && *prefix && is_dir(prefix)) rv = add_path(w, (char *) prefix);
+
+    struct tree_job root = {.path = (char *) prefix};
+    t.jobs = &root;
+    int started = 0;
+    for (int i = 0; i < threads && rv == 0; i++, started++) {
+        workers[i].t = &t;
+        if (i && pthread_create(&workers[i].thread, NULL, tree_thread, &workers[i]))
+            break;
+    }
+    /* This thread is one of them */
+    if (rv == 0) tree_thread(&workers[0]);
+    for (int i = 1; i < started; i++) pthread_join(workers[i].thread, NULL);
+    trace_span("globstar", trace_start, prefix);
+
+    if (rv == 0) rv = t.error;
+    for (int i = 0; i < started && rv == 0; i++) {
+        for (int h = 0; h < workers[i].count && rv == 0; h++) {
+            struct tree_hit *hit = &workers[i].hits[h];
+            char *path = arena_strndup(w->cache->arena, hit->path, strlen(hit->path));
+            if (!path) rv = -ENOMEM;
+            else if (hit->seg < 0) rv = add_path(w, path);
+            else rv = walk(w, path, hit->seg);
+        }
+    }
+    for (int i = 0; i < threads; i++) arena_free(&workers[i].arena);
+    free(workers);
+    return rv;
+}
+
+/* Match the segments from seg on, under prefix, which is the path so far
+ * with its trailing '/' */
+static int walk(struct glob_walk *w, const char *prefix, int seg) {
+    struct segment *s = &w->segments[seg];
+    struct arena *arena = w->cache->arena;
+    bool last = seg == w->count - 1;
+    char *path;
+
+    if (s->recursive) return walk_tree(w, prefix, seg);
+
+    if (s->pattern.literal) {
+        if (!(path = join(arena, prefix, s->text, !last || w->dirs_only))) return -ENOMEM;
+        if (!last) return walk(w, path, seg + 1);
+
+        /* Nothing was matched by name here, so the path may not exist */
+        struct stat st;
+        if (w->dirs_only ? !is_dir(path) : lstat(path, &st) < 0) return 0;
+        return add_path(w, path);
+    }
+
+    struct dir_listing dir;
+    int rv = list_dir(w->cache, prefix, &dir);
+    for (int i = 0; i < dir.count && rv == 0; i++) {
+        struct dir_entry *entry = &dir.entries[i];
+        if (entry->name[0] == '.' && !s->pattern.leading_dot) continue;
+        if (!pattern_matches(&s->pattern, entry->name)) continue;
+        if (!last && !maybe_dir(entry)) continue;
+
+        if (!(path = join(arena, prefix, entry->name, !last || w->dirs_only)))
+            return -ENOMEM;
+        if (!last) rv = walk(w, path, seg + 1);
+        else if (!w->dirs_only || entry->type == DT_DIR ||
+                 (maybe_dir(entry) && is_dir(path)))
+            rv = add_path(w, path);
+    }
+    return rv;
+}
+
+int expand_glob(const char *word, struct glob_cache *cache, char ***paths) {
+    struct glob_walk w = {.cache = cache};
+    const char *prefix = "";
+
+    /* The segments, each NUL-terminated in a copy of the word */
+    size_t len = strlen(word);
+    char *copy = arena_strndup(cache->arena, word, len);
+    if (!copy) return -ENOMEM;
+    if (*copy == '/') {
+        prefix = "/";
+        copy++;
+        len--;
+    }
+    if (len && copy[len - 1] == '/') {
+        w.dirs_only = true;
+        copy[--len] = '\0';
+    }
+
+    int cap = 1;
+    for (size_t i = 0; i < len; i++) cap += copy[i] == '/';
+    if (!(w.segments = arena_alloc(cache->arena, cap * sizeof(*w.segments)))) return -ENOMEM;
+    for (char *text = copy, *slash; text; text = slash ? slash + 1 : NULL) {
+        if ((slash = strchr(text, '/'))) *slash = '\0';
+
+        /* "**" after "**" matches nothing more */
+        bool recursive = strcmp(text, "**") == 0;
+        if (recursive && w.count && w.segments[w.count - 1].recursive) continue;
+
+        struct segment *s = &w.segments[w.count++];
+        s->text = text;
+        s->recursive = recursive;
+        if (compile_pattern(&s->pattern, text, strlen(text), cache->arena)) return -ENOMEM;
+    }
+
+    int rv = walk(&w, prefix, 0);
+    if (rv < 0) return rv;
+
+    if (w.found) qsort(w.paths, w.found, sizeof(char *), compare_paths);
+    *paths = w.paths;
+    return w.found;
+}
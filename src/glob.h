@@ -0,0 +1,63 @@
+/*
+ *  Filename expansion: a word with a '*', a '?' or a bracket expression in
+ *  any of its path segments becomes the paths that match it.
+ */
+
+#ifndef GLOB_H
+#define GLOB_H
+
+#include "utils/arena.h"
+
+/**
+ * The most paths a glob may expand to.  A glob that matches more fails
+ * with -E2BIG as soon as it gets there, instead of walking on.
+ */
+#define GLOB_MAX_PATHS (1 << 17)
+
+/**
+ * The most threads that walk the directories of a "**".
+ */
+#define GLOB_THREADS 8
+
+struct dir_listing;
+
+/**
+ * The directories the globs of a pipeline have read, so the globs `*.c` and
+ * `*.h` read the current directory once.  It lives as long as the
+ * expansion of the pipeline: once commands have run, the directories may
+ * have changed.
+ */
+struct glob_cache {
+    struct arena *arena;        // Where the listings, and the paths, live
+    struct dir_listing *dirs;
+    int count;
+    int cap;
+};
+
+/**
+ * Starts an empty cache.
+ *
+ * @param cache The cache.
+ * @param arena Where the listings, and the paths found, are allocated.
+ */
+void glob_cache_init(struct glob_cache *cache, struct arena *arena);
+
+/**
+ * Finds the paths a glob matches.  A name starting with a '.' is only
+ * matched by a segment that starts with one, and "." and ".." never are.
+ * A trailing '/' only matches directories, and is kept on the paths.
+ *
+ * A segment that is just "**" matches any number of directories, itself
+ * included, as bash's globstar does: hidden directories and symbolic
+ * links are not walked into.  The tree is walked by up to GLOB_THREADS
+ * threads.
+ *
+ * @param word The glob.
+ * @param cache The directories read so far.
+ * @param paths Returns the paths, sorted, in the arena of the cache.
+ * @return The number of paths, 0 if nothing matches, -E2BIG past
+ *         GLOB_MAX_PATHS, or -errno.
+ */
+int expand_glob(const char *word, struct glob_cache *cache, char ***paths);
+
+#endif // GLOB_H
@@ -15,6 +15,7 @@
 const char *DELIM = "\1\2";
 char *history[MAX_HISTORY];
 int history_count = 0;
+static int history_loaded = 0; // Only a shell that loaded the file saves it
 
 /* Add a line to the history
  */
@@ -49,6 +50,8 @@ void print_history(int stdout) {
 }
 
 int save_history(void) {
+    if (!history_loaded) return 0;
+
     const char *home_dir = getenv("HOME");
     if (!home_dir) {
         home_dir = "/tmp";  // Fallback directory
@@ -68,6 +71,8 @@ int save_history(void) {
 }
 
 int load_history(void) {
+    history_loaded = 1;
+
     const char *home_dir = getenv("HOME");
     if (!home_dir) {
         home_dir = "/tmp";  // Fallback directory
@@ -26,6 +26,8 @@ void print_history(int stdout);
 /**
  * Saves the command history to a file in the user's home directory.
  * The history is saved to a file named `.thsh_history`.
+ * Does nothing unless load_history() was called, so a script never
+ * overwrites the history of interactive sessions.
  *
  * @return 0 on success, -1 on failure.
  */
@@ -1 +1,136 @@
-#include "input_handler.h"
\ No newline at end of file
+/*
+ * This file implements the interactive line editor: reading a command
+ * from the terminal one key at a time, with history and tab completion.
+ */
+
+#include "input_handler.h"
+#include "builtin.h"
+#include "history.h"
+#include "jobs.h"
+#include "raw_mode.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void init_input_handler(Trie *root) {
+    populate_trie(root, get_path_table());
+    populate_trie(root, get_builtin_names());
+}
+
+/* Replace the line being edited with another one */
+static void replace_line(char *cmd, int *cmd_len, const char *line) {
+    // clear current command
+    while (*cmd_len > 0) {
+        write(STDOUT_FILENO, "\b \b", 3);
+        (*cmd_len)--;
+    }
+    strcpy(cmd, line);
+    *cmd_len = strlen(cmd);
+    write(STDOUT_FILENO, cmd, *cmd_len);
+}
+
+int read_input_line(int input_fd, char *cmd, int *history_idx, Trie *root) {
+    int cmd_len = 0;
+    char c;
+    ssize_t nread;
+
+    while ((nread = read(input_fd, &c, 1)) == 1) {
+        if (c == '\x1b') {
+            /*
+             *  ESC handling -- for arrow keys
+             */
+            char seq[3];
+            if (read(STDIN_FILENO, &seq[0], 1) != 1) break;
+            if (read(STDIN_FILENO, &seq[1], 1) != 1) break;
+
+            if (seq[0] == '[') {
+                switch (seq[1]) {
+                    case 'A': {  // UP arrow key
+                        char *prev_cmd = get_prev_history_command(history_idx);
+                        if (prev_cmd) replace_line(cmd, &cmd_len, prev_cmd);
+                        break;
+                    }
+                    case 'B': {  // DOWN arrow key
+                        char *next_cmd = get_next_history_command(history_idx);
+                        if (next_cmd) replace_line(cmd, &cmd_len, next_cmd);
+                        break;
+                    }
+                }
+            }
+            continue;
+        } else if (c == '\n' || c == '\r') {
+            /*
+             * NEWLINE HANDLING
+             */
+            printf("\n");
+            break;
+        } else if (c == '\t') {
+            /*
+             * TAB HANDLING
+             */
+            static int tab_count = 0;
+            tab_count++;
+
+            if (cmd_len <= 0) {
+                tab_count = 0;
+                continue; // No suggestions if no input
+            }
+            cmd[cmd_len] = '\0'; // Temporarily null-terminate current input
+
+            int num_suggestions = 0;
+            char **suggestions = find_suggestion(root, cmd, &num_suggestions);
+
+            /* If there is only one suggestion, auto-complete the command.
+             * If there are multiple suggestions, print them all out after
+             * multiple tab spaces (ubuntu behavior)
+             */
+            if (num_suggestions == 1) {
+                replace_line(cmd, &cmd_len, suggestions[0]);
+            } else if (num_suggestions > 1) {
+                if (tab_count >= 2) {
+                    // Display all options
+                    printf("\n");
+                    for (int i = 0; i < num_suggestions; i++) {
+                        printf("%s\n", suggestions[i]);
+                    }
+                    printf("\n");
+                    print_prompt();
+                    write(STDOUT_FILENO, cmd, cmd_len);
+                }
+            }
+            free(suggestions);
+            continue;
+        } else if (c == '\x7f' || c == '\b') {
+            /*
+             * BACKSPACE HANDLING
+             */
+            if (cmd_len > 0) {
+                cmd[--cmd_len] = '\0'; // Remove the last character from the buffer
+                write(STDOUT_FILENO, "\b \b", 3); // Move back, write space, move back again
+            }
+            continue;
+        } else if (isprint(c)) {
+            /*
+             * PRINTABLE CHARACTER HANDLING
+             */
+            if (cmd_len < MAX_INPUT - 1) {
+                cmd[cmd_len++] = c;
+                write(STDOUT_FILENO, &c, 1); // Echo back the character
+            }
+        }
+    }
+
+    // End of the input: nothing left to run
+    if (nread <= 0 && cmd_len == 0) return -1;
+
+    cmd[cmd_len] = '\0'; // Null-terminate the command
+    return cmd_len;
+}
+
+void cleanup_input_handler(void) {
+    disable_raw_mode();
+}
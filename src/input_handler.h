@@ -8,12 +8,15 @@
 #include "utils/trie.h"
 
 /*
- * Initializes the input handler.
+ * Initializes the input handler: fills the completion trie with the
+ * commands on the PATH and the builtins.
  */
 void init_input_handler(Trie *root);
 
 /*
- * Reads a line of input from the terminal.
+ * Reads a line of input from the terminal, with line editing, history
+ * (arrow keys) and tab completion.  The terminal must be in raw mode.
+ * Returns the length of the line, or -1 at the end of the input.
  */
 int read_input_line(int input_fd, char *cmd, int *history_idx, Trie *root);
 
@@ -3,24 +3,61 @@
  * jobs and job control, and the implementation of the execution of commands.
  */
 
+#define _GNU_SOURCE
+
 #include "jobs.h"
-#include "utils/constants.h"
+#include "builtin.h"
+#include "functions.h"
+#include "spawn.h"
+#include "utils/cmd_hash.h"
+#include "utils/trace.h"
+#include "vars.h"
 #include <assert.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <termios.h>
 #include <unistd.h>
 #include <errno.h>
 
+/**
+ * Number of child state changes the SIGCHLD handler can queue up before the
+ * main loop gets to them.
+ */
+#define REAP_RING_SIZE 256
+
 static char **path_table;
-static int job_counter = 0;
+static char *path_source; // The PATH value path_table was built from
 static struct job *jobbies = NULL;
 
+static bool job_control = false; // Jobs get process groups and the terminal
+static bool subshell = false;    // In a forked copy of the shell
+static pid_t shell_pgid;
+
+/* State changes collected by the SIGCHLD handler, waiting to be matched
+ * against the job list from the main loop */
+static struct {
+    pid_t pid;
+    int status;
+    struct timespec when;
+    struct rusage usage;
+} reaped[REAP_RING_SIZE];
+static int reap_start = 0;
+static int reap_count = 0;
+
+/* Free a table of PATH prefixes, up to its NULL terminator */
+static void free_path_table(char **table) {
+    for (int i = 0; table[i]; i++)
+        free(table[i]);
+    free(table);
+}
+
 int init_path(void) {
-    char *path_var = getenv("PATH");
-    char *next_colon;
+    const char *path_var = get_var("PATH");
+    const char *next_colon;
     int index = 0;
 
     if (!path_var) {
@@ -28,36 +65,55 @@ int init_path(void) {
         return -errno;
     }
 
-    path_table = malloc(MAX_PATHS * sizeof(char *));
-    if (!path_table) {
+    /* The new table is built on the side, so a failure leaves the one of
+     * the previous PATH in place */
+    char **table = malloc(MAX_PATHS * sizeof(char *));
+    char *source = strdup(path_var);
+    if (!table || !source) {
         perror("Failed to allocate memory for path_table.");
-        return -errno;
+        free(table);
+        free(source);
+        return -ENOMEM;
     }
+    table[0] = NULL;
 
     while (*path_var) {
+        if (index + 1 >= MAX_PATHS) {
+            fprintf(stderr, "Exceeded path table size.\n");
+            free_path_table(table);
+            free(source);
+            return -E2BIG;
+        }
+
         next_colon = strchr(path_var, ':') ?: path_var + strlen(path_var);
 
         int len = (int) (next_colon - path_var);
-        path_table[index] = len ? strndup(path_var, len) : strdup(".");
+        table[index] = len ? strndup(path_var, len) : strdup(".");
 
-        if (!path_table[index]) {
+        if (!table[index]) {
             perror("Failed to allocate memory for path_table entry.");
-            return -errno;
+            free_path_table(table);
+            free(source);
+            return -ENOMEM;
         }
 
-        for (; len > 0 && path_table[index][len - 1] == '/'; len--)
-            path_table[index][len - 1] = '\0';
-
-        if (++index >= MAX_PATHS) {
-            perror("Exceeded path table size.\n");
-            return -errno;
-        }
+        for (; len > 0 && table[index][len - 1] == '/'; len--)
+            table[index][len - 1] = '\0';
 
+        table[++index] = NULL;
         path_var = *next_colon ? next_colon + 1 : next_colon;
     }
 
-    path_table[index] = NULL;
+    /* Drop the table of a previous PATH, along with everything that was
+     * resolved through it */
+    if (path_table) {
+        free_path_table(path_table);
+        free(path_source);
+        cmd_hash_reset();
+    }
 
+    path_table = table;
+    path_source = source;
     return 0;
 }
 
@@ -77,10 +133,130 @@ void print_path_table() {
     printf("===== End Path Table =====\n");
 }
 
-int create_job(void) {
+/* Block SIGCHLD, so the handler cannot run while we look at the job list */
+static void block_sigchld(sigset_t *old) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &set, old);
+}
+
+/* Collect every child that changed state, for as long as there is room in
+ * the ring.  Runs from the SIGCHLD handler, so only async-signal-safe calls
+ * are allowed here. */
+static void reap_children(void) {
+    int saved_errno = errno;
+    int status;
+    pid_t pid;
+    struct rusage usage;
+
+    /* wait4() hands over each child's own resource usage, which `time`
+     * reports per stage */
+    while (reap_count < REAP_RING_SIZE &&
+           (pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+        int slot = (reap_start + reap_count) % REAP_RING_SIZE;
+        reaped[slot].pid = pid;
+        reaped[slot].status = status;
+        reaped[slot].usage = usage;
+        clock_gettime(CLOCK_MONOTONIC, &reaped[slot].when);
+        reap_count++;
+    }
+    errno = saved_errno;
+}
+
+static void sigchld_handler(int sig) {
+    (void) sig;
+    reap_children();
+}
+
+/* Apply one state change to the kiddo it belongs to, if any */
+static void record_status(int slot) {
+    pid_t pid = reaped[slot].pid;
+    int status = reaped[slot].status;
+
+    for (struct job *j = jobbies; j; j = j->next) {
+        for (struct kiddo *k = j->kidlets; k; k = k->next) {
+            if (k->pid != pid) continue;
+            if (WIFSTOPPED(status)) {
+                k->stopped = true;
+            } else if (WIFCONTINUED(status)) {
+                k->stopped = false;
+            } else {
+                k->done = true;
+                k->stopped = false;
+                k->status = status;
+                k->ended = reaped[slot].when;
+                k->usage = reaped[slot].usage;
+                trace_span_on("process",
+                              k->started.tv_sec * 1000000000ULL + k->started.tv_nsec,
+                              k->ended.tv_sec * 1000000000ULL + k->ended.tv_nsec,
+                              pid, NULL);
+            }
+            return;
+        }
+    }
+}
+
+/* Move everything the handler collected onto the job list.  Must be called
+ * with SIGCHLD blocked. */
+static void drain_reaped(void) {
+    do {
+        while (reap_count) {
+            record_status(reap_start);
+            reap_start = (reap_start + 1) % REAP_RING_SIZE;
+            reap_count--;
+        }
+        /* The ring may have filled up and left zombies behind */
+        reap_children();
+    } while (reap_count);
+}
+
+static void give_terminal(pid_t pgid) {
+    sigset_t set, old;
+
+    /* tcsetpgrp() from a background group raises SIGTTOU, unless it is
+     * blocked */
+    sigemptyset(&set);
+    sigaddset(&set, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &set, &old);
+    tcsetpgrp(STDIN_FILENO, pgid);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+int init_jobs(bool interactive) {
+    struct sigaction sa;
+
+    sa.sa_handler = sigchld_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGCHLD, &sa, NULL) < 0) return -errno;
+
+    /* With a terminal, every job gets its own process group, and the
+     * foreground one owns the terminal, so ^C and ^Z only reach it. */
+    if (interactive && isatty(STDIN_FILENO)) {
+        setpgid(0, 0);
+        shell_pgid = getpgrp();
+        give_terminal(shell_pgid);
+        job_control = true;
+    }
+    return 0;
+}
+
+int create_job(const char *cmdline) {
     struct job *tmp;
     struct job *j = malloc(sizeof(struct job));
-    j->id = ++job_counter;
+    if (!j) {
+        perror("Failed to allocate memory for job.");
+        return -errno;
+    }
+    /* Like other shells, number jobs one past the highest active one, so
+     * numbers stay small */
+    j->id = 1;
+    for (tmp = jobbies; tmp; tmp = tmp->next)
+        if (tmp->id >= j->id) j->id = tmp->id + 1;
+    j->pgid = job_control ? 0 : -1;
+    j->cmdline = strdup(cmdline ?: "");
+    j->background = false;
     j->kidlets = NULL;
     j->next = NULL;
     if (jobbies) {
@@ -102,7 +278,7 @@ static struct job *find_job(int job_id, bool remove) {
                     last->next = tmp->next;
                 } else {
                     assert(tmp == jobbies);
-                    jobbies = NULL;
+                    jobbies = tmp->next;
                 }
             }
             return tmp;
@@ -112,7 +288,139 @@ static struct job *find_job(int job_id, bool remove) {
     return NULL;
 }
 
-int run_command(char *args[MAX_ARGS], int stdin, int stdout, int job_id) {
+static void free_job(struct job *j) {
+    find_job(j->id, true);
+
+    struct kiddo *k = j->kidlets;
+    while (k) {
+        struct kiddo *next_kid = k->next;
+        free(k);
+        k = next_kid;
+    }
+    free(j->cmdline);
+    free(j);
+}
+
+static bool job_done(struct job *j) {
+    for (struct kiddo *k = j->kidlets; k; k = k->next)
+        if (!k->done) return false;
+    return true;
+}
+
+/* A job is stopped once every process that is still around is stopped */
+static bool job_stopped(struct job *j) {
+    bool any = false;
+    for (struct kiddo *k = j->kidlets; k; k = k->next) {
+        if (k->done) continue;
+        if (!k->stopped) return false;
+        any = true;
+    }
+    return any;
+}
+
+/* The exit code of a job is the one of its last stage */
+static int job_exit_code(struct job *j) {
+    struct kiddo *k = j->kidlets;
+    if (!k) return 0;
+    while (k->next) k = k->next;
+    return WIFSIGNALED(k->status) ? 128 + WTERMSIG(k->status)
+                                  : WEXITSTATUS(k->status);
+}
+
+/* Sleep until the job is done or stopped.  Returns true if it is done. */
+static bool wait_for_job(struct job *j) {
+    sigset_t old, suspend;
+
+    block_sigchld(&old);
+    suspend = old;
+    sigdelset(&suspend, SIGCHLD);
+
+    drain_reaped();
+    while (!job_done(j) && !job_stopped(j)) {
+        sigsuspend(&suspend);
+        drain_reaped();
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    return job_done(j);
+}
+
+/* Send SIGCONT to every process of the job */
+static void continue_job(struct job *j) {
+    sigset_t old;
+
+    /* Forget about stops we have not looked at yet, before the SIGCONT
+     * makes them stale */
+    block_sigchld(&old);
+    drain_reaped();
+    for (struct kiddo *k = j->kidlets; k; k = k->next) {
+        if (!k->done) k->stopped = false;
+        if (j->pgid <= 0 && !k->done) kill(k->pid, SIGCONT);
+    }
+    if (j->pgid > 0) kill(-j->pgid, SIGCONT);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+static const char *job_state(struct job *j) {
+    if (job_done(j)) return "Done";
+    if (job_stopped(j)) return "Stopped";
+    return "Running";
+}
+
+char *resolve_command(const char *name) {
+    bool found;
+    const char *path_var = get_var("PATH");
+
+    /* PATH changed under us, so every cached resolution is suspect */
+    if (path_var && (!path_source || strcmp(path_var, path_source) != 0))
+        init_path();
+
+    if (!path_table) return NULL;
+    cmd_hash_validate(path_table);
+
+    const char *path = cmd_hash_get(name, &found);
+    if (found) return (char *) path;
+
+    /* A relative directory, such as ".", is another one after a cd: what
+     * is found once it has been searched, misses included, is not hashed */
+    static char *unhashed;
+    bool relative = false;
+
+    for (int i = 0; path_table[i]; i++) {
+        char tmp[strlen(path_table[i]) + strlen(name) + 2];
+        sprintf(tmp, "%s/%s", path_table[i], name);
+        if (path_table[i][0] != '/') relative = true;
+        if (access(tmp, X_OK) != 0) continue;
+
+        if (relative) {
+            free(unhashed);
+            return unhashed = strdup(tmp);
+        }
+        cmd_hash_put(name, tmp);
+        return (char *) cmd_hash_get(name, &found);
+    }
+
+    if (!relative) cmd_hash_put(name, NULL);
+    return NULL;
+}
+
+/* Record a freshly launched process as the last one of job j */
+static void add_kiddo(struct job *j, struct kiddo *kid, pid_t pid) {
+    /* The first stage leads the job's process group */
+    if (j->pgid == 0) j->pgid = pid;
+
+    /* Append, so the kidlets stay in pipeline order */
+    kid->pid = pid;
+    kid->status = 0;
+    kid->done = false;
+    kid->stopped = false;
+    kid->next = NULL;
+    struct kiddo **tail = &j->kidlets;
+    while (*tail) tail = &(*tail)->next;
+    *tail = kid;
+}
+
+int run_command(char *args[], int stdin, int stdout, int job_id) {
     char *path = NULL;
 
     if (!args[0]) return 0;
@@ -120,74 +428,344 @@ int run_command(char *args[MAX_ARGS], int stdin, int stdout, int job_id) {
     /* If the first argument starts with a '.' or a '/', it is an absolute path
      * and can execute as-is.
      *
-     * Otherwise, search each prefix in the path_table in order to find the path
-     * to the binary.
+     * Otherwise, resolve it through the command hash, which only searches
+     * the path_table for names it has not seen before.
      */
-    char pre = '\r';
-    write(STDOUT_FILENO, &pre, 1);
-
-    if (*args[0] == '.' || *args[0] == '/') path = args[0];
-    else {
-        for (int i = 0; path_table[i]; i++) {
-            char tmp[strlen(path_table[i]) + strlen(args[0]) + 2];
-            sprintf(tmp, "%s/%s", path_table[i], args[0]);
-            if (access(tmp, X_OK) == 0) {
-                path = strdup(tmp);
-                break;
-            }
-        }
+    if (job_control) {
+        char pre = '\r';
+        write(STDOUT_FILENO, &pre, 1);
     }
 
-    /* Ensure that our path exists, otherwise we terminate with error */
-    if (!path || stat(path, &(struct stat) {}) != 0) return -ENOENT;
+    uint64_t trace_start = trace_now();
+    bool hashed = !(*args[0] == '.' || *args[0] == '/');
+    if (!hashed) {
+        /* Ensure that our path exists, otherwise we terminate with error */
+        if (stat(args[0], &(struct stat) {}) != 0) return -ENOENT;
+        path = args[0];
+    } else if (!(path = resolve_command(args[0]))) {
+        trace_span("lookup", trace_start, args[0]);
+        return -ENOENT;
+    }
+    trace_span("lookup", trace_start, args[0]);
 
     /*
-     * This block handles the forking of the current process to execute a command.
-     * It ensures proper redirection of stdin and stdout, allowing for
+     * This block hands the command to the configured spawn backend, which
+     * takes care of the redirection of stdin and stdout, allowing for
      * command output and input to be directed as needed.
-     * The parent process waits for the child to complete, making sure that we
-     * don't have any zombie processes.
+     * The parent does not wait here: the child is recorded in the job, and
+     * reaped by wait_on_job() once every stage of the pipeline is running.
      */
+    struct job *j = find_job(job_id, false);
+    if (!j) return -ESRCH;
+
+    struct kiddo *kid = malloc(sizeof(struct kiddo));
+    if (!kid) return -ENOMEM;
+
+    pid_t pid;
+    trace_start = trace_now();
+    clock_gettime(CLOCK_MONOTONIC, &kid->started);
+    int rv = spawn_process(path, args, stdin, stdout, j->pgid, &pid);
+    if (rv == -ENOENT && hashed) {
+        /* The binary went away since it was hashed; look it up again */
+        cmd_hash_remove(args[0]);
+        if ((path = resolve_command(args[0])))
+            rv = spawn_process(path, args, stdin, stdout, j->pgid, &pid);
+    }
+    trace_span("spawn", trace_start, args[0]);
+    if (rv < 0) {
+        free(kid);
+        return rv;
+    }
+    trace_name_track(pid, args[0]);
+    add_kiddo(j, kid, pid);
+    return 0;
+}
+
+/* Fork a copy of the shell as a process of job j, with stdin and stdout
+ * in place.  With own_jobs, the commands it runs are jobs of its own, in
+ * the process group of this one, that it waits on.  Returns 0 in the copy,
+ * its pid in the shell, or -errno. */
+static pid_t fork_copy(struct job *j, int stdin, int stdout, int spare, bool own_jobs) {
+    struct kiddo *kid = malloc(sizeof(struct kiddo));
+    if (!kid) return -ENOMEM;
+
+    /* Flush first, or the child would write out our buffered output too */
+    fflush(NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &kid->started);
     pid_t pid = fork();
-    if (pid < 0) return -errno;
-    if (pid == 0) {
-        if (stdin != STDIN_FILENO) {
-            dup2(stdin, STDIN_FILENO);
-            close(stdin);
-        }
-        if (stdout != STDOUT_FILENO) {
-            dup2(stdout, STDOUT_FILENO);
-            close(stdout);
-        }
-        execve(path, args, __environ);
-        perror("execve");
-        _exit(errno);
+    if (pid < 0) {
+        free(kid);
+        return -errno;
+    }
+    if (pid > 0) {
+        /* Like the spawn backends, set the group from both sides, so it
+         * exists whichever of us gets there first */
+        if (j->pgid >= 0) setpgid(pid, j->pgid ?: pid);
+        add_kiddo(j, kid, pid);
+        return pid;
+    }
+
+    /* Nothing of the shell's job control applies to the copy, and ^C or ^Z
+     * should reach it like any other stage */
+    sigset_t none;
+    sigemptyset(&none);
+    if (own_jobs) {
+        job_control = false;
+        jobbies = NULL;
+        reap_start = reap_count = 0;
     } else {
-        int status;
-        waitpid(pid, &status, 0);
+        signal(SIGCHLD, SIG_DFL);
+    }
+    subshell = true;
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    /* Like a command that fails to exec, a copy that cannot get the
+     * attributes it asked for does not run */
+    int rv = apply_sched(get_spawn_sched(), 0);
+    if (rv < 0) {
+        dprintf(STDERR_FILENO, "sched: %s\n", strerror(-rv));
+        _exit(127);
+    }
+    if (j->pgid >= 0) setpgid(0, j->pgid);
+    if (spare >= 0) close(spare);
+    if (stdin != STDIN_FILENO) {
+        dup2(stdin, STDIN_FILENO);
+        close(stdin);
     }
+    if (stdout != STDOUT_FILENO) {
+        dup2(stdout, STDOUT_FILENO);
+        close(stdout);
+    }
+    return 0;
+}
+
+int run_builtin(char *args[], int stdin, int stdout, int spare, int job_id) {
+    struct job *j = find_job(job_id, false);
+    if (!j) return -ESRCH;
+
+    /* A builtin has no children; a function's body may have some */
+    uint64_t trace_start = trace_now();
+    pid_t pid = fork_copy(j, stdin, stdout, spare, is_function(args[0]));
+    if (pid < 0) return pid;
+    if (pid == 0) {
+        int rv = 0;
+        handle_builtin(args, STDIN_FILENO, STDOUT_FILENO, &rv);
+        fflush(NULL);
+        _exit(rv < 0 ? 1 : rv);
+    }
+    trace_span("spawn", trace_start, args[0]);
+    trace_name_track(pid, args[0]);
+    return 0;
+}
+
+int run_subshell(int (*body)(void *ctx), void *ctx, int stdout, int spare, int job_id) {
+    struct job *j = find_job(job_id, false);
+    if (!j) return -ESRCH;
 
-    free(path);
-    (void) &find_job;
+    uint64_t trace_start = trace_now();
+    pid_t pid = fork_copy(j, STDIN_FILENO, stdout, spare, true);
+    if (pid < 0) return pid;
+    if (pid == 0) {
+        int status = body(ctx);
+        fflush(NULL);
+        _exit(status);
+    }
+    trace_span("spawn", trace_start, "subshell");
+    trace_name_track(pid, "subshell");
     return 0;
 }
 
+bool in_subshell(void) {
+    return subshell;
+}
+
 int wait_on_job(int job_id, int *exit_code) {
+    return wait_on_job_usage(job_id, exit_code, NULL, NULL);
+}
+
+int wait_on_job_usage(int job_id, int *exit_code, struct proc_usage *usage, int *count) {
     struct job *j = find_job(job_id, false);
     if (!j) return -ENOENT;
 
-    int status;
-    struct kiddo *k = j->kidlets;
-    while (k) {
-        waitpid(k->pid, &status, 0);
-        if (exit_code) *exit_code = status;
+    j->background = false;
+    if (job_control && j->pgid > 0) {
+        give_terminal(j->pgid);
+        /* A stage that touched the terminal before it was handed over got
+         * stopped by SIGTTIN; let it carry on now that it owns it. */
+        continue_job(j);
+    }
 
-        struct kiddo *next_kid = k->next;
-        free(k);
-        k = next_kid;
+    bool done = wait_for_job(j);
+
+    if (job_control && j->pgid > 0) give_terminal(shell_pgid);
+
+    if (!done) {
+        /* ^Z: the job stays around, and the prompt comes back */
+        j->background = true;
+        dprintf(STDERR_FILENO, "\n[%d]+  %-24s%s\n", j->id, "Stopped", j->cmdline);
+        if (exit_code) *exit_code = 128 + SIGTSTP;
+        if (count) *count = 0;
+        return -EAGAIN;
+    }
+
+    if (usage && count) {
+        int n = 0;
+        for (struct kiddo *k = j->kidlets; k && n < *count; k = k->next, n++) {
+            usage[n].pid = k->pid;
+            usage[n].status = k->status;
+            usage[n].real = (k->ended.tv_sec - k->started.tv_sec) +
+                            (k->ended.tv_nsec - k->started.tv_nsec) / 1e9;
+            usage[n].usage = k->usage;
+        }
+        *count = n;
     }
 
+    int code = job_exit_code(j);
+    if (exit_code) *exit_code = code;
+
+    // ^C leaves the cursor after the echoed "^C"; start the prompt afresh
+    if (job_control && code == 128 + SIGINT) write(STDOUT_FILENO, "\n", 1);
+
     // Remove job from jobbies list
-    find_job(job_id, true);
+    free_job(j);
+    return 0;
+}
+
+int background_job(int job_id) {
+    struct job *j = find_job(job_id, false);
+    if (!j) return -ENOENT;
+
+    j->background = true;
+    /* Only an interactive shell announces the jobs it starts */
+    if (job_control)
+        dprintf(STDERR_FILENO, "[%d] %d\n", j->id, j->pgid > 0 ? j->pgid : 0);
+    return 0;
+}
+
+int resume_job(int job_id, bool foreground, int *exit_code) {
+    struct job *j = find_job(job_id, false);
+    if (!j) return -ENOENT;
+
+    if (foreground) {
+        dprintf(STDERR_FILENO, "%s\n", j->cmdline);
+        /* With job control, wait_on_job() continues the job itself */
+        if (!job_control) continue_job(j);
+        int rv = wait_on_job(job_id, exit_code);
+        return rv == -EAGAIN ? 0 : rv;
+    }
+
+    continue_job(j);
+    j->background = true;
+    dprintf(STDERR_FILENO, "[%d]+ %s &\n", j->id, j->cmdline);
+    return 0;
+}
+
+int await_job(int job_id, int *exit_code) {
+    struct job *j = find_job(job_id, false);
+    if (!j) return -ENOENT;
+
+    if (!wait_for_job(j)) return -EAGAIN;
+
+    if (exit_code) *exit_code = job_exit_code(j);
+    free_job(j);
     return 0;
-}
\ No newline at end of file
+}
+
+int await_any_job(int *exit_code) {
+    sigset_t old, suspend;
+    struct job *done;
+
+    block_sigchld(&old);
+    suspend = old;
+    sigdelset(&suspend, SIGCHLD);
+
+    for (;;) {
+        bool running = false;
+
+        drain_reaped();
+        for (done = jobbies; done; done = done->next) {
+            if (!done->background) continue;
+            if (job_done(done)) break;
+            if (!job_stopped(done)) running = true;
+        }
+        if (done || !running) break;
+        sigsuspend(&suspend);
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    if (!done) return -ECHILD;
+
+    int id = done->id;
+    if (exit_code) *exit_code = job_exit_code(done);
+    free_job(done);
+    return id;
+}
+
+int find_job_spec(const char *spec, bool by_pid) {
+    char *end;
+    long n;
+
+    if (!spec || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0) {
+        /* The current job is the most recent one still around */
+        struct job *last = NULL;
+        for (struct job *j = jobbies; j; j = j->next)
+            if (j->background) last = j;
+        return last ? last->id : -ENOENT;
+    }
+
+    bool is_job = spec[0] == '%';
+    n = strtol(spec + is_job, &end, 10);
+    if (*end || end == spec + is_job || n <= 0) return -EINVAL;
+
+    for (struct job *j = jobbies; j; j = j->next) {
+        if (is_job || !by_pid) {
+            if (j->id == n) return j->id;
+            continue;
+        }
+        for (struct kiddo *k = j->kidlets; k; k = k->next)
+            if (k->pid == n) return j->id;
+    }
+    return -ENOENT;
+}
+
+void update_jobs(void) {
+    sigset_t old;
+    block_sigchld(&old);
+    drain_reaped();
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+void print_jobs(int fd) {
+    struct job *current = NULL;
+
+    update_jobs();
+    for (struct job *j = jobbies; j; j = j->next)
+        if (j->background) current = j;
+
+    for (struct job *j = jobbies; j; j = j->next) {
+        if (!j->background) continue;
+        dprintf(fd, "[%d]%c  %-24s%s%s\n", j->id, j == current ? '+' : ' ',
+                job_state(j), j->cmdline, job_stopped(j) ? "" : " &");
+    }
+}
+
+void notify_jobs(void) {
+    update_jobs();
+
+    struct job *j = jobbies;
+    while (j) {
+        struct job *next = j->next;
+        if (j->background && job_done(j)) {
+            int code = job_exit_code(j);
+            if (code) {
+                char state[32];
+                snprintf(state, sizeof(state), "Exit %d", code);
+                dprintf(STDERR_FILENO, "[%d]   %-24s%s\n", j->id, state, j->cmdline);
+            } else {
+                dprintf(STDERR_FILENO, "[%d]   %-24s%s\n", j->id, "Done", j->cmdline);
+            }
+            free_job(j);
+        }
+        j = next;
+    }
+}
@@ -1,8 +1,9 @@
 #ifndef JOBS_H
 #define JOBS_H
 
-#include "utils/constants.h"
 #include <stdbool.h>
+#include <sys/resource.h>
+#include <time.h>
 
 /**
  * Maximum number of PATH prefixes that can be stored.
@@ -11,11 +12,30 @@
 
 struct kiddo {
     int pid;
+    int status; // As reported by waitpid(), once done
+    bool done; // Exited or killed
+    bool stopped; // Stopped by a signal, and not continued since
+    struct timespec started; // CLOCK_MONOTONIC at launch
+    struct timespec ended; // CLOCK_MONOTONIC when it was reaped
+    struct rusage usage; // As reported by wait4(), once done
     struct kiddo *next; // Linked list of sibling processes
 };
 
+/**
+ * What one process of a job cost, as collected by wait4() when it exited.
+ */
+struct proc_usage {
+    int pid;
+    int status;
+    double real; // Seconds from launch to exit
+    struct rusage usage;
+};
+
 struct job {
     int id;
+    int pgid; // Process group of the job, 0 until its first child, -1 without job control
+    char *cmdline; // The command line, for job listings
+    bool background; // Not (or no longer) waited on by the prompt
     struct kiddo *kidlets; // Linked list of child processes
     struct job *next; // Linked list of active jobs
 };
@@ -44,13 +64,39 @@ char **get_path_table(void);
  */
 void print_path_table(void);
 
+/**
+ * Resolves a command name to the binary it runs, searching each prefix in
+ * the path_table.  Results, including misses, are remembered in the command
+ * hash, so repeated lookups do not touch the filesystem.  The hash is
+ * flushed when PATH or the mtime of one of its directories changes.
+ * Nothing is hashed once a relative directory of PATH has been searched,
+ * since it names another directory after a cd.
+ *
+ * @param name The command name, without any '/'.
+ * @return The path of the binary (owned by the hash, valid until an entry
+ *         is dropped from it or the next call), or NULL if it is not found.
+ */
+char *resolve_command(const char *name);
+
+/**
+ * Installs the SIGCHLD handler that reaps children as they change state.
+ * When interactive and attached to a terminal, also enables job control:
+ * the shell moves into its own process group, and every job gets a process
+ * group of its own, which owns the terminal while in the foreground.
+ *
+ * @param interactive Whether the shell reads commands from the terminal.
+ * @return 0 on success, or negative errno on failure.
+ */
+int init_jobs(bool interactive);
+
 /**
  * Creates a new job and adds it to the list of active jobs.
  * Each job is assigned a unique job ID.
  *
+ * @param cmdline The command line of the job, as shown by `jobs`.
  * @return The job ID of the newly created job.
  */
-int create_job(void);
+int create_job(const char *cmdline);
 
 /**
  * Executes a command in a new process, associates it with a job ID, and
@@ -64,20 +110,151 @@ int create_job(void);
  * @param stdin File descriptor for standard input.
  * @param stdout File descriptor for standard output.
  * @param job_id The ID of the job to which this command belongs.
- * @return 0 on success, or negative errno on failure to execute the command.
+ * @return 0 on success, -ESRCH if the job does not exist, or negative errno
+ *         on failure to execute the command.
  */
-int run_command(char *args[MAX_ARGS], int stdin, int stdout, int job_id);
+int run_command(char *args[], int stdin, int stdout, int job_id);
 
 /**
- * Waits for all processes in the job to complete, then frees associated resources.
- * Captures and returns the exit code of the last child process in the job.
- * If the job consists of multiple processes, the exit code returned is that
- * of the last process to finish.
+ * Runs a builtin as a process of a job, in a forked copy of the shell, so
+ * it runs alongside the other stages of a pipeline instead of blocking the
+ * shell on a full pipe.  Whatever the builtin changes stays in the copy.
+ * Its exit code is 0 if the builtin succeeded, 1 if it failed, or the
+ * status it returned, as a function's body, or a test, has one.
+ *
+ * @param args The builtin and its arguments.
+ * @param stdin File descriptor for standard input.
+ * @param stdout File descriptor for standard output.
+ * @param spare A descriptor the copy must not keep open, such as the read
+ *        end of its own output pipe, or -1.
+ * @param job_id The ID of the job to which this builtin belongs.
+ * @return 0 on success, -ESRCH if the job does not exist, or negative errno
+ *         if the shell cannot fork.
+ */
+int run_builtin(char *args[], int stdin, int stdout, int spare, int job_id);
+
+/**
+ * Runs a function as a process of a job, in a forked copy of the shell,
+ * which exits with the status it returns.  Whatever it changes, the
+ * directory, the variables, the functions, or exit itself, stays in the
+ * copy, as in a command substitution.  The commands it runs are its own
+ * jobs, that it waits on.
+ *
+ * @param body The function, run in the copy.
+ * @param ctx Passed on to body.
+ * @param stdout File descriptor for standard output.
+ * @param spare A descriptor the copy must not keep open, or -1.
+ * @param job_id The ID of the job to which the copy belongs.
+ * @return 0 on success, -ESRCH if the job does not exist, or negative errno
+ *         if the shell cannot fork.
+ */
+int run_subshell(int (*body)(void *ctx), void *ctx, int stdout, int spare, int job_id);
+
+/**
+ * @return Whether this is a copy of the shell, forked by run_builtin() or
+ *         run_subshell(), rather than the shell itself.
+ */
+bool in_subshell(void);
+
+/**
+ * Runs a job in the foreground: hands it the terminal (with job control),
+ * and waits for all its processes to complete, then frees associated
+ * resources.  Children are reaped by the SIGCHLD handler; this only sleeps
+ * until they are all accounted for.
+ * Captures and returns the exit code of the last child process in the job,
+ * which is the last stage of the pipeline.
+ *
+ * If the job is stopped (^Z) instead, it is kept as a background job, and
+ * the exit code is 128 + SIGTSTP.  Only the return value tells it from a
+ * process that exited with that code.
  *
  * @param job_id The ID of the job to wait on.
  * @param exit_code Pointer to store the exit code of the last process of the job.
- * @return 0 on success, or negative errno on failure.
+ * @return 0 on success, -EAGAIN if the job stopped instead, or negative
+ *         errno on failure.
  */
 int wait_on_job(int job_id, int *exit_code);
 
+/**
+ * Waits on a job like wait_on_job(), and also returns what each of its
+ * processes cost, in pipeline order.
+ *
+ * @param job_id The ID of the job to wait on.
+ * @param exit_code Pointer to store the exit code of the last process of the job.
+ * @param usage Array to fill in, one entry per process.
+ * @param count In: the size of the array.  Out: the number of entries
+ *              filled in, which is 0 if the job got stopped instead.
+ * @return 0 on success, -EAGAIN if the job stopped instead, or negative
+ *         errno on failure.
+ */
+int wait_on_job_usage(int job_id, int *exit_code, struct proc_usage *usage, int *count);
+
+/**
+ * Leaves a freshly launched job running in the background, and, in an
+ * interactive shell, prints its job ID and process group.
+ *
+ * @param job_id The ID of the job.
+ * @return 0 on success, or -ENOENT if there is no such job.
+ */
+int background_job(int job_id);
+
+/**
+ * Continues a (stopped) job, in the foreground as `fg` does, or in the
+ * background as `bg` does.
+ *
+ * @param job_id The ID of the job to continue.
+ * @param foreground Whether to wait on the job, as wait_on_job() does.
+ * @param exit_code Pointer to store the exit code, when run in the foreground.
+ * @return 0 on success, or negative errno on failure.
+ */
+int resume_job(int job_id, bool foreground, int *exit_code);
+
+/**
+ * Waits for a background job to finish, without handing it the terminal,
+ * then frees associated resources.
+ *
+ * @param job_id The ID of the job to wait on.
+ * @param exit_code Pointer to store the exit code of the last process of the job.
+ * @return 0 on success, -EAGAIN if the job stopped instead, or -ENOENT if
+ *         there is no such job.
+ */
+int await_job(int job_id, int *exit_code);
+
+/**
+ * Waits for whichever background job finishes first, and forgets it.
+ *
+ * @param exit_code Pointer to store the exit code of the job, may be NULL.
+ * @return The ID of the job, or -ECHILD if no background job is running.
+ */
+int await_any_job(int *exit_code);
+
+/**
+ * Looks up the job a job specification refers to.
+ * "%n" is job n; a plain number is job n, or the job running process n
+ * if by_pid is set; NULL, "%%" and "%+" are the current job.
+ *
+ * @param spec The job specification, or NULL.
+ * @param by_pid Whether plain numbers are process IDs.
+ * @return The job ID, or negative errno if there is no such job.
+ */
+int find_job_spec(const char *spec, bool by_pid);
+
+/**
+ * Applies the state changes the SIGCHLD handler collected to the job list.
+ */
+void update_jobs(void);
+
+/**
+ * Prints every background job with its state, as the `jobs` builtin does.
+ *
+ * @param fd The file descriptor to print to.
+ */
+void print_jobs(int fd);
+
+/**
+ * Reports background jobs that finished since the last call, and forgets
+ * about them.  Called before every prompt.
+ */
+void notify_jobs(void);
+
 #endif
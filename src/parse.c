@@ -4,53 +4,21 @@
  */
 
 #include "parse.h"
+#include "functions.h"
+#include "glob.h"
+#include "subst.h"
+#include "utils/arena.h"
+#include "utils/pattern.h"
+#include "utils/trace.h"
+#include "vars.h"
 #include <assert.h>
 #include <ctype.h>
-#include <dirent.h>
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-/**
- * @brief Allocate and copy a substring of a string.
- * @param destination Pointer to the destination string.
- * @param source Pointer to the source string.
- * @param start_idx Index of the first character to copy.
- * @param length Number of characters to copy.
- * @return 0 on success, -1 on failure.
- */
-int allocate_and_copy_substring(char **destination,
-                                char *source,
-                                int start_idx,
-                                long length) {
-    if (destination == NULL) {
-        fprintf(stderr, "destination argument is NULL\n");
-        return -1;
-    }
-
-    if (source == NULL) {
-        fprintf(stderr, "source argument is NULL\n");
-        return -1;
-    }
-
-    if (start_idx < 0) {
-        fprintf(stderr, "start_idx argument is negative\n");
-        return -1;
-    }
-
-    if (length < 0) {
-        fprintf(stderr, "length argument is negative\n");
-        return -1;
-    }
-
-    *destination = malloc((length + 1) * sizeof(char *));
-    strncpy(*destination, &source[start_idx], length);
-    (*destination)[length] = '\0';
-    return 0;
-}
-
 /* This function returns one line from input_fd
  *
  * buf is populated with the contents, including the newline, and
@@ -119,142 +87,57 @@ int read_one_line(int input_fd, char *buf, size_t size) {
     return count;
 }
 
-/* TODO: Check is a file matches a glob.
- *
- * This function takes in a simple file glob (such as '*.c')
- * and a file name, and returns 1 if it matches, and 0 if not.
- */
-static int glob_matches(const char *glob, char *name) {
-    // preliminary check
-    if (glob[0] != '*') {
-        return 0;
-    }
-
-    // point to the extension part of the glob
-    const char *extension = glob + 1;
-    size_t ext_len = strlen(extension);
-    size_t name_len = strlen(name);
-
-    // check if the name is shorter than the extension
-    if (name_len < ext_len) {
-        return 0;
-    }
-
-    // Compare the end of the name with the extension
-    return strcmp(name + name_len - ext_len, extension) == 0;
-}
-
-/* TODO: Expand a file glob.
- *
- * This function takes in a simple file glob (such as '*.c')
- * and expands it to all matching files in the current working directory.
- * If the glob does not match anything, pass the glob through to the application as an argument.
- *
- * glob: The glob must be simple - only one asterisk as the first character,
- * with 0+ non-special characters following it.
- *
- * buf: A double pointer to scratch buffer allocated by the caller and good for the life of the command,
- *      which one may place expanded globs in.  The double pointer allows you to update the offset
- *      into the buffer.
- *
- * bufsize: _pointer_ to the remaining space in the buffer.  If too many files match, this space may be exceeded,
- *      in which case, the function returns -ENOSPC
- *
- * commands: Same argument as passed to parse_line
- *
- * pipeline_idx: Index into command array for the current pipeline
- *
- * arg_idx: _Pointer_ to the current argument index.  May be incremented as
- *         a glob is expanded.
- *
- * Returns 0 on success, -errno on error
- */
-static int expand_glob(char *glob,
-                       char **buf,
-                       size_t *bufsize,
-                       char *commands[MAX_PIPELINE][MAX_ARGS],
-                       int pipeline_idx,
-                       int *arg_idx) {
-    // Check for valid glob pattern
-    if (glob[0] != '*' || strlen(glob) < 2) {
-        return -EINVAL;
-    }
-
-    DIR *dirp;
-    struct dirent *dp;
-
-    // open current directory
-    if ((dirp = opendir(".")) == NULL) {
-        return -errno;
-    }
-
-    while ((dp = readdir(dirp)) != NULL) {
-        // check files if they match the glob pattern
-        if (glob_matches(glob, dp->d_name)) {
-            size_t len = strlen(dp->d_name);
-            if (*bufsize < len + 1) { // need to check buffer space
-                closedir(dirp);
-                return -ENOSPC;
-            }
 
-            // Copy file name to buffer and update commands array
-            strcpy(*buf, dp->d_name);
-            commands[pipeline_idx][*arg_idx] = *buf;
-            (*buf) += len + 1;     // move buffer pointer
-            (*bufsize) -= len + 1; // decrement remaining buffer size
-            (*arg_idx)++;          // increment argument index
-        }
-    }
+int splice_words(struct pipeline *p, struct command *stage, int at, char **words,
+                 int count) {
+    char **argv = arena_alloc(p->arena, (stage->argc + count) * sizeof(char *));
+    if (!argv) return -ENOMEM;
 
-    closedir(dirp);
+    memcpy(argv, stage->argv, at * sizeof(char *));
+    if (count) memcpy(argv + at, words, count * sizeof(char *));
+    /* The rest, and the NULL after it */
+    memcpy(argv + at + count, stage->argv + at + 1, (stage->argc - at) * sizeof(char *));
+    stage->argv = argv;
+    stage->argc += count - 1;
     return 0;
 }
 
 /* Parse one line of input.
  *
- * This function should populate a two-dimensional array of commands
- * and tokens.  The array itself should be pre-allocated by the
- * caller.
- *
- * The first level of the array is each stage in a pipeline, at most MAX_PIPELINE long.
- * The second level of the array is each argument to a given command, at most MAX_ARGS entries.
- * In each command buffer, the entry after the last valid entry should be NULL.
- * After the last valid pipeline buffer, there should be one command entry with just a NULL.
+ * This function should populate a pipeline: its stages, each with the
+ * arguments of its command, and its redirections.  There is no limit on
+ * the number of stages or arguments.
  *
- * For instance, a simple command like "cd" should parse as:
- *  commands[0] = ["cd", '\0']
- *  commands[1] = ['\0']
+ * Each stage's argv is NULL-terminated, as execve() takes it.  The words
+ * are not copied: they are NUL-terminated in place, in inbuf, so they live
+ * as long as the line does.  The arrays go in the arena, which the caller
+ * resets once the line is done with.
  *
  * The first "special" character to consider is the vertical bar, or "pipe" ('|').
  * This splits a single line into multiple sub-commands that form the pipeline.
- * We will implement pipelines in lab 2, but for now, just use this character to delimit
- * commands.
  *
  * For instance, the command: "ls | grep foo\n" should be broken into:
  *
- * commands[0] = ["ls", '\0']
- * commands[1] = ["grep", "foo", '\0']
- * commands[2] = ['\0']
+ * stages[0].argv = ["ls", NULL]
+ * stages[1].argv = ["grep", "foo", NULL]
  *
  * Hint: Make sure to remove the newline at the end
  *
  * Hint: Make sure the implementation is robust to extra whitespace, like: "grep      foo"
  *       should still be parsed as:
  *
- * commands[0] = ["grep", "foo", '\0']
- * commands[1] = ['\0']
+ * stages[0].argv = ["grep", "foo", NULL]
  *
- * This function should ignore anything after the '#' character, as
- * this is a comment.
+ * This function should ignore anything after a '#' that starts a word,
+ * as this is a comment.
  *
  * Finally, the command should identify file redirection characters ('<' and '>').
- * The string right after these tokens should be returned using the special output
- * parameters "infile" and "outfile".  You can assume there is at most one '<' and one
- * '>' character in the entire inbuf.
+ * The word right after these tokens is returned in "infile" and "outfile".
+ * The last of several inputs (a file, a here-document or a here-string)
+ * is the one that counts.
  *
  * For example, in input: "ls > out.txt", the return should be:
- *   commands[0] = ["ls", '\0']
- *   commands[1] = ['\0']
+ *   stages[0].argv = ["ls", NULL]
  *   outfile = "out.txt"
  *
  * Hint: Be sure your implementation is robust to arbitrary (or no) space before or after
@@ -264,38 +147,239 @@ static int expand_glob(char *glob,
  *
  * You do not need to handle redirection of other handles (e.g., "foo 2>&1 out.txt").
  *
+ * A line may hold a list of pipelines, separated by ';', "&&" or "||",
+ * which p->op records, with p->next pointing at the next pipeline.  A '&'
+ * after a pipeline runs it in the background; this is reported through
+ * "background", and the list goes on after it as after a ';'.
+ *
+ * For example, "make && ./test || echo failed" is three pipelines:
+ *   p->stages[0].argv = ["make", NULL], p->op = LIST_AND
+ *   p->next->stages[0].argv = ["./test", NULL], p->next->op = LIST_OR
+ *   p->next->next->stages[0].argv = ["echo", "failed", NULL]
+ *
  * inbuf: a NULL-terminated buffer of input.
- *        This buffer may be changed by the function
- *        (e.g., changing some characters to \0).
+ *        This buffer is changed by the function (the words get their
+ *        terminating '\0's in place), and must outlive the pipelines.
  *
  * length: the length of the string in inbuf.  Should be
  *         less than the size of inbuf.
  *
- * commands: a two-dimensional array of character pointers, allocated by the caller, which
- *           this function populates.
- *
- * scratch: A caller-allocated buffer that can be used for scratch space, such as
- *          expanding globs in the challenge problems.  You may not need to use this
- *          for the core assignment.
- *
- * scratch_len: Size of the scratch buffer
- *
- * return value: Number of entries populated in commands (1+, not counting the NULL),
- *               or -errno on failure.
+ * return value: Number of pipelines (1+), or -errno on failure.
  *
  *               In the case of a line with no actual commands (e.g.,
  *               a line with just comments), return 0.
+ *
+ * The work is split in two: tokenize_line() does everything but the
+ * expansions, which only depends on the text of the line, and
+ * expand_pipeline() then runs commands and looks at the file system, for
+ * each pipeline as it is about to run.  Compiled scripts only repeat the
+ * second step.
  */
 
-#define DELIM " #|><\n"
+/* The bytes that end a word: whitespace, and the operators */
+#define DELIM " \t\n#|><&;"
+
+/* The bytes that may make a word a glob */
+#define GLOB "*?["
+
+/* Find the next delimiter of the word that starts at word, or the end of
+ * the line, but look past the command and process substitutions, and the
+ * ${...} expansions, which may have delimiters of their own inside, and
+ * past a '#' that does not start the word.  The expansions passed on the
+ * way are added to *expand. */
+static char *next_delimiter(char *word, char *end, unsigned char *expand) {
+    for (char *s = word;;) {
+        char *d = strpbrk(s, DELIM "$`" GLOB);
+        if (!d || d > end) return end;
+
+        char *close = NULL;
+        if (*d == '`' || (strchr("$<>", *d) && d[1] == '(') || (*d == '$' && d[1] == '{'))
+            close = substitution_end(d);
+        if (close && (*d == '`' || (*d == '$' && d[1] == '('))) *expand |= EXPAND_SUBST;
+        if (*d == '$' && is_parameter(d)) *expand |= EXPAND_VARS;
+        if (strchr(GLOB, *d)) *expand |= EXPAND_GLOB;
+
+        if (close) s = close + 1;
+        else if (*d == '$' || strchr(GLOB, *d) || (*d == '#' && d != word)) s = d + 1;
+        else return d;
+    }
+}
+
+/* Append a stage to the pipeline; *cap is the room in p->stages */
+static struct command *add_stage(struct pipeline *p, int *cap) {
+    if (p->count == *cap) {
+        int more = *cap ? *cap * 2 : 4;
+        struct command *stages = arena_grow(p->arena, p->stages,
+                                            *cap * sizeof(struct command),
+                                            more * sizeof(struct command));
+        if (!stages) return NULL;
+        p->stages = stages;
+        *cap = more;
+    }
+    struct command *stage = &p->stages[p->count++];
+    stage->argc = 0;
+    stage->assigns = NULL;
+    stage->assign_count = 0;
+    stage->argv = arena_alloc(p->arena, 8 * sizeof(char *));
+    if (!stage->argv) return NULL;
+    stage->argv[0] = NULL;
+    return stage;
+}
+
+/* Append a word to the arguments of a stage; *cap is the room in its argv,
+ * counting the NULL */
+static int add_word(struct pipeline *p, struct command *stage, int *cap, char *word) {
+    if (stage->argc + 1 == *cap) {
+        char **argv = arena_grow(p->arena, stage->argv, *cap * sizeof(char *),
+                                 *cap * 2 * sizeof(char *));
+        if (!argv) return -ENOMEM;
+        stage->argv = argv;
+        *cap *= 2;
+    }
+    stage->argv[stage->argc++] = word;
+    stage->argv[stage->argc] = NULL;
+    return 0;
+}
+
+/* Start the next pipeline of the list, after the operator that ends p.
+ * Returns it, or NULL if out of memory. */
+static struct pipeline *add_pipeline(struct pipeline *p, enum list_op op) {
+    struct pipeline *next = arena_alloc(p->arena, sizeof(*next));
+    if (!next) return NULL;
+
+    memset(next, 0, sizeof(*next));
+    next->arena = p->arena;
+    p->op = op;
+    p->next = next;
+    return next;
+}
+
+/* The bytes that separate the words of a function body */
+#define BODY_DELIM " \t\n;&|"
+
+/* Walk the words from s to end, counting the braces of function bodies: a
+ * '{' that is a command of its own, or ends a "name(){", opens one, and a
+ * '}' that is a command of its own closes it.  Returns the '}' that brings
+ * *depth down to 0, or end, with *depth what is still open there.  The
+ * substitutions are passed over, and a comment ends the walk. */
+static const char *match_braces(const char *s, const char *end, int *depth) {
+    bool command = true; // Whether the next word is a command
+
+    while (s < end) {
+        if (strchr(BODY_DELIM, *s)) {
+            if (*s == ';' || *s == '&' || *s == '|') command = true;
+            s++;
+            continue;
+        }
+        if (*s == '#') return end;
+
+        const char *word = s;
+        while (s < end && !strchr(BODY_DELIM, *s)) {
+            const char *close = NULL;
+            if (*s == '`' || (*s == '$' && (s[1] == '(' || s[1] == '{')))
+                close = substitution_end(s);
+            s = close && close < end ? close + 1 : s + 1;
+        }
+
+        size_t len = s - word;
+        if (command && len == 1 && *word == '}') {
+            if (--*depth <= 0) return word;
+            command = false;
+        } else if ((command && len == 1 && *word == '{') ||
+                   (len >= 3 && memcmp(s - 3, "(){", 3) == 0)) {
+            ++*depth;
+            command = true;
+        } else {
+            /* The '{' comes after "name()" or "()" */
+            command = len >= 2 && memcmp(s - 2, "()", 2) == 0;
+        }
+    }
+    return end;
+}
+
+/* The length of the function name a word starts with: the bytes a command
+ * name may have, not starting with a digit */
+static size_t function_name_length(const char *word) {
+    size_t len = 0;
+    if (isdigit((unsigned char) word[0])) return 0;
+    while (word[len] && (isalnum((unsigned char) word[len]) || strchr("_-.:", word[len])))
+        len++;
+    return len;
+}
+
+/* Whether word, the next of the stage, is the "name()" or "name(){" that
+ * starts a function definition, or the "()" or "(){" after its name.  If
+ * so, the body between the braces goes in p->body, NUL-terminated in
+ * place, the name is cut off the "()", and *resume is set past the '}'.
+ * rest is the text after the word, delim the byte the word ended at.
+ * Returns 1 for a definition, 0 for any other word, or -EINVAL for a
+ * definition without its body. */
+static int function_definition(struct pipeline *p, struct command *stage, char *word,
+                               char delim, char *rest, char *end, char **resume) {
+    size_t n = stage->argc ? 0 : function_name_length(word);
+    char *parens = word + n;
+
+    if (parens[0] != '(' || parens[1] != ')' || (parens[2] && strcmp(parens + 2, "{") != 0))
+        return 0;
+    if (stage->argc ? stage->argc > 1 || strlen(stage->argv[0]) !=
+                                         function_name_length(stage->argv[0]) : !n)
+        return 0;
+    if (p->count > 1 || !delim || !isspace((unsigned char) delim)) return -EINVAL;
+
+    /* The '{' is a word of its own, unless it ends this one */
+    char *open = parens + 2;
+    if (!*open) {
+        open = rest;
+        while (open < end && isspace((unsigned char) *open)) open++;
+        if (open == end || *open != '{' || (open + 1 < end && !strchr(BODY_DELIM, open[1])))
+            return -EINVAL;
+        rest = open + 1;
+    }
+
+    int depth = 1;
+    char *close = (char *) match_braces(rest, end, &depth);
+    if (close == end) return -EINVAL;
 
-int parse_line(char *inbuf, size_t length,
-               char *commands[MAX_PIPELINE][MAX_ARGS], char **infile,
-               char **outfile, char *scratch, size_t scratch_len) {
+    while (isspace((unsigned char) *rest)) rest++;
+    *close = '\0';
+    *parens = '\0';
+    p->body = rest;
+    *resume = close + 1;
+    return 1;
+}
+
+/* Put an alias's text in place of the word at the start of a command: the
+ * rest of the line is copied after it, delim being what ended the word.
+ * Returns the new text, or NULL if out of memory. */
+static char *expand_alias(const char *alias, char delim, const char *rest, const char *end,
+                          struct arena *arena, char **new_end) {
+    size_t len = strlen(alias), more = rest < end ? end - rest : 0;
+    char *text = arena_alloc(arena, len + more + 2);
+    if (!text) return NULL;
+
+    memcpy(text, alias, len);
+    if (delim) text[len++] = delim;
+    memcpy(text + len, rest, more);
+    len += more;
+    text[len] = '\0';
+    *new_end = text + len;
+    return text;
+}
 
-    (void) scratch; // Unused, suppress warning
-    (void) scratch_len; // Unused, suppress warning
-    (void) &expand_glob; // Unused, suppress warning
+/* tokenize_line(), expanding the aliases or not */
+static int tokenize(char *inbuf, size_t length, struct pipeline *p, struct arena *arena,
+                    bool aliases) {
+    enum { WORD, TO_INFILE, TO_OUTFILE, HERE_DOC, HERE_STRING } target = WORD;
+    struct pipeline *first = p, *prev = NULL;
+    int stage_cap = 0, arg_cap = 8, count = 1;
+    bool words = false; // Whether the current pipeline has any
+    /* The aliases expanded at the start of the current command, which do
+     * not expand again there */
+    const char *aliased[ALIAS_MAX_DEPTH];
+    int alias_count = 0;
+
+    memset(p, 0, sizeof(*p));
+    p->arena = arena;
 
     /* Handle the trivial cases that would be easy to handle immediately that
      * are valid */
@@ -303,140 +387,401 @@ int parse_line(char *inbuf, size_t length,
         return 0;
     }
 
-    /* We are approaching this problem with use of strpbrk() to find the next
-     * delimiter in the string.
-     *
-     * As strpbrk() returns a pointer to the first occurence of the
-     * outlined delimiters, we can receive the index of the next delimiter,
-     * and on a case by case basis, handle the different special operations,
-     * of which are detailed per switch case. Trivially we increment the pointer
-     * to the next character after the delimiter, and continue parsing the
-     * input until null termination.
-     * */
-    int pipe_idx = 0, arg_idx = 0;
+    struct command *stage = add_stage(p, &stage_cap);
+    if (!stage) return -ENOMEM;
+
+    /* We walk the line from one delimiter to the next.  The word in front
+     * of a delimiter gets its '\0' where the delimiter was, once we have
+     * looked at it, and goes either to the arguments of the current stage,
+     * or to the redirection that asked for the next word. */
     char *current = inbuf;
     char *end = inbuf + length;
-    char *next_delim;
 
     while (current < end) {
-        /* Per iteration, we find the index of the next delimiter, and then
-         * switch/case on the character to handle them per their discrete spec */
-        next_delim = strpbrk(current, DELIM);
-        if (!next_delim) break;
-        switch (*next_delim) {
+        char *next_delim = next_delimiter(current, end, &p->expand);
+        char delim = next_delim < end ? *next_delim : '\0';
+
+        char *resume = NULL;
+        if (next_delim > current) {
+            char *word = current;
+            *next_delim = '\0';
+            int rv = 0;
+            /* Nothing follows a function definition but an operator */
+            if (p->body) return -EINVAL;
+            switch (target) {
+                case WORD:
+                    if (aliases && !stage->argc && alias_count < ALIAS_MAX_DEPTH) {
+                        const char *alias = get_alias(word, next_delim - word);
+                        for (int i = 0; alias && i < alias_count; i++)
+                            if (aliased[i] == alias) alias = NULL;
+                        if (alias) {
+                            /* Tokenize the alias's text, then the rest */
+                            aliased[alias_count++] = alias;
+                            current = expand_alias(alias, delim, next_delim + 1, end, arena,
+                                                   &end);
+                            if (!current) return -ENOMEM;
+                            continue;
+                        }
+                    }
+                    if ((rv = function_definition(p, stage, word, delim, next_delim + 1, end,
+                                                  &resume)) < 0)
+                        return rv;
+                    if (rv && stage->argc) {
+                        rv = 0;
+                        break;
+                    }
+                    if (!stage->argc && is_assignment(word)) p->expand |= EXPAND_ASSIGN;
+                    rv = add_word(p, stage, &arg_cap, word);
+                    words = true;
+                    alias_count = 0;
+                    break;
+                case TO_INFILE:
+                    p->infile = word;
+                    break;
+                case TO_OUTFILE:
+                    p->outfile = word;
+                    break;
+                case HERE_DOC:
+                    p->here.delim = word;
+                    break;
+                case HERE_STRING:
+                    /* A here-string is its word and a newline */
+                    p->here.len = next_delim - word + 1;
+                    p->here.text = arena_strndup(arena, word, p->here.len);
+                    if (p->here.text) p->here.text[p->here.len - 1] = '\n';
+                    else rv = -ENOMEM;
+                    break;
+            }
+            if (rv < 0) return rv;
+            target = WORD;
+        }
+
+        /* Past the body of a function definition */
+        if (resume) {
+            current = resume;
+            continue;
+        }
+
+        current = next_delim + 1;
+        enum list_op op = LIST_THEN;
+        switch (delim) {
             case '#':
-                /* The comment delimiter is a trivial case, as we can simply
-                 * null terminate the string at the comment, and return the
-                 * number of commands parsed and terminate the operation
-                 * */
-                return pipe_idx >= 0 ? pipe_idx + 1 : -errno;
+                /* A comment runs to the end of the line */
+                current = end;
+                continue;
 
             case '|':
-                /* The pipe delimiter is a straightforward case; we allocate the
-                 * substring to the commands table, and then increment the pipe_idx
-                 * and reset the arg_idx to 0 to build up the rows of piped
-                 * commands
-                 * */
-                if (next_delim - current > 0) {
-                    allocate_and_copy_substring(&commands[pipe_idx][arg_idx],
-                                                current,
-                                                0,
-                                                next_delim - current);
+                /* "||" ends the pipeline, like the operators below */
+                if (*current == '|') {
+                    current++;
+                    op = LIST_OR;
+                    break;
                 }
-                pipe_idx++;
-                arg_idx = 0;
-                break;
+
+                /* A pipe starts the next stage; the one it ends must have
+                 * a command */
+                if (target != WORD || !stage->argc || p->body) return -EINVAL;
+                if (!(stage = add_stage(p, &stage_cap))) return -ENOMEM;
+                arg_cap = 8;
+                alias_count = 0;
+                continue;
 
             case '>':
             case '<':
-                /* The following redirections are slightly more finicky because its
-                 * dependency on a following argument, and the interaction
-                 * thereafter with any possible other special character.
-                 *
-                 * Extraction of the initial argument is a given, but the following
-                 * steps require a bit more attention. I approach this by first
-                 * detecting the following delimiter, and then extracting the
-                 * following argument to the respective infile or outfile; if the next
-                 * delimiter is a pipe, we handle the special case by preemptively
-                 * setting up the next pipe_idx and arg_idx, and then continuing
-                 * parsing the input.
-                 * */
-                char redirection_char = *next_delim;
-
-                // skip the redirection character and any following whitespace
-                current = next_delim + 1;
-                while (current < end && isspace((unsigned char) *current)) {
-                    current++;
+                /* A redirection takes the next word, wherever it starts */
+                if (target != WORD || p->body) return -EINVAL;
+                if (delim == '>') {
+                    target = TO_OUTFILE;
+                    continue;
                 }
 
-                // find the end of the filename (next delimiter or end of input)
-                next_delim = strpbrk(current, DELIM);
-                if (!next_delim) {
-                    next_delim = end; // if no more delimiters, use end of input
+                /* Whichever input comes last replaces the others */
+                p->infile = NULL;
+                memset(&p->here, 0, sizeof(p->here));
+                target = TO_INFILE;
+
+                /* "<<DELIM" and "<<-DELIM" start a here-document, "<<< word"
+                 * is a here-string */
+                if (*current == '<') {
+                    target = current[1] == '<' ? HERE_STRING : HERE_DOC;
+                    current += target == HERE_STRING ? 2 : 1;
+                    if (target == HERE_DOC && *current == '-') {
+                        p->here.strip_tabs = true;
+                        current++;
+                    }
                 }
+                continue;
 
-                // extract the filename for redirection
-                char **redirection_target = (redirection_char == '>') ? outfile : infile;
-                allocate_and_copy_substring(redirection_target, current,
-                                            0, next_delim - current);
-
-                // adjust current to continue parsing after the filename
-                current = next_delim;
+            case '&':
+                /* "&&", or the background marker, which ends the pipeline
+                 * like a ';' */
+                if (*current == '&') {
+                    current++;
+                    op = LIST_AND;
+                } else {
+                    p->background = true;
+                }
                 break;
 
-            case ' ':
-            case '\n':
-                /* Spaces and newlines (rare to find newlines) all function
-                 * more or less the same for our limited use case; every successive
-                 * argument is an additional argument, which will be allocated to
-                 * the commands table
-                 * */
-                if (next_delim - current > 0) {
-                    allocate_and_copy_substring(&commands[pipe_idx][arg_idx],
-                                                current,
-                                                0,
-                                                next_delim - current);
-                    arg_idx++;
-                }
+            case ';':
                 break;
+
+            default:
+                /* Whitespace, or the end of the line */
+                continue;
         }
 
-        current = next_delim + 1;
+        /* An operator ends the pipeline, which must have a command, and
+         * starts the next one */
+        if (target != WORD || !words || !stage->argc) return -EINVAL;
+        prev = p;
+        if (!(p = add_pipeline(p, op))) return -ENOMEM;
+        stage_cap = 0;
+        if (!(stage = add_stage(p, &stage_cap))) return -ENOMEM;
+        arg_cap = 8;
+        words = false;
+        alias_count = 0;
+        count++;
     }
 
-    /* For redundancy, we check if the current pointer is less than the end
-     * pointer, and if so, we allocate the remaining string to the commands
-     * table */
-    if (current < end) {
-        allocate_and_copy_substring(&commands[pipe_idx][arg_idx],
-                                    current,
-                                    0,
-                                    end - current);
-        arg_idx++;
+    /* A redirection without its word, or a pipe without a command after it */
+    if (target != WORD || (p->count > 1 && !stage->argc)) return -EINVAL;
+    if (!words) {
+        /* Nothing after a trailing ';' or '&' is fine; nothing after "&&"
+         * or "||" is not */
+        if (!prev) {
+            first->count = 0;
+            return 0;
+        }
+        if (prev->op != LIST_THEN) return -EINVAL;
+        prev->op = LIST_END;
+        prev->next = NULL;
+        count--;
     }
+    return count;
+}
 
-    /* We null terminate the commands table, and return the number of commands
-     * parsed */
-    commands[pipe_idx][arg_idx] = NULL;
-
-    // this could be integrated into the above loop,
-    // but if it works, it works...
-    for (int p = 0; p <= pipe_idx; p++) {
-        for (int a = 0; commands[p][a] != NULL; a++) {
-            // Check if the argument is a glob pattern
-            if (strchr(commands[p][a], '*') != NULL) {
-                char *glob = commands[p][a];
-                size_t bufsize = scratch_len;
-
-                // Call expand_glob to expand the glob pattern
-                int result = expand_glob(glob, &scratch, &bufsize,
-                                         commands, p, &a);
-                if (result < 0) {
-                    return -errno;
-                }
+int tokenize_line(char *inbuf, size_t length, struct pipeline *p, struct arena *arena) {
+    return tokenize(inbuf, length, p, arena, true);
+}
+
+int tokenize_line_unaliased(char *inbuf, size_t length, struct pipeline *p,
+                            struct arena *arena) {
+    return tokenize(inbuf, length, p, arena, false);
+}
+
+/* Whether the next line continues this one, and how much of this one to
+ * keep if so: all but the backslash, or what comes before the comment
+ * after an operator or in a function body.  *sep is what joins the lines:
+ * nothing after a backslash, a space after an operator, and "; " between
+ * the commands of a body. */
+static bool continues(const char *line, size_t len, size_t *keep, const char **sep) {
+    if (len && line[len - 1] == '\\') {
+        *keep = len - 1;
+        *sep = "";
+        return true;
+    }
+
+    /* A comment runs to the end of the line */
+    size_t end = len;
+    for (size_t i = 0; i < len; i++) {
+        if (line[i] == '#' && (i == 0 || strchr(DELIM, line[i - 1]))) {
+            end = i;
+            break;
+        }
+    }
+    while (end && isspace((unsigned char) line[end - 1])) end--;
+
+    *keep = end;
+    *sep = " ";
+    if (end && (line[end - 1] == '|' ||
+                (end >= 2 && line[end - 1] == '&' && line[end - 2] == '&')))
+        return true;
+
+    /* "name()", with its '{' on the next line, or a body still open */
+    if (end >= 2 && line[end - 2] == '(' && line[end - 1] == ')') return true;
+    int depth = 0;
+    for (const char *s = line; (s = match_braces(s, line + end, &depth)) < line + end; s++)
+        if (depth < 0) depth = 0;
+    if (depth <= 0) return false;
+    if (!strchr("{;&", line[end - 1])) *sep = "; ";
+    return true;
+}
+
+char *join_continued_lines(char *line, size_t *len, line_reader next, void *ctx,
+                           struct arena *arena) {
+    char *joined = NULL;
+    size_t cap = 0, keep, more;
+    const char *sep;
+
+    while (continues(line, *len, &keep, &sep)) {
+        size_t sep_len = strlen(sep);
+
+        /* Copy the line out before reading the next one, which may reuse
+         * its buffer */
+        if (!joined) {
+            cap = keep + sep_len + 1;
+            if (!(joined = arena_alloc(arena, cap))) return NULL;
+            memcpy(joined, line, keep);
+        }
+        memcpy(joined + keep, sep, sep_len);
+        keep += sep_len;
+        joined[keep] = '\0';
+        *len = keep;
+        line = joined;
+
+        char *rest = next(ctx, &more);
+        if (!rest) break;
+
+        char *bigger = arena_grow(arena, joined, cap, keep + more + 3);
+        if (!bigger) return NULL;
+        line = joined = bigger;
+        cap = keep + more + 3;
+        memcpy(joined + keep, rest, more + 1);
+        *len = keep + more;
+    }
+
+    /* The bodies of its here-documents come next, and may reuse its buffer
+     * too */
+    if (!joined && strstr(line, "<<")) line = arena_strndup(arena, line, *len);
+    return line;
+}
+
+/* Read the body of one here-document */
+static int read_here_doc(struct here_text *here, line_reader next, void *ctx,
+                         struct arena *arena) {
+    size_t cap = 256, len;
+    char *line;
+
+    if (!here->delim || here->text) return 0;
+
+    here->len = 0;
+    here->text = arena_alloc(arena, cap);
+    if (!here->text) return -ENOMEM;
+
+    /* Bash warns about a missing delimiter, and takes what it got */
+    while ((line = next(ctx, &len))) {
+        if (here->strip_tabs) {
+            while (*line == '\t') {
+                line++;
+                len--;
             }
         }
+        if (strcmp(line, here->delim) == 0) break;
+
+        if (here->len + len + 2 > cap) {
+            size_t old = cap;
+            while (here->len + len + 2 > cap) cap *= 2;
+            char *bigger = arena_grow(arena, here->text, old, cap);
+            if (!bigger) return -ENOMEM;
+            here->text = bigger;
+        }
+        memcpy(here->text + here->len, line, len);
+        here->len += len;
+        here->text[here->len++] = '\n';
+    }
+    here->text[here->len] = '\0';
+    return 0;
+}
+
+int read_here_docs(struct pipeline *p, line_reader next, void *ctx, struct arena *arena) {
+    for (; p; p = p->next)
+        if (read_here_doc(&p->here, next, ctx, arena) < 0) return -ENOMEM;
+    return 0;
+}
+
+int copy_list(const struct pipeline *p, struct pipeline *copy, struct arena *arena) {
+    for (struct pipeline *q = copy;; q = q->next) {
+        *q = *p;
+        q->arena = arena;
+        q->stages = arena_alloc(arena, p->count * sizeof(struct command));
+        if (!q->stages) return -ENOMEM;
+        for (int i = 0; i < p->count; i++) {
+            struct command *stage = &q->stages[i];
+            size_t size = (p->stages[i].argc + 1) * sizeof(char *);
+            *stage = p->stages[i];
+            if (!(stage->argv = arena_alloc(arena, size))) return -ENOMEM;
+            memcpy(stage->argv, p->stages[i].argv, size);
+        }
+
+        if (!(p = p->next)) return 0;
+        if (!(q->next = arena_alloc(arena, sizeof(*q)))) return -ENOMEM;
+    }
+}
+
+int expand_globs(struct pipeline *p) {
+    uint64_t trace_start = trace_now();
+    struct glob_cache cache;
+    char **paths;
+
+    /* The globs of the pipeline share the directories they read */
+    glob_cache_init(&cache, p->arena);
+    for (int s = 0; s < p->count; s++) {
+        struct command *stage = &p->stages[s];
+        for (int a = 0; stage->argv[a] != NULL; a++) {
+            char *word = stage->argv[a];
+            if (is_process_substitution(word) || !is_pattern(word, strlen(word)))
+                continue;
+
+            int found = expand_glob(word, &cache, &paths);
+            if (found < 0) return found;
+            // A glob that matches nothing is passed through as it is
+            if (!found) continue;
+
+            int rv = splice_words(p, stage, a, paths, found);
+            if (rv < 0) return rv;
+            a += found - 1;
+        }
+    }
+
+    trace_span("glob", trace_start, NULL);
+    return p->count;
+}
+
+bool is_assignment(const char *word) {
+    size_t len = var_name_length(word);
+    if (!len) return false;
+
+    /* NAME[key]=value; the key may have expansions of its own */
+    if (word[len] == '[') {
+        const char *close = strchr(word + len, ']');
+        if (!close) return false;
+        len = close + 1 - word;
+    }
+    return word[len] == '=';
+}
+
+int expand_pipeline(struct pipeline *p) {
+    /* The output of a substitution, or the value of a variable, may hold
+     * globs of its own; the values assigned are never globbed */
+    int steps = p->count;
+    if (p->expand & EXPAND_ASSIGN) steps = expand_assignments(p);
+    if (steps > 0 && (p->expand & (EXPAND_SUBST | EXPAND_VARS)))
+        steps = expand_substitutions(p);
+    if (steps > 0 && (p->expand & ~EXPAND_ASSIGN)) steps = expand_globs(p);
+    p->expand = 0;
+    return steps;
+}
+
+bool list_runs_next(enum list_op op, int status) {
+    switch (op) {
+        case LIST_AND:
+            return status == 0;
+        case LIST_OR:
+            return status != 0;
+        default:
+            return true;
     }
+}
 
-    return pipe_idx >= 0 ? pipe_idx + 1 : -errno;
-}
\ No newline at end of file
+int parse_line(char *inbuf, size_t length, struct pipeline *p, struct arena *arena) {
+    uint64_t trace_start = trace_now();
+    int count = tokenize_line(inbuf, length, p, arena);
+    trace_span("parse", trace_start, NULL);
+
+    for (struct pipeline *q = count > 0 ? p : NULL; q; q = q->next) {
+        int steps = expand_pipeline(q);
+        if (steps <= 0) return steps;
+    }
+    return count;
+}
@@ -1,8 +1,224 @@
-#include "utils/constants.h"
+#ifndef PARSE_H
+#define PARSE_H
+
+#include "utils/arena.h"
+#include <stdbool.h>
 #include <stddef.h>
 
 int read_one_line(int input_fd, char *buf, size_t size);
 
-int parse_line(char *inbuf, size_t length, char *commands[MAX_PIPELINE][MAX_ARGS],
-               char **infile, char **outfile,
-               char *scratch, size_t scratch_len);
\ No newline at end of file
+/**
+ * Text fed to the first stage of a pipeline instead of a file: the lines
+ * of a here-document (<<DELIM), or a here-string (<<< word).
+ */
+struct here_text {
+    char *delim;      // The delimiter of a here-document, NULL for a here-string
+    bool strip_tabs;  // <<-DELIM: leading tabs are removed from the lines
+    char *text;       // The text, once known; a here-document's is read later
+    size_t len;
+};
+
+/**
+ * Returns the next line of input, for the body of a here-document.
+ *
+ * @param ctx Whatever the reader needs.
+ * @param len Returns the length of the line.
+ * @return The line, without its newline, or NULL at the end of the input.
+ */
+typedef char *(*line_reader)(void *ctx, size_t *len);
+
+/**
+ * How the next pipeline of a list runs, after the one the operator ends.
+ */
+enum list_op {
+    LIST_END,  // The last pipeline of the list
+    LIST_THEN, // ';' or '&': the next one runs regardless
+    LIST_AND,  // '&&': the next one runs if this one succeeded
+    LIST_OR,   // '||': the next one runs if this one failed
+};
+
+/**
+ * What expand_pipeline() has to do for a pipeline.
+ */
+#define EXPAND_SUBST  0x1 // Some word has a command substitution
+#define EXPAND_GLOB   0x2 // Some word has a '*', a '?' or a '['
+#define EXPAND_VARS   0x4 // Some word has a $name or a ${...}
+#define EXPAND_ASSIGN 0x8 // Some stage starts with a NAME=value
+
+/**
+ * A NAME=value, NAME[key]=value or NAME=(value...) in front of a command,
+ * once expanded.
+ */
+struct assignment {
+    char *name;
+    char *key;     // The key of NAME[key]=value, or NULL
+    char **values; // The value, or the elements of NAME=(...)
+    int count;
+    bool list;     // NAME=(...)
+};
+
+/**
+ * One command of a pipeline.  The assignments in front of it only go
+ * into its environment; a stage with nothing but assignments sets the
+ * shell's variables instead.
+ */
+struct command {
+    char **argv; // NULL-terminated, as execve() takes it
+    int argc;
+    struct assignment *assigns; // Set by expand_pipeline()
+    int assign_count;
+};
+
+/**
+ * A parsed pipeline: its stages and its redirections, and the pipelines
+ * that follow it on the line, as a list.  The words point into the line
+ * itself, or into the arena, and everything else lives in the arena, so
+ * it all goes away when the arena is reset.
+ */
+struct pipeline {
+    struct command *stages;
+    int count;
+    char *infile;
+    char *outfile;
+    struct here_text here;
+    bool background;        // Ends with '&'
+    char *body;             // name() { body }: the body, stages[0] being the name
+    unsigned char expand;   // EXPAND_* flags
+    enum list_op op;        // How the next pipeline runs after this one
+    struct pipeline *next;  // The next pipeline of the list, or NULL
+    struct arena *arena;    // Where the expansions of the pipeline allocate
+};
+
+/**
+ * Splits a line into a list of pipelines, and each of them into its stages
+ * and arguments, and finds their redirections and operators, without
+ * expanding anything.  The words are NUL-terminated in place, in the line.
+ *
+ * The pipelines of a list are separated by ';', '&', "&&" or "||"; a
+ * trailing ';' or '&' ends the last one.  A here-document only gets its
+ * delimiter here; its body is on the lines that follow, which
+ * read_here_docs() collects.
+ *
+ * The first word of a command that is an alias is replaced by its text.
+ * A function definition, name() { list }, is a pipeline of its own, with
+ * the list left as text in body, for define_function() to tokenize.
+ *
+ * @param inbuf The line, NUL-terminated.  It is modified, and must outlive
+ *              the pipelines.
+ * @param length The length of the line.
+ * @param p The first pipeline of the list, to fill in.  The others are
+ *          allocated in the arena.
+ * @param arena Where the pipelines are allocated.
+ * @return The number of pipelines, 0 for a line with no commands, or -errno.
+ */
+int tokenize_line(char *inbuf, size_t length, struct pipeline *p, struct arena *arena);
+
+/**
+ * Like tokenize_line(), but leaves the aliases as they are, for code that
+ * is kept to run later, when the aliases may have changed.
+ */
+int tokenize_line_unaliased(char *inbuf, size_t length, struct pipeline *p,
+                            struct arena *arena);
+
+/**
+ * Joins a line with the lines that continue it.  A line continues on the
+ * next one if it ends with a backslash, which is dropped, or with an
+ * operator that needs a command after it: '|', "&&" or "||".  It also
+ * continues while the body of a function definition is open, up to its
+ * closing '}'; the lines of the body are joined as a list, with "; ".
+ *
+ * A line that is joined, or that may have a here-document, whose body is
+ * read next, is copied into the arena, since reading the next line may
+ * reuse the buffer of this one.
+ *
+ * @param line The line, NUL-terminated.
+ * @param len The length of the line; returns the length of the result.
+ * @param next The source of the lines that follow.
+ * @param ctx Passed on to next.
+ * @param arena Where a joined line is built.
+ * @return The line itself, the copy of it or the joined lines, or NULL if
+ *         out of memory.
+ */
+char *join_continued_lines(char *line, size_t *len, line_reader next, void *ctx,
+                           struct arena *arena);
+
+/**
+ * Copies a list, so it can be expanded and run while the original stays
+ * as it is, as a function's body runs on every call: the pipelines, their
+ * stages and the argv arrays are copied, the words are shared.
+ *
+ * @param p The list, as filled in by tokenize_line().
+ * @param copy The first pipeline of the copy, to fill in.
+ * @param arena Where the copy is allocated, and its expansions allocate.
+ * @return 0 on success, or -ENOMEM.
+ */
+int copy_list(const struct pipeline *p, struct pipeline *copy, struct arena *arena);
+
+/**
+ * Reads the bodies of the here-documents of a list, in order, each up to
+ * the line holding just its delimiter, or the end of the input.
+ *
+ * @param p The list, as filled in by tokenize_line().
+ * @param next The source of the lines that follow the command.
+ * @param ctx Passed on to next.
+ * @param arena Where the bodies are stored.
+ * @return 0 on success, or -ENOMEM.
+ */
+int read_here_docs(struct pipeline *p, line_reader next, void *ctx, struct arena *arena);
+
+/**
+ * Replaces one argument of a stage with any number of words, as the
+ * expansions do.  The new argv is allocated in the pipeline's arena.
+ *
+ * @param stage A stage of p.
+ * @param at The index of the argument to replace.
+ * @param words The words to put in its place.
+ * @param count The number of words, which may be 0.
+ * @return 0 on success, or -ENOMEM.
+ */
+int splice_words(struct pipeline *p, struct command *stage, int at, char **words,
+                 int count);
+
+/**
+ * Expands the globs in the arguments of a tokenized pipeline, as
+ * expand_glob() does.  A glob that matches nothing is left as it is.
+ *
+ * @param p The pipeline, as filled in by tokenize_line().
+ * @return The number of stages on success, or -errno on failure.
+ */
+int expand_globs(struct pipeline *p);
+
+/**
+ * Takes the assignments off the front of the stages, then expands the
+ * command substitutions and the variables, then the globs, of one
+ * pipeline, as its EXPAND_* flags call for, and clears them, so it is only
+ * done once.  A list expands each pipeline right before it runs, so a
+ * pipeline that does not run expands nothing.
+ *
+ * @param p The pipeline, as filled in by tokenize_line().
+ * @return The number of stages on success, -EDOM for an arithmetic error,
+ *         which is reported already, or -errno on failure.
+ */
+int expand_pipeline(struct pipeline *p);
+
+/**
+ * @return Whether the word assigns a variable: NAME=value, NAME[key]=value
+ *         or the start of NAME=(value...).
+ */
+bool is_assignment(const char *word);
+
+/**
+ * Whether the pipeline after one ending with op runs.
+ *
+ * @param op The operator after the pipeline.
+ * @param status The exit status of the pipeline that ran last.
+ */
+bool list_runs_next(enum list_op op, int status);
+
+/**
+ * Parses one line of input: tokenize_line(), then expand_pipeline() on
+ * every pipeline of the list.
+ */
+int parse_line(char *inbuf, size_t length, struct pipeline *p, struct arena *arena);
+
+#endif // PARSE_H
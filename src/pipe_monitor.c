@@ -0,0 +1,130 @@
+/*
+ * This file implements the pipeline throughput monitor: a relay thread
+ * per pipe that moves the data along with splice(), and keeps track of
+ * which side of the pipe is holding the other one up.
+ */
+
+#define _GNU_SOURCE
+
+#include "pipe_monitor.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RELAY_CHUNK (64 * 1024)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Block until one of the descriptors is ready, and return the time spent
+ * waiting */
+static double wait_for(struct pollfd *pfd, int count) {
+    double start = now();
+    while (poll(pfd, count, -1) < 0 && errno == EINTR);
+    return now() - start;
+}
+
+static void *relay(void *arg) {
+    struct pipe_edge *edge = arg;
+    double start = now();
+
+    for (;;) {
+        ssize_t n = splice(edge->in, NULL, edge->out, NULL, RELAY_CHUNK,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n > 0) {
+            edge->bytes += n;
+            continue;
+        }
+        if (n == 0 || errno != EAGAIN) break; // End of stream, or reader gone
+
+        /* Either there is nothing to read, and the downstream stage is
+         * starved, or the output pipe is full, and the upstream stage will
+         * soon be blocked writing.  Wait on whichever it is. */
+        struct pollfd pfd[2] = {{edge->in, POLLIN, 0}, {edge->out, 0, 0}};
+        if (poll(pfd, 1, 0) == 0) {
+            /* Also watch for the reader going away in the meantime, which
+             * shows up as POLLERR on the output */
+            edge->reader_wait += wait_for(pfd, 2);
+            if (pfd[1].revents & POLLERR) break;
+        } else {
+            pfd[1].events = POLLOUT;
+            edge->writer_wait += wait_for(&pfd[1], 1);
+        }
+    }
+
+    edge->elapsed = now() - start;
+
+    /* Pass EOF downstream, and EPIPE upstream */
+    close(edge->out);
+    close(edge->in);
+    return NULL;
+}
+
+int monitored_pipe(struct pipe_edge *edge, int fd[2], const char *label) {
+    int upstream[2], downstream[2];
+    sigset_t all, old;
+
+    memset(edge, 0, sizeof(*edge));
+    snprintf(edge->label, sizeof(edge->label), "%s", label);
+
+    if (pipe2(upstream, O_CLOEXEC) < 0) return -errno;
+    if (pipe2(downstream, O_CLOEXEC) < 0) {
+        int err = errno;
+        close(upstream[0]);
+        close(upstream[1]);
+        return -err;
+    }
+
+    edge->in = upstream[0];
+    edge->out = downstream[1];
+
+    /* The relay inherits a fully blocked signal mask: SIGCHLD must go to the
+     * main thread, and a reader that went away must show up as EPIPE rather
+     * than a SIGPIPE that would take the shell down. */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int rv = pthread_create(&edge->relay, NULL, relay, edge);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (rv) {
+        close(upstream[0]);
+        close(upstream[1]);
+        close(downstream[0]);
+        close(downstream[1]);
+        return -rv;
+    }
+    edge->running = true;
+
+    fd[0] = downstream[0];
+    fd[1] = upstream[1];
+    return 0;
+}
+
+void report_pipe_edges(struct pipe_edge *edges, int count, int fd) {
+    if (!count) return;
+
+    dprintf(fd, "%-32s %14s %12s %11s %11s  %s\n", "edge", "bytes", "MB/s",
+            "reader-wait", "writer-wait", "blocked");
+    for (int i = 0; i < count; i++) {
+        struct pipe_edge *e = &edges[i];
+        if (!e->running) continue;
+        pthread_join(e->relay, NULL);
+        e->running = false;
+
+        double rate = e->elapsed > 0 ? e->bytes / e->elapsed / (1024 * 1024) : 0;
+        const char *blocked = "-";
+        if (e->reader_wait > e->writer_wait) blocked = "reader";
+        else if (e->writer_wait > e->reader_wait) blocked = "writer";
+
+        dprintf(fd, "%-32s %14llu %12.2f %10.3fs %10.3fs  %s\n", e->label,
+                e->bytes, rate, e->reader_wait, e->writer_wait, blocked);
+    }
+}
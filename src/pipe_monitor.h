@@ -0,0 +1,49 @@
+#ifndef PIPE_MONITOR_H
+#define PIPE_MONITOR_H
+
+#include <pthread.h>
+#include <stdbool.h>
+
+/**
+ * Throughput and stall statistics of one edge of a pipeline, i.e. the pipe
+ * between two consecutive stages.
+ */
+struct pipe_edge {
+    pthread_t relay;
+    bool running;
+    int in;  // Read end of the pipe the upstream stage writes into
+    int out; // Write end of the pipe the downstream stage reads from
+    char label[64];
+    unsigned long long bytes;
+    double reader_wait; // Seconds the downstream stage starved for data
+    double writer_wait; // Seconds the upstream stage was blocked on a full pipe
+    double elapsed;     // Seconds from the relay's start to end of stream
+};
+
+/**
+ * Creates a monitored pipe.  Instead of one pipe, two are created, and a
+ * relay thread splice()s from one to the other, so the data is never
+ * copied through user space.  The relay counts the bytes that go through,
+ * and how long each side had to wait on the other.
+ *
+ * Both returned descriptors are close-on-exec, as pipe2(fd, O_CLOEXEC)
+ * would make them.
+ *
+ * @param edge The statistics of this edge, filled in by the relay.
+ * @param fd Returns the read end in fd[0] and the write end in fd[1].
+ * @param label The name of the edge in the report.
+ * @return 0 on success, or negative errno on failure.
+ */
+int monitored_pipe(struct pipe_edge *edge, int fd[2], const char *label);
+
+/**
+ * Waits for the relays of a pipeline to reach the end of their stream,
+ * and prints a table of bytes/sec and blocked time per edge.
+ *
+ * @param edges The edges, as set up by monitored_pipe().
+ * @param count The number of edges.
+ * @param fd The file descriptor to print the table to.
+ */
+void report_pipe_edges(struct pipe_edge *edges, int count, int fd);
+
+#endif // PIPE_MONITOR_H
@@ -0,0 +1,207 @@
+/*
+ * This file implements the `sched` prefix, and the automatic placement of
+ * pipeline stages on neighbouring cores.
+ */
+
+#define _GNU_SOURCE
+
+#include "placement.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_SHIFT 13
+
+static const char *ioprio_classes[] = {"", "rt", "be", "idle"};
+
+/* One CPU the shell may run on, where it sits in the machine */
+struct cpu_slot {
+    int cpu;
+    int package;
+    int core;
+    int thread; // Rank among the hardware threads of its core
+};
+
+static struct cpu_slot *placement = NULL; // In placement order
+static int placement_count = -1;          // -1 until the topology is read
+static int placement_next = 0;            // Where the next pipeline starts
+
+/* Parse a list of CPUs, e.g. "0-3,6" */
+static int parse_cpu_list(const char *list, cpu_set_t *cpus) {
+    CPU_ZERO(cpus);
+    while (*list) {
+        char *end;
+        long first = strtol(list, &end, 10), last = first;
+        if (end == list) return -EINVAL;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list) return -EINVAL;
+        }
+        if (first < 0 || last < first || last >= CPU_SETSIZE) return -EINVAL;
+        for (long cpu = first; cpu <= last; cpu++) CPU_SET(cpu, cpus);
+        if (*end == ',') end++;
+        else if (*end) return -EINVAL;
+        list = end;
+    }
+    return CPU_COUNT(cpus) ? 0 : -EINVAL;
+}
+
+/* Parse an I/O priority, e.g. "idle" or "be:7" */
+static int parse_ioprio(const char *spec, int *ioprio) {
+    const char *colon = strchr(spec, ':');
+    size_t len = colon ? (size_t) (colon - spec) : strlen(spec);
+    int level = 4; // The kernel's default within a class
+
+    if (colon) {
+        char *end;
+        level = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end || level < 0 || level > 7) return -EINVAL;
+    }
+    for (int class = 1; class < 4; class++) {
+        if (strlen(ioprio_classes[class]) == len
+            && strncmp(spec, ioprio_classes[class], len) == 0) {
+            *ioprio = class << IOPRIO_CLASS_SHIFT | level;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+int sched_keyword(char *args[], struct sched_attrs *attrs, bool *pipeline) {
+    int i = 1, n = 0;
+
+    if (!args[0] || strcmp(args[0], "sched") != 0) return 0;
+
+    for (; args[i] && args[i][0] == '-'; i++) {
+        int rv = 0;
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        } else if (strcmp(args[i], "-p") == 0) {
+            *pipeline = true;
+        } else if (strcmp(args[i], "-c") == 0 && args[i + 1]) {
+            cpu_set_t allowed;
+            rv = parse_cpu_list(args[++i], &attrs->cpus);
+            attrs->set_cpus = true;
+            /* Refuse here what the child would fail to set after fork() */
+            if (!rv && sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+                CPU_AND(&attrs->cpus, &attrs->cpus, &allowed);
+                if (!CPU_COUNT(&attrs->cpus)) {
+                    dprintf(STDERR_FILENO, "sched: no usable CPU in %s\n", args[i]);
+                    return -EINVAL;
+                }
+            }
+        } else if (strcmp(args[i], "-n") == 0 && args[i + 1]) {
+            char *end;
+            attrs->nice = strtol(args[++i], &end, 10);
+            attrs->set_nice = true;
+            if (*end || end == args[i]) rv = -EINVAL;
+        } else if (strcmp(args[i], "-i") == 0 && args[i + 1]) {
+            rv = parse_ioprio(args[++i], &attrs->ioprio);
+            attrs->set_ioprio = true;
+        } else {
+            rv = -EINVAL;
+        }
+        if (rv < 0) {
+            dprintf(STDERR_FILENO, "usage: sched [-c cpus] [-n nice] "
+                                   "[-i rt|be|idle[:level]] [-p] command\n");
+            return rv;
+        }
+    }
+
+    if (!args[i]) {
+        dprintf(STDERR_FILENO, "sched: no command\n");
+        return -EINVAL;
+    }
+
+    for (; args[i]; i++) args[n++] = args[i];
+    args[n] = NULL;
+    attrs->prefixed = attrs->set_cpus || attrs->set_nice || attrs->set_ioprio;
+    return 1;
+}
+
+static int read_topology(int cpu, const char *name) {
+    char path[128];
+    int value = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    FILE *file = fopen(path, "re");
+    if (!file) return -1;
+    if (fscanf(file, "%d", &value) != 1) value = -1;
+    fclose(file);
+    return value;
+}
+
+static int compare_slots(const void *a, const void *b) {
+    const struct cpu_slot *x = a, *y = b;
+    if (x->thread != y->thread) return x->thread - y->thread;
+    if (x->package != y->package) return x->package - y->package;
+    if (x->core != y->core) return x->core - y->core;
+    return x->cpu - y->cpu;
+}
+
+/* Order the CPUs we may run on: the first thread of every core, core by
+ * core and package by package, then the second threads, and so on */
+static int load_placement(void) {
+    cpu_set_t allowed;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) return -errno;
+
+    placement = calloc(CPU_COUNT(&allowed), sizeof(struct cpu_slot));
+    if (!placement) return -ENOMEM;
+
+    placement_count = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        struct cpu_slot *s = &placement[placement_count++];
+        s->cpu = cpu;
+        s->package = read_topology(cpu, "physical_package_id");
+        s->core = read_topology(cpu, "core_id");
+        s->thread = 0;
+        /* CPUs are numbered upwards, so the earlier threads of the same
+         * core are already in the table */
+        for (int i = 0; i < placement_count - 1; i++)
+            if (placement[i].package == s->package && placement[i].core == s->core)
+                s->thread++;
+    }
+    qsort(placement, placement_count, sizeof(struct cpu_slot), compare_slots);
+    return 0;
+}
+
+int place_stage(int stage, cpu_set_t *cpus) {
+    static int base = 0;
+
+    if (placement_count < 0) {
+        int rv = load_placement();
+        if (rv < 0) return rv;
+    }
+    if (!placement_count) return -ENODEV;
+
+    if (stage == 0) base = placement_next;
+    placement_next = (base + stage + 1) % placement_count;
+
+    CPU_ZERO(cpus);
+    CPU_SET(placement[(base + stage) % placement_count].cpu, cpus);
+    return 0;
+}
+
+int apply_sched(const struct sched_attrs *attrs, pid_t pid) {
+    int rv = 0;
+
+    if (!attrs) return 0;
+
+    if (attrs->set_cpus && sched_setaffinity(pid, sizeof(cpu_set_t), &attrs->cpus) < 0)
+        rv = rv ?: -errno;
+    if (attrs->set_nice && setpriority(PRIO_PROCESS, pid, attrs->nice) < 0)
+        rv = rv ?: -errno;
+    if (attrs->set_ioprio
+        && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, pid, attrs->ioprio) < 0)
+        rv = rv ?: -errno;
+    return rv;
+}
@@ -0,0 +1,61 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <sched.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+/**
+ * Scheduling attributes a process is started with: the CPUs it may run
+ * on, its nice level and its I/O priority.  Each one only applies when
+ * its flag is set; otherwise the child inherits the shell's.
+ */
+struct sched_attrs {
+    bool set_cpus;
+    cpu_set_t cpus;
+    bool set_nice;
+    int nice;
+    bool set_ioprio;
+    int ioprio; // As ioprio_set() takes it: the class << 13 | the level
+    bool prefixed; // Whether a sched prefix asked for any of them
+};
+
+/**
+ * Strips a leading `sched [-c cpus] [-n nice] [-i class[:level]] [-p] [--]`
+ * off a pipeline stage, and collects the attributes it asks for.
+ *
+ * cpus is a list such as "0-3,6".  The I/O class is one of rt, be or idle,
+ * with a level from 0 (highest) to 7.  -p applies the attributes to every
+ * stage of the pipeline, which only means something on the first stage.
+ * A builtin or a function with attributes runs in a copy of the shell.
+ *
+ * @param args The stage; shifted in place to start at the command.
+ * @param attrs Where to add the attributes.
+ * @param pipeline Set if -p was given.
+ * @return 1 if the stage had a sched prefix, 0 if not, or -EINVAL.
+ */
+int sched_keyword(char *args[], struct sched_attrs *attrs, bool *pipeline);
+
+/**
+ * Picks the CPU for one stage of a pipeline, so consecutive stages land on
+ * neighbouring cores of the same package, where they share a cache.
+ * One hardware thread per core is used before their SMT siblings are,
+ * and each new pipeline starts where the previous one left off, so
+ * concurrent pipelines spread over the machine.
+ *
+ * @param stage The stage, from 0; stage 0 starts a new pipeline.
+ * @param cpus Set to the one CPU to use.
+ * @return 0 on success, or negative errno if the topology is unknown.
+ */
+int place_stage(int stage, cpu_set_t *cpus);
+
+/**
+ * Applies the attributes to a process.
+ *
+ * @param attrs The attributes, or NULL for none.
+ * @param pid The process, or 0 for the calling one.
+ * @return 0 on success, or the negative errno of the first that failed.
+ */
+int apply_sched(const struct sched_attrs *attrs, pid_t pid);
+
+#endif // PLACEMENT_H
@@ -3,11 +3,14 @@
  */
 
 #include "utils/trie.h"
+#include <stdbool.h>
 #include <stdlib.h>
 #include <termios.h>
 #include <unistd.h>
 
 struct termios global_termios;
+static bool termios_saved = false;
+static bool raw_active = false;
 
 // https://viewsourcecode.org/snaptoken/kilo/02.enteringRawMode.html
 
@@ -29,28 +32,37 @@ static void die(const char *s) {
 /**
  * Disables raw mode for the terminal.
  * Restores the terminal's original settings stored in `global_termios`.
+ * Does nothing if raw mode is not enabled.
  * If there is an error in setting the attributes, it calls `die`.
  */
 void disable_raw_mode() {
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &global_termios) == -1)
+    if (!raw_active) return;
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &global_termios) == -1)
         die("tcsetattr");
+    raw_active = false;
 }
 
 /**
  * Enables raw mode for the terminal.
  * Modifies the terminal settings to disable echoing, canonical mode,
  * and certain control signals.
- * The original terminal settings are saved in `global_termios`.
+ * The original terminal settings are saved in `global_termios` the first
+ * time around; later calls switch back to raw mode after a command ran.
  * If there is an error in getting or setting the attributes, it calls `die`.
  */
 void enable_raw_mode() {
-    if (tcgetattr(STDIN_FILENO, &global_termios) == -1)
-        die("tcgetattr");
-    atexit(disable_raw_mode);
+    if (raw_active) return;
+    if (!termios_saved) {
+        if (tcgetattr(STDIN_FILENO, &global_termios) == -1)
+            die("tcgetattr");
+        atexit(disable_raw_mode);
+        termios_saved = true;
+    }
 
     struct termios raw = global_termios;
     raw.c_lflag &= ~(ECHO | ICANON | ISIG);
     raw.c_iflag &= ~(IXON | ICRNL);
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) == -1)
         die("tcsetattr");
+    raw_active = true;
 }
\ No newline at end of file
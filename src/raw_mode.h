@@ -4,13 +4,15 @@
 /**
  * Disables raw mode for the terminal.
  * Restores the terminal's original settings stored in `global_termios`.
+ * Does nothing if raw mode is not enabled.
  */
 void disable_raw_mode(void);
 
 /**
  * Enables raw mode for the terminal.
  * Modifies the terminal settings to disable echoing, canonical mode,
- * and certain control signals.
+ * and certain control signals.  Commands are run with raw mode disabled,
+ * so this is called again before every prompt.
  */
 void enable_raw_mode(void);
 
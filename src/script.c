@@ -0,0 +1,169 @@
+/*
+ * This file implements the line source of batch mode.  A script is mapped
+ * or read in large blocks, and every line is NUL-terminated in place, so
+ * running a script costs a handful of syscalls instead of one per byte.
+ */
+
+#define _GNU_SOURCE
+
+#include "script.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SCRIPT_BLOCK (64 * 1024)
+
+int open_script_fd(struct script *s, int fd) {
+    struct stat st;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        /* The file may have been partly read already, e.g. a script on
+         * stdin that got rewound to after the previous line */
+        off_t start = lseek(fd, 0, SEEK_CUR);
+        if (start < 0) start = 0;
+
+        s->eof = true;
+        if (st.st_size <= start) return 0;
+
+        /* A private, writable mapping: terminating a line in place only
+         * copies the page it is on */
+        void *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            s->data = data;
+            s->size = st.st_size;
+            s->pos = start;
+            s->mapped = true;
+            return 0;
+        }
+        s->eof = false; // Fall back to reading it
+    }
+
+    s->cap = SCRIPT_BLOCK;
+    s->data = malloc(s->cap);
+    return s->data ? 0 : -ENOMEM;
+}
+
+int open_script_file(struct script *s, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -errno;
+
+    int rv = open_script_fd(s, fd);
+    if (rv) {
+        close(fd);
+        return rv;
+    }
+
+    if (s->eof) {
+        /* Mapped, or empty: the descriptor is of no more use */
+        close(fd);
+        s->fd = -1;
+    } else {
+        s->own_fd = true;
+    }
+    return 0;
+}
+
+int open_script_string(struct script *s, const char *text) {
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+    s->data = strdup(text);
+    if (!s->data) return -ENOMEM;
+    s->size = strlen(text);
+    s->cap = s->size + 1;
+    s->eof = true;
+    return 0;
+}
+
+/* Move what is left of the buffer to its front, and read another block
+ * after it */
+static void fill_script(struct script *s) {
+    if (s->pos) {
+        memmove(s->data, s->data + s->pos, s->size - s->pos);
+        s->size -= s->pos;
+        s->pos = 0;
+    }
+
+    /* Always keep a byte spare to terminate the last line */
+    if (s->cap - s->size - 1 < SCRIPT_BLOCK / 2) {
+        char *bigger = realloc(s->data, s->cap * 2);
+        if (!bigger) {
+            s->eof = true;
+            return;
+        }
+        s->data = bigger;
+        s->cap *= 2;
+    }
+
+    ssize_t n;
+    do {
+        n = read(s->fd, s->data + s->size, s->cap - s->size - 1);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) s->eof = true;
+    else s->size += n;
+}
+
+char *next_script_line(struct script *s, size_t *len) {
+    /* A mapped stdin is shared with the commands: pick up after whatever
+     * they read of it */
+    bool shared = s->mapped && !s->own_fd && s->fd >= 0;
+    if (shared) {
+        off_t offset = lseek(s->fd, 0, SEEK_CUR);
+        if (offset > (off_t) s->pos) s->pos = offset < (off_t) s->size ? offset : s->size;
+    }
+
+    for (;;) {
+        char *start = s->data + s->pos;
+        size_t avail = s->size - s->pos;
+        char *nl = avail ? memchr(start, '\n', avail) : NULL;
+
+        if (nl) {
+            *nl = '\0';
+            *len = nl - start;
+            s->pos += *len + 1;
+            /* Keep a shared stdin where the next line starts, so commands
+             * that read it get the rest of the script, as they would from
+             * any other shell */
+            if (shared) lseek(s->fd, s->pos, SEEK_SET);
+            return start;
+        }
+        if (s->eof) break;
+        fill_script(s);
+    }
+
+    if (s->pos >= s->size) return NULL;
+
+    /* The last line has no newline.  The buffers always have a spare byte,
+     * and so does a mapping, unless the file fills its last page. */
+    char *line = s->data + s->pos;
+    *len = s->size - s->pos;
+    s->pos = s->size;
+    if (s->mapped && s->size % sysconf(_SC_PAGESIZE) == 0) {
+        free(s->tail);
+        line = s->tail = strndup(line, *len);
+        return line;
+    }
+    if (!s->mapped) line[*len] = '\0';
+    return line;
+}
+
+char *script_line_reader(void *ctx, size_t *len) {
+    return next_script_line(ctx, len);
+}
+
+void close_script(struct script *s) {
+    if (s->mapped) munmap(s->data, s->size);
+    else free(s->data);
+    free(s->tail);
+    if (s->own_fd) close(s->fd);
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+}
@@ -0,0 +1,84 @@
+/*
+ *  Reads the lines of a script, or of a -c command, for batch mode.
+ */
+
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * A source of script lines.  Regular files are mapped into memory in one
+ * go; pipes and terminals are read in large blocks.  Either way, lines are
+ * handed out in place, without copying them or reading byte by byte.
+ */
+struct script {
+    int fd;         // Descriptor the script comes from, or -1
+    bool own_fd;    // Whether close_script() closes fd
+    char *data;     // The mapping, or the block buffer
+    size_t size;    // Bytes of data that are valid
+    size_t cap;     // Size of the block buffer
+    size_t pos;     // Start of the next line
+    bool mapped;
+    bool eof;
+    char *tail;     // Copy of a last line that has no room for a terminator
+};
+
+/**
+ * Opens a script file.  A regular file is mapped, anything else (a pipe,
+ * /dev/stdin) is read in blocks.
+ *
+ * @param s The script to initialize.
+ * @param path The path of the script.
+ * @return 0 on success, or negative errno on failure.
+ */
+int open_script_file(struct script *s, const char *path);
+
+/**
+ * Reads a script from an already open descriptor, such as stdin.
+ *
+ * @param s The script to initialize.
+ * @param fd The descriptor to read from.  It is not closed by close_script().
+ * @return 0 on success, or negative errno on failure.
+ */
+int open_script_fd(struct script *s, int fd);
+
+/**
+ * Uses a string as the script, as `-c` does.  It may hold several lines.
+ *
+ * @param s The script to initialize.
+ * @param text The commands.
+ * @return 0 on success, or negative errno on failure.
+ */
+int open_script_string(struct script *s, const char *text);
+
+/**
+ * Returns the next line of the script, without its newline and
+ * NUL-terminated.  The line may be modified in place, and stays valid
+ * until the next call.
+ *
+ * @param s The script.
+ * @param len Returns the length of the line.
+ * @return The line, or NULL at the end of the script.
+ */
+char *next_script_line(struct script *s, size_t *len);
+
+/**
+ * next_script_line() as a line_reader, to read the body of a here-document.
+ *
+ * @param ctx The struct script.
+ * @param len Returns the length of the line.
+ * @return The line, or NULL at the end of the script.
+ */
+char *script_line_reader(void *ctx, size_t *len);
+
+/**
+ * Releases the mapping or buffer of a script, and closes the file it
+ * opened.
+ *
+ * @param s The script.
+ */
+void close_script(struct script *s);
+
+#endif // SCRIPT_H
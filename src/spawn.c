@@ -0,0 +1,239 @@
+/*
+ * This file implements the different ways the shell can start a child
+ * process.  fork() copies the shell's page tables, so its cost grows with
+ * the shell's memory footprint; posix_spawn() and clone(CLONE_VM) share
+ * the parent's address space until the child calls execve().
+ */
+
+#define _GNU_SOURCE
+
+#include "spawn.h"
+#include "vars.h"
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define VFORK_STACK_SIZE (64 * 1024)
+
+static const char *backend_names[] = {
+        [SPAWN_FORK] = "fork",
+        [SPAWN_POSIX_SPAWN] = "posix_spawn",
+        [SPAWN_VFORK] = "vfork",
+};
+
+static enum spawn_backend backend = SPAWN_FORK;
+static const struct sched_attrs *spawn_sched = NULL;
+static char **spawn_env = NULL;
+static int spawn_stderr = -1;
+
+int set_spawn_backend(const char *name) {
+    for (int i = 0; i < (int) (sizeof(backend_names) / sizeof(*backend_names)); i++) {
+        if (strcmp(name, backend_names[i]) == 0) {
+            backend = i;
+            return 0;
+        }
+    }
+    return -EINVAL;
+}
+
+const char *get_spawn_backend_name(void) {
+    return backend_names[backend];
+}
+
+void set_spawn_sched(const struct sched_attrs *attrs) {
+    spawn_sched = attrs;
+}
+
+const struct sched_attrs *get_spawn_sched(void) {
+    return spawn_sched;
+}
+
+void set_spawn_env(char **envp) {
+    spawn_env = envp;
+}
+
+void set_spawn_stderr(int fd) {
+    spawn_stderr = fd;
+}
+
+static int spawn_fork(const char *path, char *const args[], char **envp, int stdin,
+                      int stdout, pid_t pgid, pid_t *pid) {
+    pid_t child = fork();
+    if (child < 0) return -errno;
+    if (child == 0) {
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        /* The command does not run without the attributes it asked for */
+        int rv = apply_sched(spawn_sched, 0);
+        if (rv < 0) {
+            dprintf(STDERR_FILENO, "sched: %s\n", strerror(-rv));
+            _exit(127);
+        }
+        if (pgid >= 0) setpgid(0, pgid);
+        if (stdin != STDIN_FILENO) {
+            dup2(stdin, STDIN_FILENO);
+            close(stdin);
+        }
+        if (stdout != STDOUT_FILENO) {
+            dup2(stdout, STDOUT_FILENO);
+            close(stdout);
+        }
+        if (spawn_stderr >= 0) dup2(spawn_stderr, STDERR_FILENO);
+        execve(path, args, envp);
+        perror("execve");
+        _exit(errno);
+    }
+    *pid = child;
+    return 0;
+}
+
+static int spawn_posix(const char *path, char *const args[], char **envp, int stdin,
+                       int stdout, pid_t pgid, pid_t *pid) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t none;
+    int rv;
+
+    posix_spawnattr_init(&attr);
+    sigemptyset(&none);
+    posix_spawnattr_setsigmask(&attr, &none);
+    if (pgid >= 0) {
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK);
+        posix_spawnattr_setpgroup(&attr, pgid);
+    } else {
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+    }
+
+    /* The file actions replay, in order, what the fork backend does
+     * between fork() and execve(). */
+    posix_spawn_file_actions_init(&actions);
+    if (stdin != STDIN_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, stdin, STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, stdin);
+    }
+    if (stdout != STDOUT_FILENO) {
+        posix_spawn_file_actions_adddup2(&actions, stdout, STDOUT_FILENO);
+        posix_spawn_file_actions_addclose(&actions, stdout);
+    }
+    if (spawn_stderr >= 0)
+        posix_spawn_file_actions_adddup2(&actions, spawn_stderr, STDERR_FILENO);
+
+    rv = posix_spawn(pid, path, &actions, &attr, args, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return -rv;
+}
+
+/* Everything the clone()d child needs; it lives on the parent's stack,
+ * which the child shares until it calls execve(). */
+struct vfork_args {
+    const char *path;
+    char *const *args;
+    char **envp;
+    int stdin;
+    int stdout;
+    pid_t pgid;
+    sigset_t *mask;
+    int err;
+};
+
+static int vfork_child(void *arg) {
+    struct vfork_args *a = arg;
+    struct sigaction sa;
+
+    /* We share the parent's memory, so none of its signal handlers may
+     * run here.  Reset them before unblocking signals again. */
+    for (int sig = 1; sig < NSIG; sig++) {
+        if (sigaction(sig, NULL, &sa) == 0 && sa.sa_handler != SIG_DFL
+            && sa.sa_handler != SIG_IGN) {
+            sa.sa_handler = SIG_DFL;
+            sigaction(sig, &sa, NULL);
+        }
+    }
+    sigprocmask(SIG_SETMASK, a->mask, NULL);
+
+    /* The parent reports the failure, as it does a failed execve() */
+    int rv = apply_sched(spawn_sched, 0);
+    if (rv < 0) {
+        errno = -rv;
+        goto fail;
+    }
+    if (a->pgid >= 0) setpgid(0, a->pgid);
+    if (a->stdin != STDIN_FILENO) {
+        if (dup2(a->stdin, STDIN_FILENO) < 0) goto fail;
+        close(a->stdin);
+    }
+    if (a->stdout != STDOUT_FILENO) {
+        if (dup2(a->stdout, STDOUT_FILENO) < 0) goto fail;
+        close(a->stdout);
+    }
+    if (spawn_stderr >= 0 && dup2(spawn_stderr, STDERR_FILENO) < 0) goto fail;
+    execve(a->path, a->args, a->envp);
+
+fail:
+    a->err = errno;
+    _exit(127);
+}
+
+static int spawn_vfork(const char *path, char *const args[], char **envp, int stdin,
+                       int stdout, pid_t pgid, pid_t *pid) {
+    /* The parent is suspended until the child has exec'ed or exited, so a
+     * single stack can be reused for every spawn.  Only the main thread
+     * launches commands. */
+    static char stack[VFORK_STACK_SIZE] __attribute__((aligned(16)));
+    sigset_t all, old, none;
+    struct vfork_args a = {path, args, envp, stdin, stdout, pgid, &none, 0};
+
+    sigemptyset(&none);
+    sigfillset(&all);
+    sigprocmask(SIG_BLOCK, &all, &old);
+    pid_t child = clone(vfork_child, stack + sizeof(stack),
+                        CLONE_VM | CLONE_VFORK | SIGCHLD, &a);
+    int err = errno;
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    if (child < 0) return -err;
+    if (a.err) {
+        while (waitpid(child, NULL, 0) < 0 && errno == EINTR);
+        return -a.err;
+    }
+    *pid = child;
+    return 0;
+}
+
+int spawn_process(const char *path, char *const args[], int stdin, int stdout,
+                  pid_t pgid, pid_t *pid) {
+    char **envp = spawn_env ? spawn_env : vars_environ();
+    int rv;
+
+    switch (backend) {
+        case SPAWN_POSIX_SPAWN:
+            /* posix_spawn() has no attributes for affinity, nice or I/O
+             * priority; the vfork backend, closest in cost, starts a child
+             * that needs them */
+            if (!spawn_sched) {
+                rv = spawn_posix(path, args, envp, stdin, stdout, pgid, pid);
+                break;
+            }
+            /* fall through */
+        case SPAWN_VFORK:
+            rv = spawn_vfork(path, args, envp, stdin, stdout, pgid, pid);
+            break;
+        case SPAWN_FORK:
+        default:
+            rv = spawn_fork(path, args, envp, stdin, stdout, pgid, pid);
+            break;
+    }
+
+    /* Also move the child from the parent's side, so the group exists
+     * before we hand it the terminal, whichever side gets there first.
+     * This fails harmlessly once the child has exec'ed. */
+    if (rv == 0 && pgid >= 0) setpgid(*pid, pgid ?: *pid);
+    return rv;
+}
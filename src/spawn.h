@@ -0,0 +1,85 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include "placement.h"
+#include <sys/types.h>
+
+/**
+ * The mechanisms that can be used to start a child process.
+ */
+enum spawn_backend {
+    SPAWN_FORK,        // fork(), then dup2() and execve() in the child
+    SPAWN_POSIX_SPAWN, // posix_spawn() with file actions for the redirections
+    SPAWN_VFORK,       // clone(CLONE_VM | CLONE_VFORK), sharing our page tables
+};
+
+/**
+ * Selects the backend used by every subsequent spawn_process() call.
+ *
+ * @param name One of "fork", "posix_spawn" or "vfork".
+ * @return 0 on success, or -EINVAL if the name is not a known backend.
+ */
+int set_spawn_backend(const char *name);
+
+/**
+ * Returns the name of the backend currently in use.
+ *
+ * @return A static string, as accepted by set_spawn_backend().
+ */
+const char *get_spawn_backend_name(void);
+
+/**
+ * Sets the scheduling attributes every subsequent spawn_process() call
+ * starts its child with, until they are set again.
+ *
+ * @param attrs The attributes, or NULL to inherit the shell's.  They must
+ *              stay valid until they are replaced.
+ */
+void set_spawn_sched(const struct sched_attrs *attrs);
+
+/**
+ * @return The attributes set by set_spawn_sched(), or NULL.
+ */
+const struct sched_attrs *get_spawn_sched(void);
+
+/**
+ * Sets the environment every subsequent spawn_process() call starts its
+ * child with, until it is set again.
+ *
+ * @param envp The environment, or NULL for the one of the exported
+ *             variables, vars_environ().  It must stay valid until it is
+ *             replaced.
+ */
+void set_spawn_env(char **envp);
+
+/**
+ * Sets where the stderr of every subsequent spawn_process() call goes,
+ * until it is set again.  The descriptor is dup'ed into place in the
+ * child, and left open in the parent.
+ *
+ * @param fd The descriptor, or -1 for the shell's stderr.
+ */
+void set_spawn_stderr(int fd);
+
+/**
+ * Starts path as a new child process, with stdin and stdout redirected.
+ * Redirection follows the same rules for every backend: a descriptor other
+ * than STDIN_FILENO (resp. STDOUT_FILENO) is dup'ed into place and then
+ * closed in the child.  The parent's descriptors are left untouched.
+ *
+ * The fork backend reports a failed execve() through the child's exit
+ * status; the other backends report it here, and leave no child behind.
+ *
+ * @param path Path of the binary to execute.
+ * @param args NULL-terminated argument vector, args[0] included.
+ * @param stdin File descriptor for standard input.
+ * @param stdout File descriptor for standard output.
+ * @param pgid Process group to move the child into: 0 for a new group led by
+ *             the child, or -1 to stay in the shell's group.
+ * @param pid Pointer to store the pid of the new child.
+ * @return 0 on success, or negative errno on failure.
+ */
+int spawn_process(const char *path, char *const args[], int stdin, int stdout,
+                  pid_t pgid, pid_t *pid);
+
+#endif // SPAWN_H
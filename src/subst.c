@@ -0,0 +1,762 @@
+/*
+ * This file implements command substitution.  The output of the command is
+ * collected in memory, never in a file: a builtin writes into a memfd,
+ * and a pipeline into a pipe, which a thread drains while the shell waits
+ * on the job, so a command with a lot of output never blocks on it.  Only
+ * what cannot change the shell runs from the shell itself; a list, or a
+ * builtin such as cd or exit, runs in a forked copy of it.
+ *
+ * Variables expand in the same pass over a word, and split into fields
+ * the same way; the values of assignments are expanded too, but not split.
+ * So does arithmetic, $((...)), which is evaluated in the shell.
+ *
+ * Process substitution also goes through pipes: the commands join the job
+ * of the pipeline, and run alongside its stages.
+ */
+
+#define _GNU_SOURCE
+
+#include "subst.h"
+#include "arith.h"
+#include "builtin.h"
+#include "exec.h"
+#include "functions.h"
+#include "glob.h"
+#include "jobs.h"
+#include "parse.h"
+#include "utils/arena.h"
+#include "utils/pattern.h"
+#include "utils/trace.h"
+#include "vars.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define CAPTURE_CHUNK 4096
+
+/* The output of a command */
+struct capture {
+    char *data;
+    size_t len;
+    size_t cap;
+};
+
+/* The exit status of the last command substitution since expand_assignments()
+ * last started */
+static int subst_status;
+
+/* What the thread draining a pipe works with */
+struct drain {
+    int fd;
+    struct capture *out;
+    int error;
+};
+
+char *substitution_end(const char *start) {
+    if (*start == '`') return strchr(start + 1, '`');
+
+    /* ${...} may hold more of them, as in ${x:-${y}} */
+    if (start[1] == '{') {
+        int depth = 0;
+        for (const char *c = start + 1; *c; c++) {
+            if (*c == '{') depth++;
+            else if (*c == '}' && --depth == 0) return (char *) c;
+        }
+        return NULL;
+    }
+
+    int depth = 0;
+    for (const char *c = start + 1; *c; c++) {
+        if (*c == '`') {
+            /* A backtick substitution inside; its parentheses do not count */
+            c = strchr(c + 1, '`');
+            if (!c) return NULL;
+        } else if (*c == '(') {
+            depth++;
+        } else if (*c == ')' && --depth == 0) {
+            return (char *) c;
+        }
+    }
+    return NULL;
+}
+
+bool is_process_substitution(const char *word) {
+    if ((word[0] != '<' && word[0] != '>') || word[1] != '(') return false;
+    char *end = substitution_end(word);
+    return end && end[1] == '\0';
+}
+
+bool has_substitution(const char *word) {
+    if (strchr(word, '`')) return true;
+    for (const char *c = strchr(word, '$'); c; c = strchr(c + 1, '$'))
+        if (c[1] == '(' || is_parameter(c)) return true;
+    return false;
+}
+
+/* Make room for more bytes of output */
+static int reserve(struct capture *c, size_t more) {
+    if (c->len + more <= c->cap) return 0;
+
+    size_t cap = c->cap ? c->cap : CAPTURE_CHUNK;
+    while (cap < c->len + more) cap *= 2;
+    char *bigger = realloc(c->data, cap);
+    if (!bigger) return -ENOMEM;
+    c->data = bigger;
+    c->cap = cap;
+    return 0;
+}
+
+static void *drain_pipe(void *arg) {
+    struct drain *d = arg;
+    ssize_t n;
+
+    for (;;) {
+        if (reserve(d->out, CAPTURE_CHUNK)) {
+            d->error = -ENOMEM;
+            break;
+        }
+        n = read(d->fd, d->out->data + d->out->len, d->out->cap - d->out->len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        d->out->len += n;
+    }
+
+    /* Keep reading, so the writers never block on a pipe nobody drains */
+    char sink[CAPTURE_CHUNK];
+    while (d->error && (n = read(d->fd, sink, sizeof(sink))) != 0)
+        if (n < 0 && errno != EINTR) break;
+    return NULL;
+}
+
+/* Run a builtin with its output going to a memfd, which is kept for the
+ * next time: nothing is forked, and nothing blocks, however much it
+ * writes.  A copy of the shell gets a memfd of its own, since it shares
+ * the file with the shell. */
+static int capture_builtin(char *args[], struct capture *out) {
+    static int memfd = -1;
+    static pid_t owner;
+    int rv = 0;
+
+    if (memfd >= 0 && owner != getpid()) {
+        close(memfd);
+        memfd = -1;
+    }
+    if (memfd < 0 && (memfd = memfd_create("thsh-subst", MFD_CLOEXEC)) < 0) {
+        memfd = -1;
+        return -errno;
+    }
+    owner = getpid();
+    if (ftruncate(memfd, 0) < 0 || lseek(memfd, 0, SEEK_SET) < 0) return -errno;
+
+    handle_builtin(args, STDIN_FILENO, memfd, &rv);
+    subst_status = rv < 0 ? 1 : rv;
+
+    off_t size = lseek(memfd, 0, SEEK_CUR);
+    if (size <= 0) return 0;
+    if (reserve(out, size)) return -ENOMEM;
+    ssize_t n = pread(memfd, out->data + out->len, size, 0);
+    if (n < 0) return -errno;
+    out->len += n;
+    return 0;
+}
+
+/* Run the pipelines of a list in turn, as its operators say, in the copy
+ * of the shell a substitution runs in.  Returns the status of the last
+ * one, which the copy exits with. */
+static int run_captured_list(void *arg) {
+    struct pipeline *p = arg;
+    int status = 0;
+
+    for (bool run = true; p; run = list_runs_next(p->op, status), p = p->next) {
+        if (!run) continue;
+        int rv = expand_pipeline(p);
+        if (rv == -EDOM) {
+            status = 1;
+            rv = 0;
+        } else if (rv > 0) {
+            rv = run_pipeline(p, p->background, &status);
+        }
+        if (rv < 0) {
+            dprintf(STDERR_FILENO, "Failed to run command substitution - error %d\n", rv);
+            status = 127;
+        }
+        set_last_status(status);
+    }
+    return status;
+}
+
+/* Run the command line of a substitution with its output going into a
+ * pipe that a thread drains: one pipeline from the shell itself, or any
+ * list from a copy of it, that the shell waits on */
+static int capture_output(struct pipeline *p, bool subshell, const char *cmdline,
+                          struct capture *out) {
+    pthread_t reader;
+    int fd[2], status = 0, job_id = -1;
+
+    if (pipe2(fd, O_CLOEXEC) < 0) return -errno;
+
+    /* The copy is forked first, so the thread is not there to fork, and
+     * with SIGCHLD blocked, so it is not reaped before it joins its job */
+    int rv = 0;
+    if (subshell) {
+        sigset_t launching, unblocked;
+        sigemptyset(&launching);
+        sigaddset(&launching, SIGCHLD);
+        sigprocmask(SIG_BLOCK, &launching, &unblocked);
+        if ((rv = job_id = create_job(cmdline)) >= 0)
+            rv = run_subshell(run_captured_list, p, fd[1], fd[0], job_id);
+        sigprocmask(SIG_SETMASK, &unblocked, NULL);
+    }
+
+    /* Signals go to the shell's own thread: the SIGCHLD handler must not
+     * run alongside the shell reaping the jobs */
+    struct drain d = {fd[0], out, 0};
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int error = pthread_create(&reader, NULL, drain_pipe, &d);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (error && !subshell) {
+        close(fd[0]);
+        close(fd[1]);
+        return -error;
+    }
+
+    /* Like any other command that fails to run, it is reported, and the
+     * line carries on without its output */
+    if (!subshell) rv = run_pipeline_into(p, fd[1], &status);
+    if (rv < 0) {
+        dprintf(STDERR_FILENO, "Failed to run command substitution - error %d\n", rv);
+        status = 127;
+    }
+    close(fd[1]);
+
+    /* The copy is running already: without the thread, read it from here */
+    if (error) drain_pipe(&d);
+    if (job_id >= 0) {
+        /* The shell is waiting on the output; carry on */
+        while (wait_on_job(job_id, &status) == -EAGAIN) continue;
+    }
+    if (!error) pthread_join(reader, NULL);
+    close(fd[0]);
+    subst_status = status;
+    return d.error;
+}
+
+/* Parse the command line of a substitution, into the arena of the
+ * pipeline it is part of.  Returns the number of pipelines, or -errno. */
+static int parse_inner_line(const char *text, size_t len, struct arena *arena,
+                            struct pipeline *inner) {
+    char *line = arena_strndup(arena, text, len);
+    if (!line) return -ENOMEM;
+
+    int count = tokenize_line(line, len, inner, arena);
+    /* There are no lines to read the body of a here-document from */
+    for (struct pipeline *p = count > 0 ? inner : NULL; p; p = p->next)
+        if (p->here.delim) return -EINVAL;
+    return count;
+}
+
+/* Whether a builtin changes nothing of the shell, so that a substitution
+ * may run it from the shell itself */
+static bool is_harmless(const char *name) {
+    static const char *const harmless[] = {"echo", "pwd", NULL};
+
+    for (int i = 0; harmless[i]; i++)
+        if (strcmp(name, harmless[i]) == 0) return !is_function(name);
+    return false;
+}
+
+/* Whether the command line of a substitution can run from the shell
+ * itself: a single pipeline in the foreground, whose commands are known
+ * before it expands, and that defines and assigns nothing */
+static bool runs_in_place(struct pipeline *p) {
+    if (p->next || p->body || p->background) return false;
+    for (int s = 0; s < p->count; s++) {
+        char **argv = p->stages[s].argv;
+        if (!argv[0] || is_assignment(argv[0]) || has_substitution(argv[0]) ||
+            is_pattern(argv[0], strlen(argv[0])))
+            return false;
+        if (is_builtin(argv[0]) && !is_harmless(argv[0])) return false;
+        /* ${name=word} and $((name = 1)) assign as they expand */
+        for (int a = 1; argv[a]; a++)
+            if (strchr(argv[a], '=') && has_substitution(argv[a])) return false;
+    }
+    return true;
+}
+
+/* Run the command line of a substitution, and collect its output.  What
+ * may change the shell, cd, exit, an assignment, a function, or a list,
+ * runs in a copy of it, as it would in any other shell. */
+static int capture_command(const char *text, size_t len, struct arena *arena,
+                           struct capture *out) {
+    uint64_t trace_start = trace_now();
+    struct pipeline inner;
+
+    char *cmdline = arena_strndup(arena, text, len);
+    if (!cmdline) return -ENOMEM;
+    int count = parse_inner_line(text, len, arena, &inner);
+    int rv = count < 0 ? count : 0;
+
+    if (count > 0 && !runs_in_place(&inner)) {
+        rv = capture_output(&inner, true, cmdline, out);
+    } else if (count > 0 && (rv = expand_pipeline(&inner)) > 0) {
+        /* A single builtin writes into a memfd, and nothing is forked */
+        if (inner.count == 1 && !inner.infile && !inner.outfile && !inner.here.text &&
+            !inner.stages[0].assign_count && inner.stages[0].argv[0] &&
+            is_harmless(inner.stages[0].argv[0]))
+            rv = capture_builtin(inner.stages[0].argv, out);
+        else
+            rv = capture_output(&inner, false, cmdline, out);
+    }
+
+    trace_span("subst", trace_start, NULL);
+    return rv;
+}
+
+/* The fields one word expands to, as they are built */
+struct fields {
+    struct arena *arena;
+    char **list;
+    int count;
+    int cap;
+    struct capture field; // The field under way
+    bool have;            // Whether a field is under way
+    bool split;           // Whether expansions split at whitespace
+};
+
+/* Add the field under way to the list */
+static int add_field(struct fields *f) {
+    if (f->count == f->cap) {
+        char **more = arena_grow(f->arena, f->list, f->cap * sizeof(char *),
+                                 (f->cap ? f->cap * 2 : 8) * sizeof(char *));
+        if (!more) return -ENOMEM;
+        f->list = more;
+        f->cap = f->cap ? f->cap * 2 : 8;
+    }
+    char *word = arena_strndup(f->arena, f->field.data ? f->field.data : "", f->field.len);
+    if (!word) return -ENOMEM;
+    f->list[f->count++] = word;
+    f->field.len = 0;
+    f->have = false;
+    return 0;
+}
+
+/* Add what an expansion produced to the fields: split at whitespace, or
+ * as it is */
+static int add_expansion(struct fields *f, const char *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (f->split && isspace((unsigned char) data[i])) {
+            if (f->have && add_field(f)) return -ENOMEM;
+            continue;
+        }
+        if (reserve(&f->field, 1)) return -ENOMEM;
+        f->field.data[f->field.len++] = data[i];
+        f->have = true;
+    }
+    return 0;
+}
+
+static int expand_text(struct fields *f, const char *text, size_t len);
+
+/* Expand text as a single string, unsplit, into the arena */
+static int expand_string(struct arena *arena, const char *text, size_t len, char **out) {
+    struct fields f = {.arena = arena};
+
+    int rv = expand_text(&f, text, len);
+    if (!rv && !(*out = arena_strndup(arena, f.field.data ? f.field.data : "", f.field.len)))
+        rv = -ENOMEM;
+    free(f.field.data);
+    return rv;
+}
+
+bool is_parameter(const char *text) {
+    return text[0] == '$' && (text[1] == '{' || var_name_length(text + 1) ||
+                              (text[1] && strchr(SPECIAL_PARAMS, text[1])));
+}
+
+/* Expand the inside of a ${...}: ${name}, ${name[key]}, ${name[@]},
+ * ${#name}, ${#name[@]}, ${!name[@]}, and ${name:-word} with the other
+ * operators of bash, with or without the ':' */
+static int expand_braces(struct fields *f, const char *inner, size_t len) {
+    char *s = arena_strndup(f->arena, inner, len);
+    if (!s) return -ENOMEM;
+
+    bool length = s[0] == '#' && s[1], keys = s[0] == '!' && s[1];
+    if (length || keys) s++;
+
+    size_t n = var_name_length(s);
+    if (!n && s[0] >= '0' && s[0] <= '9') n = strspn(s, "0123456789");
+    if (!n && s[0] && strchr(SPECIAL_PARAMS, s[0])) n = 1;
+    if (!n) return -EINVAL;
+    char *name = arena_strndup(f->arena, s, n);
+    if (!name) return -ENOMEM;
+
+    char *rest = s + n, *sub = NULL;
+    if (*rest == '[') {
+        char *close = strchr(rest, ']');
+        if (!close) return -EINVAL;
+        *close = '\0';
+        sub = rest + 1;
+        rest = close + 1;
+    }
+    bool colon = rest[0] == ':' && rest[1] && strchr("-=+?", rest[1]);
+    char op = colon ? rest[1] : rest[0] && strchr("-=+?", rest[0]) ? rest[0] : '\0';
+    char *word = rest + (colon ? 2 : op ? 1 : 0);
+    if ((!op && *rest) || (keys && (!sub || op))) return -EINVAL;
+
+    /* ${name[@]} and ${name[*]} are every element, as separate fields */
+    bool all = sub && (strcmp(sub, "@") == 0 || strcmp(sub, "*") == 0);
+    const char **items = NULL, *value = NULL;
+    char *key = NULL;
+    int count = 0, rv = 0;
+    if (all) {
+        if ((count = get_var_items(name, keys, f->arena, &items)) < 0) return count;
+    } else if (sub) {
+        if ((rv = expand_string(f->arena, sub, strlen(sub), &key)) < 0) return rv;
+        value = get_var_element(name, key);
+    } else {
+        value = get_var(name);
+    }
+
+    if (length) {
+        char number[24];
+        int digits = snprintf(number, sizeof(number), "%zu",
+                              all ? (size_t) count : strlen(value ? value : ""));
+        return add_expansion(f, number, digits);
+    }
+
+    bool set = all ? count > 0 : value && (!colon || *value);
+    char *text;
+    switch (op) {
+        case '-':
+            if (set) break;
+            return expand_text(f, word, strlen(word));
+        case '=':
+            if (set) break;
+            if ((rv = expand_string(f->arena, word, strlen(word), &text)) < 0) return rv;
+            if (all || (!sub && !var_name_length(name))) return -EINVAL;
+            rv = key ? set_var_element(name, key, text) : set_var(name, text);
+            return rv < 0 ? rv : add_expansion(f, text, strlen(text));
+        case '+':
+            return set ? expand_text(f, word, strlen(word)) : 0;
+        case '?':
+            if (set) break;
+            if ((rv = expand_string(f->arena, word, strlen(word), &text)) < 0) return rv;
+            dprintf(STDERR_FILENO, "thsh: %s: %s\n", name,
+                    *text ? text : "parameter null or not set");
+            return -EINVAL;
+    }
+
+    if (!all) return value ? add_expansion(f, value, strlen(value)) : 0;
+    /* The elements are fields of their own, or joined by spaces unsplit */
+    for (int i = 0; i < count && !rv; i++) {
+        if (i) rv = f->split ? (f->have ? add_field(f) : 0) : add_expansion(f, " ", 1);
+        if (!rv) rv = add_expansion(f, items[i], strlen(items[i]));
+    }
+    return rv;
+}
+
+/* Whether the "$((" at c, whose substitution ends at end, is arithmetic:
+ * its "((" closes with the "))" at end, rather than earlier, as in the
+ * commands of $((a) | (b)) */
+static bool is_arithmetic(const char *c, const char *end) {
+    return c[1] == '(' && c[2] == '(' && substitution_end(c + 1) == end - 1;
+}
+
+/* Expand the inside of a $((...)): its variables and substitutions, then
+ * the value of the expression */
+static int expand_arithmetic(struct fields *f, const char *inner, size_t len) {
+    char *expr, value[24];
+    int64_t result;
+
+    int rv = expand_string(f->arena, inner, len, &expr);
+    if (rv) return rv;
+    /* arith_eval() has reported the error, whatever it was */
+    if (arith_eval(expr, &result)) return -EDOM;
+    snprintf(value, sizeof(value), "%" PRId64, result);
+    return add_expansion(f, value, strlen(value));
+}
+
+/* Expand the substitutions and the variables of some text into fields */
+static int expand_text(struct fields *f, const char *text, size_t len) {
+    struct capture output = {0};
+    const char *stop = text + len;
+    int rv = 0;
+
+    for (const char *c = text; c < stop && !rv;) {
+        char *end = NULL;
+        if (*c == '`' || (c[0] == '$' && (c[1] == '(' || c[1] == '{')))
+            end = substitution_end(c);
+        if (end && end >= stop) end = NULL;
+
+        if (end && c[1] == '{') {
+            rv = expand_braces(f, c + 2, end - c - 2);
+            c = end + 1;
+            continue;
+        }
+
+        size_t n = c[0] == '$' && !end ? var_name_length(c + 1) : 0;
+        if (!n && c[0] == '$' && c + 1 < stop && c[1] && strchr(SPECIAL_PARAMS, c[1])) n = 1;
+        if (n && c + 1 + n <= stop) {
+            char name[n + 1];
+            memcpy(name, c + 1, n);
+            name[n] = '\0';
+            const char *value = get_var(name);
+            if (value) rv = add_expansion(f, value, strlen(value));
+            c += 1 + n;
+            continue;
+        }
+
+        if (!end) {
+            /* Anything else, even an unclosed substitution, is literal */
+            rv = reserve(&f->field, 1);
+            if (!rv) f->field.data[f->field.len++] = *c++;
+            f->have = true;
+            continue;
+        }
+
+        if (*c == '$' && is_arithmetic(c, end)) {
+            rv = expand_arithmetic(f, c + 3, end - 1 - (c + 3));
+            c = end + 1;
+            continue;
+        }
+
+        const char *inner = c + (*c == '`' ? 1 : 2);
+        output.len = 0;
+        rv = capture_command(inner, end - inner, f->arena, &output);
+        c = end + 1;
+
+        /* The trailing newlines go, and the rest splits at whitespace */
+        while (output.len && output.data[output.len - 1] == '\n') output.len--;
+        if (!rv) rv = add_expansion(f, output.data, output.len);
+    }
+
+    free(output.data);
+    return rv;
+}
+
+/* Expand the substitutions and the variables of one word into fields, in
+ * the arena.  Returns the number of fields, or -errno. */
+static int expand_word(struct arena *arena, const char *word, char ***fields) {
+    struct fields f = {.arena = arena, .split = true};
+
+    int rv = expand_text(&f, word, strlen(word));
+    if (!rv && f.have) rv = add_field(&f);
+    free(f.field.data);
+    *fields = f.list;
+    return rv ? rv : f.count;
+}
+
+int expand_substitutions(struct pipeline *p) {
+    for (int s = 0; s < p->count; s++) {
+        struct command *stage = &p->stages[s];
+        for (int a = 0; stage->argv[a] != NULL; a++) {
+            /* What is inside a process substitution expands when it runs */
+            if (!has_substitution(stage->argv[a]) || is_process_substitution(stage->argv[a]))
+                continue;
+
+            /* The fields take the word's place, ahead of the words after it */
+            char **fields;
+            int count = expand_word(p->arena, stage->argv[a], &fields);
+            if (count < 0) return count;
+            int rv = splice_words(p, stage, a, fields, count);
+            if (rv < 0) return rv;
+            a += count - 1;
+        }
+
+        /* A stage whose command expanded to nothing has nothing to run,
+         * unless it only assigns variables */
+        if (!stage->argv[0] && (!stage->assign_count || p->count > 1)) return -EINVAL;
+    }
+    return p->count;
+}
+
+/* Expand the elements of NAME=(...), words[0] to words[last], without the
+ * parentheses: they split, and glob, like arguments */
+static int expand_elements(struct arena *arena, char **words, int last,
+                           struct assignment *assign) {
+    struct glob_cache cache;
+    int cap = 0;
+
+    glob_cache_init(&cache, arena);
+    assign->values = NULL;
+    assign->count = 0;
+    for (int i = 0; i <= last; i++) {
+        const char *word = i ? words[i] : strchr(words[i], '=') + 2;
+        size_t len = strlen(word) - (i == last);
+        char *text, **fields, **paths;
+
+        if (!(text = arena_strndup(arena, word, len))) return -ENOMEM;
+        int count = expand_word(arena, text, &fields);
+        if (count < 0) return count;
+        for (int k = 0; k < count; k++) {
+            int found = is_pattern(fields[k], strlen(fields[k]))
+                        ? expand_glob(fields[k], &cache, &paths) : 0;
+            if (found < 0) return found;
+            if (!found) {
+                paths = &fields[k];
+                found = 1;
+            }
+            if (assign->count + found > cap) {
+                int more = cap ? cap * 2 : 8;
+                while (more < assign->count + found) more *= 2;
+                char **values = arena_grow(arena, assign->values, cap * sizeof(char *),
+                                           more * sizeof(char *));
+                if (!values) return -ENOMEM;
+                assign->values = values;
+                cap = more;
+            }
+            memcpy(assign->values + assign->count, paths, found * sizeof(char *));
+            assign->count += found;
+        }
+    }
+    return 0;
+}
+
+/* Whether a word of NAME=(...) is the last one: it ends with a ')' that
+ * no substitution in it opened */
+static bool closes_list(const char *word) {
+    for (const char *c = word; *c; c++) {
+        char *end = NULL;
+        if (*c == '`' || (c[0] == '$' && (c[1] == '(' || c[1] == '{'))) end = substitution_end(c);
+        if (end) c = end;
+        else if (*c == ')' && !c[1]) return true;
+    }
+    return false;
+}
+
+/* Expand the assignment that starts at words[0], and return the number of
+ * words it takes, or -errno */
+static int expand_assignment(struct arena *arena, char **words, struct assignment *assign) {
+    const char *word = words[0];
+    size_t n = var_name_length(word);
+    const char *eq = strchr(word + n, '=');
+    int rv;
+
+    memset(assign, 0, sizeof(*assign));
+    if (!(assign->name = arena_strndup(arena, word, n))) return -ENOMEM;
+
+    if (word[n] == '[' &&
+        (rv = expand_string(arena, word + n + 1, eq - 1 - (word + n + 1), &assign->key)) < 0)
+        return rv;
+
+    /* NAME=(...) runs up to the word that ends with the ')' */
+    if (eq[1] == '(' && !assign->key) {
+        int last;
+        for (last = 0; words[last]; last++)
+            if (closes_list(last ? words[last] : eq + 2)) break;
+        if (!words[last]) return -EINVAL;
+        assign->list = true;
+        rv = expand_elements(arena, words, last, assign);
+        return rv < 0 ? rv : last + 1;
+    }
+
+    if (!(assign->values = arena_alloc(arena, sizeof(char *)))) return -ENOMEM;
+    assign->count = 1;
+    rv = expand_string(arena, eq + 1, strlen(eq + 1), &assign->values[0]);
+    return rv < 0 ? rv : 1;
+}
+
+int expand_assignments(struct pipeline *p) {
+    subst_status = 0;
+    for (int s = 0; s < p->count; s++) {
+        struct command *stage = &p->stages[s];
+        int words = 0, count = 0, rv;
+
+        while (stage->argv[words] && is_assignment(stage->argv[words])) {
+            if (!stage->assigns &&
+                !(stage->assigns = arena_alloc(p->arena, stage->argc * sizeof(struct assignment))))
+                return -ENOMEM;
+            rv = expand_assignment(p->arena, stage->argv + words, &stage->assigns[count]);
+            if (rv < 0) return rv;
+            words += rv;
+            count++;
+        }
+        stage->argv += words;
+        stage->argc -= words;
+        stage->assign_count = count;
+
+        /* Only a pipeline of one stage may be nothing but assignments */
+        if (!stage->argv[0] && p->count > 1) return -EINVAL;
+    }
+    return p->count;
+}
+
+int substitution_status(void) {
+    return subst_status;
+}
+
+/* Start the command of one process substitution, and return the shell's
+ * end of its pipe, or -errno */
+static int start_process_substitution(const char *word, struct arena *arena,
+                                      int job_id, int *started) {
+    bool reads = word[0] == '<'; // The pipeline reads what the command writes
+    struct pipeline inner;
+    int fd[2];
+
+    /* The command joins the job as it is: a list would need a shell of its
+     * own to run its pipelines in turn */
+    int rv = parse_inner_line(word + 2, strlen(word) - 3, arena, &inner);
+    if (rv == 0 || rv > 1 || inner.background) return -EINVAL;
+    if (rv > 0) rv = expand_pipeline(&inner);
+    if (rv < 0) return rv;
+    if (pipe2(fd, O_CLOEXEC) < 0) return -errno;
+
+    rv = join_pipeline(&inner, reads ? -1 : fd[0], reads ? fd[1] : -1, job_id);
+    close(reads ? fd[1] : fd[0]);
+    if (rv < 0) {
+        close(reads ? fd[0] : fd[1]);
+        return rv;
+    }
+    *started += rv;
+    return reads ? fd[0] : fd[1];
+}
+
+int start_process_substitutions(struct pipeline *p, int job_id, struct proc_substs *subs) {
+    int started = 0, words = 0;
+
+    subs->count = 0;
+    for (int s = 0; s < p->count; s++)
+        for (int a = 0; p->stages[s].argv[a] != NULL; a++)
+            words += is_process_substitution(p->stages[s].argv[a]);
+    if (!words) return 0;
+
+    subs->fds = arena_alloc(p->arena, words * sizeof(int));
+    if (!subs->fds) return -ENOMEM;
+
+    for (int s = 0; s < p->count; s++) {
+        char **argv = p->stages[s].argv;
+        for (int a = 0; argv[a] != NULL; a++) {
+            if (!is_process_substitution(argv[a])) continue;
+
+            int fd = start_process_substitution(argv[a], p->arena, job_id, &started);
+            char *path = fd < 0 ? NULL : arena_alloc(p->arena, 24);
+            if (fd >= 0) subs->fds[subs->count++] = fd;
+            if (!path) {
+                close_process_substitutions(subs);
+                return fd < 0 ? fd : -ENOMEM;
+            }
+            snprintf(path, 24, "/dev/fd/%d", fd);
+            argv[a] = path;
+        }
+    }
+
+    /* Only now, so the commands of the others did not inherit them */
+    for (int i = 0; i < subs->count; i++)
+        fcntl(subs->fds[i], F_SETFD, 0);
+    return started;
+}
+
+void close_process_substitutions(struct proc_substs *subs) {
+    for (int i = 0; i < subs->count; i++) close(subs->fds[i]);
+    subs->count = 0;
+}
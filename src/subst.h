@@ -0,0 +1,121 @@
+/*
+ *  Command substitution, $(...) and `...`, parameter expansion, $name and
+ *  ${...}, arithmetic expansion, $((...)), and process substitution, <(...)
+ *  and >(...).
+ */
+
+#ifndef SUBST_H
+#define SUBST_H
+
+#include "parse.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * The special parameters, which $c expands without a name: the status of
+ * the last pipeline, the pid of the shell, and the positional parameters
+ * of a function call.  ${10} and on need the braces.
+ */
+#define SPECIAL_PARAMS "?$#@*0123456789"
+
+/**
+ * The shell's ends of the pipes of the process substitutions of one
+ * pipeline, which its commands get as /dev/fd paths.
+ */
+struct proc_substs {
+    int count;
+    int *fds; // In the arena of the pipeline
+};
+
+/**
+ * Finds the end of a command or process substitution, or of a ${...},
+ * skipping nested ones.  A $((...)) ends like a command substitution.
+ *
+ * @param start Points at the "$(", "<(", ">(", "${" or '`' that opens it.
+ * @return The closing ')', '}' or '`', or NULL if it is not closed.
+ */
+char *substitution_end(const char *start);
+
+/**
+ * @return Whether the '$' at text starts a parameter expansion: $name,
+ *         ${...}, or a special parameter.
+ */
+bool is_parameter(const char *text);
+
+/**
+ * @return Whether the word has a command substitution or a parameter
+ *         expansion in it.
+ */
+bool has_substitution(const char *word);
+
+/**
+ * Replaces every command substitution in the arguments of a pipeline with
+ * the output of its command, less the trailing newlines, and every
+ * variable with its value, split into words at whitespace.  A word that
+ * expands to nothing is dropped.  The new words, and the command lines
+ * inside, live in the pipeline's arena.
+ *
+ * A command that is a single builtin runs right here, into a memfd, with
+ * no fork.  Anything else runs as a foreground pipeline, with its output
+ * read from a pipe as it comes.
+ *
+ * Besides $name, ${name} and ${name[key]}, ${name[@]} expands to every
+ * element of an array, ${!name[@]} to their keys, and ${#name} to the
+ * length of the value, or the number of elements.  ${name:-word},
+ * ${name:=word}, ${name:+word} and ${name:?word} work as in bash, and so
+ * do their forms without the ':'.
+ *
+ * $((expr)) expands to the value of expr, once its own variables and
+ * substitutions are expanded, as arith_eval() has it: no process runs.
+ *
+ * @param p The pipeline, as filled in by tokenize_line().
+ * @return The number of stages on success, -EDOM for an arithmetic error,
+ *         which arith_eval() has reported already, or -errno.
+ */
+int expand_substitutions(struct pipeline *p);
+
+/**
+ * Takes the assignments off the front of every stage of a pipeline, into
+ * its assigns, with their values expanded: unsplit, and unglobbed, but for
+ * the elements of NAME=(...), which split and glob like arguments.
+ *
+ * @param p The pipeline, as filled in by tokenize_line().
+ * @return The number of stages on success, -EINVAL for a NAME=( that
+ *         nothing closes, or for a stage of nothing but assignments in a
+ *         pipeline of several, or -errno.
+ */
+int expand_assignments(struct pipeline *p);
+
+/**
+ * @return The exit status of the last command substitution that ran since
+ *         expand_assignments() last started, or 0 if none did.  It is the
+ *         status of a command of nothing but assignments.
+ */
+int substitution_status(void);
+
+/**
+ * @return Whether the word is a process substitution, <(...) or >(...).
+ */
+bool is_process_substitution(const char *word);
+
+/**
+ * Starts the command of every process substitution in the arguments of a
+ * pipeline, as processes of its job, and replaces the word with the path
+ * of the shell's end of its pipe: /dev/fd/N, which the stages inherit.
+ * The command of <(...) writes into the pipe, and the one of >(...) reads
+ * from it.  They run alongside the pipeline, and the job is only done
+ * once they are.
+ *
+ * @param p The pipeline.
+ * @param job_id The job of the pipeline.
+ * @param subs Returns the ends to close once the stages are launched.
+ * @return The number of processes started, or -errno.
+ */
+int start_process_substitutions(struct pipeline *p, int job_id, struct proc_substs *subs);
+
+/**
+ * Closes the shell's ends of the pipes of process substitutions.
+ */
+void close_process_substitutions(struct proc_substs *subs);
+
+#endif // SUBST_H
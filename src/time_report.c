@@ -0,0 +1,103 @@
+/*
+ * This file implements the report of the `time` keyword, as a table for
+ * people, or as one line of JSON per pipeline for scripts and dashboards.
+ */
+
+#define _GNU_SOURCE
+
+#include "time_report.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static double seconds(struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* Add up the stages into the total; the peak RSS is the largest one */
+static void add_usage(struct rusage *total, struct rusage *u) {
+    timeradd(&total->ru_utime, &u->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &u->ru_stime, &total->ru_stime);
+    if (u->ru_maxrss > total->ru_maxrss) total->ru_maxrss = u->ru_maxrss;
+    total->ru_nvcsw += u->ru_nvcsw;
+    total->ru_nivcsw += u->ru_nivcsw;
+    total->ru_minflt += u->ru_minflt;
+    total->ru_majflt += u->ru_majflt;
+}
+
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static void json_usage(FILE *out, double real, struct rusage *u) {
+    fprintf(out, "\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"maxrss_kb\":%ld,"
+                 "\"nvcsw\":%ld,\"nivcsw\":%ld,\"minflt\":%ld,\"majflt\":%ld",
+            real, seconds(&u->ru_utime), seconds(&u->ru_stime), u->ru_maxrss,
+            u->ru_nvcsw, u->ru_nivcsw, u->ru_minflt, u->ru_majflt);
+}
+
+static void table_row(FILE *out, const char *stage, const char *command,
+                      double real, struct rusage *u) {
+    fprintf(out, "%-6s %-16.16s %9.3fs %9.3fs %9.3fs %9ldK %7ld %7ld %8ld %7ld\n",
+            stage, command, real, seconds(&u->ru_utime), seconds(&u->ru_stime),
+            u->ru_maxrss, u->ru_nvcsw, u->ru_nivcsw, u->ru_minflt, u->ru_majflt);
+}
+
+void report_stage_times(struct stage_time *stages, int count, const char *cmdline,
+                        double real, int exit_code, bool json, int fd) {
+    struct rusage total = {0};
+    char *text = NULL;
+    size_t len = 0;
+
+    /* Format the whole report first, so it goes out in a single write and
+     * reports appended to a shared file never interleave */
+    FILE *out = open_memstream(&text, &len);
+    if (!out) return;
+
+    for (int i = 0; i < count; i++)
+        if (stages[i].ran) add_usage(&total, &stages[i].usage);
+
+    if (json) {
+        fputc('{', out);
+        fputs("\"command\":", out);
+        json_string(out, cmdline);
+        fprintf(out, ",\"exit\":%d,", exit_code);
+        json_usage(out, real, &total);
+        fputs(",\"stages\":[", out);
+        for (int i = 0; i < count; i++) {
+            struct stage_time *s = &stages[i];
+            fprintf(out, "%s{\"command\":", i ? "," : "");
+            json_string(out, s->command);
+            fprintf(out, ",\"pid\":%d,\"builtin\":%s,\"ran\":%s,", s->pid,
+                    s->pid ? "false" : "true", s->ran ? "true" : "false");
+            json_usage(out, s->real, &s->usage);
+            fputc('}', out);
+        }
+        fputs("]}\n", out);
+    } else {
+        fprintf(out, "%-6s %-16s %10s %10s %10s %10s %7s %7s %8s %7s\n", "stage",
+                "command", "real", "user", "sys", "maxrss", "vcsw", "ivcsw",
+                "minflt", "majflt");
+        for (int i = 0; i < count; i++) {
+            char stage[16];
+            snprintf(stage, sizeof(stage), "%d", i);
+            if (stages[i].ran)
+                table_row(out, stage, stages[i].command, stages[i].real, &stages[i].usage);
+            else
+                fprintf(out, "%-6s %-16.16s %10s\n", stage, stages[i].command, "-");
+        }
+        table_row(out, "total", "", real, &total);
+    }
+
+    fclose(out);
+    if (text) write(fd, text, len);
+    free(text);
+}
@@ -0,0 +1,40 @@
+/*
+ *  Formats the report of the `time` keyword.
+ */
+
+#ifndef TIME_REPORT_H
+#define TIME_REPORT_H
+
+#include <stdbool.h>
+#include <sys/resource.h>
+
+/**
+ * What one stage of a timed pipeline cost.
+ */
+struct stage_time {
+    const char *command;
+    int pid;             // 0 for a builtin, which runs in the shell
+    bool ran;            // Whether the stage got launched at all
+    double real;         // Seconds from launch to exit
+    struct rusage usage; // From wait4(), or the shell's own for a builtin
+};
+
+/**
+ * Prints the cost of every stage of a pipeline, and the total: wall, user
+ * and sys time, peak RSS, voluntary and involuntary context switches, and
+ * minor and major page faults.  The total adds everything up, except the
+ * wall time, which is the pipeline's, and the peak RSS, which is the
+ * largest of any stage.
+ *
+ * @param stages The stages, in pipeline order.
+ * @param count The number of stages.
+ * @param cmdline The command line that was timed.
+ * @param real Wall clock seconds the whole pipeline took.
+ * @param exit_code The exit code of the pipeline.
+ * @param json Print a single line of JSON instead of a table.
+ * @param fd The file descriptor to print to.
+ */
+void report_stage_times(struct stage_time *stages, int count, const char *cmdline,
+                        double real, int exit_code, bool json, int fd);
+
+#endif // TIME_REPORT_H
@@ -0,0 +1,84 @@
+/*
+ * Implementation of arena.h.
+ */
+
+#include "arena.h"
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) char data[];
+};
+
+#define ALIGN(n) (((n) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1))
+
+static struct arena_chunk *new_chunk(struct arena *a, size_t size) {
+    if (size < ARENA_CHUNK) size = ARENA_CHUNK;
+
+    struct arena_chunk *c = malloc(sizeof(*c) + size);
+    if (!c) return NULL;
+    c->size = size;
+    c->used = 0;
+    c->next = a->chunks;
+    a->chunks = c;
+    return c;
+}
+
+void *arena_alloc(struct arena *a, size_t size) {
+    struct arena_chunk *c = a->chunks;
+
+    size = ALIGN(size ?: 1);
+    if ((!c || c->size - c->used < size) && !(c = new_chunk(a, size))) return NULL;
+
+    a->last = c->data + c->used;
+    c->used += size;
+    return a->last;
+}
+
+void *arena_grow(struct arena *a, void *ptr, size_t old_size, size_t new_size) {
+    struct arena_chunk *c = a->chunks;
+
+    if (ptr && ptr == a->last) {
+        size_t start = (char *) ptr - c->data;
+        if (ALIGN(new_size) <= c->size - start) {
+            c->used = start + ALIGN(new_size);
+            return ptr;
+        }
+    }
+
+    void *bigger = arena_alloc(a, new_size);
+    if (bigger && ptr) memcpy(bigger, ptr, old_size < new_size ? old_size : new_size);
+    return bigger;
+}
+
+char *arena_strndup(struct arena *a, const char *s, size_t len) {
+    char *copy = arena_alloc(a, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void arena_reset(struct arena *a) {
+    if (!a->chunks) return;
+
+    /* The first chunk is the oldest, at the end of the list */
+    while (a->chunks->next) {
+        struct arena_chunk *next = a->chunks->next;
+        free(a->chunks);
+        a->chunks = next;
+    }
+    a->chunks->used = 0;
+    a->last = NULL;
+}
+
+void arena_free(struct arena *a) {
+    arena_reset(a);
+    free(a->chunks);
+    a->chunks = NULL;
+}
@@ -0,0 +1,65 @@
+/*
+ * A bump allocator for everything that lives as long as one command line:
+ * the parsed pipeline, and the words its expansions make.
+ */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/**
+ * The default size of a chunk.  A line that needs more gets more chunks;
+ * a single allocation that needs more gets a chunk of its own.
+ */
+#define ARENA_CHUNK 8192
+
+struct arena_chunk;
+
+/**
+ * An arena.  Zero-initialized, it is empty and ready to use.
+ */
+struct arena {
+    struct arena_chunk *chunks; // The current chunk first
+    void *last;                 // The latest allocation, which may grow in place
+};
+
+/**
+ * Allocates from the arena.  The memory is aligned for any type, and not
+ * zeroed.
+ *
+ * @return The memory, or NULL if out of memory.
+ */
+void *arena_alloc(struct arena *a, size_t size);
+
+/**
+ * Resizes an allocation.  The latest allocation grows in place when its
+ * chunk has room; anything else is copied.
+ *
+ * @param ptr The allocation, or NULL.
+ * @param old_size Its size.
+ * @param new_size The size it needs.
+ * @return The allocation, or NULL if out of memory; ptr is still valid then.
+ */
+void *arena_grow(struct arena *a, void *ptr, size_t old_size, size_t new_size);
+
+/**
+ * Copies a string into the arena.
+ *
+ * @param s The string; it need not be NUL-terminated.
+ * @param len The length to copy.
+ * @return The NUL-terminated copy, or NULL if out of memory.
+ */
+char *arena_strndup(struct arena *a, const char *s, size_t len);
+
+/**
+ * Frees everything allocated from the arena at once.  The first chunk is
+ * kept, so a line that fits in it never calls malloc() again.
+ */
+void arena_reset(struct arena *a);
+
+/**
+ * Frees the arena and all of its chunks.
+ */
+void arena_free(struct arena *a);
+
+#endif // ARENA_H
@@ -0,0 +1,182 @@
+/*
+ * Implementation of cmd_hash.h.
+ *
+ * An open-addressing table (linear probing) keyed by command name.  Misses
+ * are cached too, so a script calling a missing command in a loop does
+ * not rescan PATH every time.
+ */
+
+#define _GNU_SOURCE
+
+#include "cmd_hash.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define CMD_HASH_INITIAL_SIZE 64
+
+struct cmd_entry {
+    char *name;     // NULL marks an empty slot
+    char *path;     // NULL marks a negative entry
+    unsigned hits;
+};
+
+static struct cmd_entry *table = NULL;
+static size_t table_size = 0;
+static size_t table_used = 0;
+
+/* The PATH directories' mtimes, as of when the cached entries were valid */
+static struct timespec *dir_mtimes = NULL;
+static int dir_count = -1;
+static long long last_check_ms = 0;
+
+static uint64_t hash_name(const char *name) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for (; *name; name++) {
+        h ^= (unsigned char) *name;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static struct cmd_entry *find_slot(struct cmd_entry *t, size_t size,
+                                   const char *name) {
+    size_t i = hash_name(name) & (size - 1);
+    while (t[i].name && strcmp(t[i].name, name) != 0)
+        i = (i + 1) & (size - 1);
+    return &t[i];
+}
+
+static int grow(void) {
+    size_t new_size = table_size ? table_size * 2 : CMD_HASH_INITIAL_SIZE;
+    struct cmd_entry *new_table = calloc(new_size, sizeof(struct cmd_entry));
+    if (!new_table) return -1;
+
+    for (size_t i = 0; i < table_size; i++) {
+        if (table[i].name)
+            *find_slot(new_table, new_size, table[i].name) = table[i];
+    }
+    free(table);
+    table = new_table;
+    table_size = new_size;
+    return 0;
+}
+
+const char *cmd_hash_get(const char *name, bool *found) {
+    *found = false;
+    if (!table) return NULL;
+
+    struct cmd_entry *e = find_slot(table, table_size, name);
+    if (!e->name) return NULL;
+
+    *found = true;
+    if (e->path) e->hits++;
+    return e->path;
+}
+
+void cmd_hash_put(const char *name, const char *path) {
+    // Keep the load factor under 3/4
+    if ((table_used + 1) * 4 > table_size * 3 && grow() < 0) return;
+
+    struct cmd_entry *e = find_slot(table, table_size, name);
+    if (e->name) {
+        free(e->path);
+    } else {
+        e->name = strdup(name);
+        table_used++;
+    }
+    e->path = path ? strdup(path) : NULL;
+    e->hits = 0;
+}
+
+void cmd_hash_remove(const char *name) {
+    if (!table) return;
+
+    struct cmd_entry *e = find_slot(table, table_size, name);
+    if (!e->name) return;
+
+    free(e->name);
+    free(e->path);
+    e->name = NULL;
+    table_used--;
+
+    /* Re-insert the rest of the probe run, so no entry after the hole
+     * becomes unreachable */
+    size_t i = (e - table + 1) & (table_size - 1);
+    while (table[i].name) {
+        struct cmd_entry moved = table[i];
+        table[i].name = NULL;
+        *find_slot(table, table_size, moved.name) = moved;
+        i = (i + 1) & (table_size - 1);
+    }
+}
+
+void cmd_hash_reset(void) {
+    for (size_t i = 0; i < table_size; i++) {
+        free(table[i].name);
+        free(table[i].path);
+    }
+    free(table);
+    table = NULL;
+    table_size = table_used = 0;
+
+    free(dir_mtimes);
+    dir_mtimes = NULL;
+    dir_count = -1;
+}
+
+static long long now_ms(void) {
+    struct timespec ts;
+    // The coarse clock is served from the vDSO, without a syscall
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void cmd_hash_validate(char **dirs) {
+    long long now = now_ms();
+    int count = 0;
+    bool changed;
+
+    if (dir_mtimes && now - last_check_ms < CMD_HASH_RECHECK_MS) return;
+    last_check_ms = now;
+
+    while (dirs[count]) count++;
+
+    struct timespec *mtimes = calloc(count + 1, sizeof(struct timespec));
+    if (!mtimes) return;
+
+    for (int i = 0; i < count; i++) {
+        struct stat st;
+        if (stat(dirs[i], &st) == 0) mtimes[i] = st.st_mtim;
+    }
+
+    changed = !dir_mtimes || count != dir_count ||
+              memcmp(mtimes, dir_mtimes, count * sizeof(struct timespec)) != 0;
+    if (changed && dir_mtimes) cmd_hash_reset();
+
+    free(dir_mtimes);
+    dir_mtimes = mtimes;
+    dir_count = count;
+}
+
+void cmd_hash_print(int fd) {
+    size_t found = 0;
+
+    // Cached misses are not listed, so a table of nothing else is empty
+    for (size_t i = 0; i < table_size; i++)
+        found += table[i].name && table[i].path;
+    if (!found) {
+        dprintf(fd, "hash: hash table empty\n");
+        return;
+    }
+
+    dprintf(fd, "hits\tcommand\n");
+    for (size_t i = 0; i < table_size; i++) {
+        if (table[i].name && table[i].path)
+            dprintf(fd, "%4u\t%s\n", table[i].hits, table[i].path);
+    }
+}
@@ -0,0 +1,60 @@
+/*
+ * A bash-style hash of command names to the binaries they resolve to.
+ */
+#ifndef CMD_HASH_H
+#define CMD_HASH_H
+
+#include <stdbool.h>
+
+/**
+ * Minimum time between two checks of the PATH directories' mtimes.  In
+ * between, lookups are answered from memory without touching the
+ * filesystem.
+ */
+#define CMD_HASH_RECHECK_MS 1000
+
+/**
+ * Looks up a command name in the hash.
+ *
+ * @param name The command name, as typed.
+ * @param found Pointer set to true if the name is cached, false otherwise.
+ * @return The cached path, or NULL for a miss or a cached negative entry.
+ */
+const char *cmd_hash_get(const char *name, bool *found);
+
+/**
+ * Records the resolution of a command name, replacing any previous entry.
+ *
+ * @param name The command name, as typed.
+ * @param path The binary it resolves to, or NULL to cache a negative entry.
+ */
+void cmd_hash_put(const char *name, const char *path);
+
+/**
+ * Forgets a single command name, if it is cached.
+ *
+ * @param name The command name to drop.
+ */
+void cmd_hash_remove(const char *name);
+
+/**
+ * Forgets every cached command, as well as the mtime snapshot.
+ */
+void cmd_hash_reset(void);
+
+/**
+ * Flushes the hash if any of the given directories changed since the
+ * entries were cached.  Rate limited to once per CMD_HASH_RECHECK_MS.
+ *
+ * @param dirs NULL-terminated array of the PATH directories.
+ */
+void cmd_hash_validate(char **dirs);
+
+/**
+ * Prints every positive entry with its hit count, one per line.
+ *
+ * @param fd The file descriptor to print to.
+ */
+void cmd_hash_print(int fd);
+
+#endif //CMD_HASH_H
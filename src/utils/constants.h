@@ -1,10 +0,0 @@
-#ifndef CONSTANTS_H
-#define CONSTANTS_H
-
-// Assume a pipeline will never be longer than 31 stages (+NULL)
-#define MAX_PIPELINE   32
-
-// Assume any individual command will not have more than 15 arguments (+NULL)
-#define MAX_ARGS       16
-
-#endif //CONSTANTS_H
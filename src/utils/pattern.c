@@ -0,0 +1,208 @@
+/*
+ * Implementation of pattern.h.
+ *
+ * Matching walks the steps and the name together.  When a step does not
+ * match, the latest '*' takes one more byte of the name, and the steps
+ * after it start over from there: an earlier '*' never needs to take more,
+ * as the later one can take anything it would have.  So a name is matched
+ * in at most (name length x steps) comparisons, and most are rejected by
+ * their first step, or by the suffix, before the loop even starts.
+ */
+
+#define _GNU_SOURCE
+
+#include "pattern.h"
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+
+#define CLASS_BYTES 32
+
+static const struct {
+    const char *name;
+    int (*is)(int c);
+} char_classes[] = {
+    {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank}, {"cntrl", iscntrl},
+    {"digit", isdigit}, {"graph", isgraph}, {"lower", islower}, {"print", isprint},
+    {"punct", ispunct}, {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+};
+
+/* Find the ']' that closes the bracket expression at text[at], which is
+ * the '['.  Returns its index, or -1 if there is none.  With a class, the
+ * bytes in the expression are set in it. */
+static long bracket_end(const char *text, size_t len, size_t at, unsigned char *class) {
+    size_t i = at + 1;
+    bool negate = i < len && (text[i] == '!' || text[i] == '^');
+    if (negate) i++;
+
+    /* A ']' first is one of the bytes */
+    for (size_t first = i; i < len; i++) {
+        unsigned char c = text[i];
+        if (c == ']' && i > first) break;
+
+        /* [:alpha:], or a one-byte [.x.] or [=x=], which are just x.  As
+         * fnmatch() has it, a bracket expression with a [. or [= left open
+         * is no bracket expression at all, and an open or unknown [: is
+         * just bytes. */
+        if (c == '[' && i + 1 < len && strchr(":.=", text[i + 1])) {
+            char end[] = {text[i + 1], ']', '\0'};
+            const char *close = memmem(text + i + 2, len - i - 2, end, 2);
+            size_t name_len = close ? close - (text + i + 2) : 0;
+            if (!close && end[0] != ':') return -1;
+
+            int k = 0, classes = sizeof(char_classes) / sizeof(*char_classes);
+            while (close && end[0] == ':' && k < classes &&
+                   (strlen(char_classes[k].name) != name_len ||
+                    memcmp(char_classes[k].name, text + i + 2, name_len) != 0))
+                k++;
+            if (close && end[0] == ':' && k < classes) {
+                for (int b = 0; class && b < 256; b++)
+                    if (char_classes[k].is(b)) class[b >> 3] |= 1 << (b & 7);
+                i = close + 1 - text;
+                continue;
+            }
+            if (end[0] != ':' && name_len == 1) {
+                c = text[i + 2];
+                if (class) class[c >> 3] |= 1 << (c & 7);
+                i = close + 1 - text;
+                continue;
+            }
+        }
+
+        /* A range, unless the '-' is last */
+        unsigned char last = c;
+        if (i + 2 < len && text[i + 1] == '-' && text[i + 2] != ']') {
+            last = text[i + 2];
+            i += 2;
+        }
+        for (int b = c; class && b <= last; b++) class[b >> 3] |= 1 << (b & 7);
+    }
+    if (i >= len) return -1;
+
+    if (class && negate)
+        for (int b = 0; b < CLASS_BYTES; b++) class[b] = ~class[b];
+    /* A name never has a NUL, and it ends the name */
+    if (class) class[0] &= ~1;
+    return i;
+}
+
+bool is_pattern(const char *text, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (text[i] == '*' || text[i] == '?') return true;
+        if (text[i] == '[' && bracket_end(text, len, i, NULL) >= 0) return true;
+    }
+    return false;
+}
+
+static struct pattern_step *add_step(struct pattern *pat, int *cap, struct arena *arena) {
+    if (pat->count == *cap) {
+        int more = *cap ? *cap * 2 : 8;
+        struct pattern_step *steps = arena_grow(arena, pat->steps,
+                                                *cap * sizeof(*steps), more * sizeof(*steps));
+        if (!steps) return NULL;
+        pat->steps = steps;
+        *cap = more;
+    }
+    struct pattern_step *step = &pat->steps[pat->count++];
+    memset(step, 0, sizeof(*step));
+    return step;
+}
+
+int compile_pattern(struct pattern *pat, const char *text, size_t len, struct arena *arena) {
+    struct pattern_step *step = NULL;
+    int cap = 0;
+
+    memset(pat, 0, sizeof(*pat));
+    pat->leading_dot = len && text[0] == '.';
+
+    for (size_t i = 0; i < len; i++) {
+        char c = text[i];
+        long end = c == '[' ? bracket_end(text, len, i, NULL) : -1;
+
+        if (c == '*') {
+            /* "**" in a segment is just a '*' */
+            if (step && step->kind == STEP_STAR) continue;
+            if (!(step = add_step(pat, &cap, arena))) return -ENOMEM;
+            step->kind = STEP_STAR;
+        } else if (c == '?') {
+            if (!(step = add_step(pat, &cap, arena))) return -ENOMEM;
+            step->kind = STEP_ANY;
+        } else if (end >= 0) {
+            unsigned char *class = arena_alloc(arena, CLASS_BYTES);
+            if (!class || !(step = add_step(pat, &cap, arena))) return -ENOMEM;
+            memset(class, 0, CLASS_BYTES);
+            bracket_end(text, len, i, class);
+            step->kind = STEP_CLASS;
+            step->class = class;
+            i = end;
+        } else if (step && step->kind == STEP_LITERAL) {
+            /* Runs of plain bytes are a single step, in the text itself */
+            step->len++;
+        } else {
+            if (!(step = add_step(pat, &cap, arena))) return -ENOMEM;
+            step->kind = STEP_LITERAL;
+            step->text = text + i;
+            step->len = 1;
+        }
+    }
+
+    pat->literal = pat->count == 0 ||
+                   (pat->count == 1 && pat->steps[0].kind == STEP_LITERAL);
+    if (pat->count >= 2 && step->kind == STEP_LITERAL &&
+        pat->steps[pat->count - 2].kind == STEP_STAR) {
+        pat->suffix = step->text;
+        pat->suffix_len = step->len;
+    }
+    return 0;
+}
+
+bool pattern_matches(const struct pattern *pat, const char *name) {
+    if (pat->suffix) {
+        size_t len = strlen(name);
+        if (len < pat->suffix_len ||
+            memcmp(name + len - pat->suffix_len, pat->suffix, pat->suffix_len) != 0)
+            return false;
+    }
+
+    const unsigned char *s = (const unsigned char *) name, *star_s = NULL;
+    int i = 0, star = -1;
+    for (;;) {
+        if (i < pat->count) {
+            const struct pattern_step *step = &pat->steps[i];
+            switch (step->kind) {
+                case STEP_STAR:
+                    star = ++i;
+                    star_s = s;
+                    continue;
+                case STEP_LITERAL:
+                    if (strncmp((const char *) s, step->text, step->len) == 0) {
+                        s += step->len;
+                        i++;
+                        continue;
+                    }
+                    break;
+                case STEP_ANY:
+                    if (*s) {
+                        s++;
+                        i++;
+                        continue;
+                    }
+                    break;
+                case STEP_CLASS:
+                    if (step->class[*s >> 3] & (1 << (*s & 7))) {
+                        s++;
+                        i++;
+                        continue;
+                    }
+                    break;
+            }
+        } else if (!*s) {
+            return true;
+        }
+
+        /* A mismatch: the latest '*' takes one more byte, if there is one */
+        if (star < 0 || !*star_s) return false;
+        i = star;
+        s = ++star_s;
+    }
+}
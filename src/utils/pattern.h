@@ -0,0 +1,66 @@
+/*
+ * Shell patterns, as globs use them: '*', '?' and bracket expressions.  A
+ * pattern is compiled once into a list of steps, and then matched against
+ * any number of names without looking at its text again.
+ */
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include "arena.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * One step of a compiled pattern.
+ */
+struct pattern_step {
+    enum { STEP_LITERAL, STEP_ANY, STEP_STAR, STEP_CLASS } kind;
+    const char *text;           // STEP_LITERAL: the bytes to match
+    size_t len;
+    const unsigned char *class; // STEP_CLASS: a bitmap of the 256 bytes it takes
+};
+
+/**
+ * A compiled pattern.
+ */
+struct pattern {
+    struct pattern_step *steps;
+    int count;
+    bool literal;       // Nothing special in it: it only matches its own text
+    bool leading_dot;   // It starts with a '.', so it may match hidden names
+    const char *suffix; // The literal it ends with, after a '*', or NULL
+    size_t suffix_len;
+};
+
+/**
+ * @return Whether the text has a '*', a '?', or a '[' that a ']' closes.
+ *
+ * @param text The text, which need not be NUL-terminated.
+ * @param len Its length.
+ */
+bool is_pattern(const char *text, size_t len);
+
+/**
+ * Compiles a pattern.  A '[' that no ']' closes is taken as is, and so is a
+ * ']' right after the '[' or its '!' or '^'.  Bracket expressions take
+ * ranges, and the [:alpha:]-style classes of <ctype.h>.
+ *
+ * @param pat The pattern to fill in.
+ * @param text The text of the pattern; it need not be NUL-terminated, and
+ *             must outlive the pattern.
+ * @param len Its length.
+ * @param arena Where the steps are allocated.
+ * @return 0 on success, or -ENOMEM.
+ */
+int compile_pattern(struct pattern *pat, const char *text, size_t len, struct arena *arena);
+
+/**
+ * Matches a name against a compiled pattern, as a whole.
+ *
+ * @param pat The pattern.
+ * @param name The name, NUL-terminated.
+ * @return Whether it matches.
+ */
+bool pattern_matches(const struct pattern *pat, const char *name);
+
+#endif // PATTERN_H
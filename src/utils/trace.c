@@ -0,0 +1,139 @@
+/*
+ * Implementation of trace.h.
+ *
+ * Events go into a growing array, and only get formatted once, at exit,
+ * so recording a span costs a clock read and a copy.
+ */
+
+#define _GNU_SOURCE
+
+#include "trace.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_INITIAL_EVENTS 4096
+
+struct trace_event {
+    const char *name;
+    char phase;         // 'X' for a span, 'M' for a track name
+    int tid;
+    uint64_t start;
+    uint64_t end;
+    char detail[TRACE_DETAIL];
+};
+
+static struct trace_event *events = NULL;
+static size_t event_count = 0;
+static size_t event_cap = 0;
+static int trace_fd = -1;
+static pid_t trace_pid; // Forked children must not write the parent's trace
+
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20) fprintf(out, "\\u%04x", c);
+        else fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+static void trace_write(void) {
+    if (trace_fd < 0 || getpid() != trace_pid) return;
+
+    FILE *out = fdopen(trace_fd, "w");
+    if (!out) return;
+
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n", out);
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                 "\"args\":{\"name\":\"thsh\"}}", trace_pid, trace_pid);
+    for (size_t i = 0; i < event_count; i++) {
+        struct trace_event *e = &events[i];
+        if (e->phase == 'M') {
+            fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                         "\"tid\":%d,\"args\":{\"name\":", trace_pid, e->tid);
+            json_string(out, e->detail);
+            fputs("}}", out);
+            continue;
+        }
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"thsh\",\"ph\":\"X\",\"pid\":%d,"
+                     "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", e->name, trace_pid, e->tid,
+                e->start / 1e3, (e->end - e->start) / 1e3);
+        if (e->detail[0]) {
+            fputs(",\"args\":{\"detail\":", out);
+            json_string(out, e->detail);
+            fputc('}', out);
+        }
+        fputc('}', out);
+    }
+    fputs("\n]}\n", out);
+    fclose(out);
+    trace_fd = -1;
+}
+
+int trace_start(const char *path) {
+    trace_fd = open(path, O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd < 0) return -errno;
+
+    trace_pid = getpid();
+    atexit(trace_write);
+    return 0;
+}
+
+bool trace_enabled(void) {
+    return trace_fd >= 0;
+}
+
+uint64_t trace_now(void) {
+    struct timespec ts;
+    if (trace_fd < 0) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static struct trace_event *new_event(void) {
+    if (event_count == event_cap) {
+        size_t cap = event_cap ? event_cap * 2 : TRACE_INITIAL_EVENTS;
+        struct trace_event *bigger = realloc(events, cap * sizeof(*events));
+        if (!bigger) return NULL;
+        events = bigger;
+        event_cap = cap;
+    }
+    return &events[event_count++];
+}
+
+void trace_span_on(const char *name, uint64_t start, uint64_t end, int tid,
+                   const char *detail) {
+    if (trace_fd < 0) return;
+
+    struct trace_event *e = new_event();
+    if (!e) return;
+    e->name = name;
+    e->phase = 'X';
+    e->tid = tid;
+    e->start = start;
+    e->end = end;
+    snprintf(e->detail, sizeof(e->detail), "%s", detail ? detail : "");
+}
+
+void trace_span(const char *name, uint64_t start, const char *detail) {
+    if (trace_fd < 0) return;
+    trace_span_on(name, start, trace_now(), trace_pid, detail);
+}
+
+void trace_name_track(int tid, const char *name) {
+    if (trace_fd < 0) return;
+
+    struct trace_event *e = new_event();
+    if (!e) return;
+    e->name = "thread_name";
+    e->phase = 'M';
+    e->tid = tid;
+    snprintf(e->detail, sizeof(e->detail), "%s", name);
+}
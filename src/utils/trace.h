@@ -0,0 +1,67 @@
+/*
+ * A timeline of what the shell spends its time on, in Chrome trace-event
+ * format, for chrome://tracing or Perfetto.
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Longest detail (a command name, a pipeline) kept with an event.
+ */
+#define TRACE_DETAIL 64
+
+/**
+ * Starts recording.  Events are kept in memory, and written to the file
+ * when the shell exits.
+ *
+ * @param path The file to write the trace to.
+ * @return 0 on success, or negative errno if the file cannot be created.
+ */
+int trace_start(const char *path);
+
+/**
+ * @return Whether events are being recorded.
+ */
+bool trace_enabled(void);
+
+/**
+ * The start of a span.
+ *
+ * @return CLOCK_MONOTONIC in nanoseconds, or 0 when not recording.
+ */
+uint64_t trace_now(void);
+
+/**
+ * Records a span of the shell itself, from start until now.
+ *
+ * @param name The phase, e.g. "parse".  Must be a string literal.
+ * @param start As returned by trace_now().
+ * @param detail What the phase worked on, or NULL.
+ */
+void trace_span(const char *name, uint64_t start, const char *detail);
+
+/**
+ * Records a span on the track of another thread of execution, such as a
+ * child process.
+ *
+ * @param name The phase.  Must be a string literal.
+ * @param start Start, in CLOCK_MONOTONIC nanoseconds.
+ * @param end End, in CLOCK_MONOTONIC nanoseconds.
+ * @param tid The track, e.g. the child's pid.
+ * @param detail What the span is about, or NULL.
+ */
+void trace_span_on(const char *name, uint64_t start, uint64_t end, int tid,
+                   const char *detail);
+
+/**
+ * Names a track, e.g. after the command a child process runs.
+ *
+ * @param tid The track.
+ * @param name Its name.
+ */
+void trace_name_track(int tid, const char *name);
+
+#endif // TRACE_H
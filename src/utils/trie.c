@@ -35,6 +35,10 @@ bool is_child_node(Trie *root) {
 }
 
 void recommend_suggestion(Trie *root, char *curr_prefix, char **suggestions, int *count) {
+    if (*count >= MAX_SUGGESTIONS) {
+        return;
+    }
+
     if (root->end) {
         suggestions[*count] = strdup(curr_prefix);
         (*count)++;
@@ -66,7 +70,7 @@ char **find_suggestion(Trie *root, const char *query, int *count) {
     }
 
     bool is_word = (p_crawl->end && is_child_node(p_crawl));
-    char **suggestions = (char **) malloc(100 * sizeof(char *));
+    char **suggestions = (char **) malloc(MAX_SUGGESTIONS * sizeof(char *));
 
     if (!is_word) {
         recommend_suggestion(p_crawl, (char *) query, suggestions, count);
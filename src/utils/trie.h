@@ -15,6 +15,9 @@
 
 #define ALPHABET_SIZE 128
 
+/* Most suggestions find_suggestion() returns for one query */
+#define MAX_SUGGESTIONS 100
+
 /**
  * Struct representing a trie node.
  *
@@ -56,7 +59,7 @@ bool is_child_node(Trie *root);
 /**
  * Recursively generates suggestions for the current prefix.
  * If the current Trie node marks the end of a word, it adds
- * the prefix to the suggestions array.
+ * the prefix to the suggestions array, which holds MAX_SUGGESTIONS.
  *
  * @param root A pointer to the current Trie node.
  * @param curr_prefix The current prefix being constructed.
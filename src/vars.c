@@ -0,0 +1,548 @@
+/*
+ * Implementation of vars.h.
+ *
+ * The variables live in an open-addressing table (linear probing) keyed by
+ * name, as the command hash does.  An associative array is a table of its
+ * own, of scalars keyed by the array's keys, and an indexed array a plain
+ * array of values with holes.
+ *
+ * The environment of the commands is only built when an exported variable
+ * has changed since the last time: a script running a command in a loop
+ * hands every one of them the same array.
+ */
+
+#define _GNU_SOURCE
+
+#include "vars.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define VARS_INITIAL_SIZE 64
+
+struct var_table;
+
+struct var {
+    char *name;             // NULL marks an empty slot
+    enum var_kind kind;
+    bool exported;
+    char *value;            // VAR_SCALAR: NULL while unset
+    char **items;           // VAR_ARRAY: by index, NULL for a hole
+    int count;              // VAR_ARRAY: one past the last element set
+    int cap;
+    struct var_table *map;  // VAR_ASSOC: scalars keyed by the keys
+};
+
+struct var_table {
+    struct var *slots;
+    size_t size;
+    size_t used;
+};
+
+static struct var_table vars;
+static bool loaded = false;
+
+/* The environment of the commands, and whether it needs building again */
+static char **environ_cache = NULL;
+static bool environ_stale = true;
+
+static int last_status = 0;
+
+/* The arguments of the function call under way, after its name */
+static char **positional = NULL;
+
+/* The shell loads its environment first thing; anything else that uses
+ * the variables, such as a benchmark, gets the process's */
+static void load(void) {
+    if (!loaded) init_vars(__environ);
+}
+
+static uint64_t hash_name(const char *name) {
+    // FNV-1a
+    uint64_t h = 14695981039346656037ULL;
+    for (; *name; name++) {
+        h ^= (unsigned char) *name;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static struct var *find_slot(struct var *slots, size_t size, const char *name) {
+    size_t i = hash_name(name) & (size - 1);
+    while (slots[i].name && strcmp(slots[i].name, name) != 0)
+        i = (i + 1) & (size - 1);
+    return &slots[i];
+}
+
+static struct var *lookup(struct var_table *t, const char *name) {
+    if (!t->size) return NULL;
+    struct var *v = find_slot(t->slots, t->size, name);
+    return v->name ? v : NULL;
+}
+
+static int grow(struct var_table *t) {
+    size_t size = t->size ? t->size * 2 : VARS_INITIAL_SIZE;
+    struct var *slots = calloc(size, sizeof(struct var));
+    if (!slots) return -ENOMEM;
+
+    for (size_t i = 0; i < t->size; i++)
+        if (t->slots[i].name) *find_slot(slots, size, t->slots[i].name) = t->slots[i];
+    free(t->slots);
+    t->slots = slots;
+    t->size = size;
+    return 0;
+}
+
+/* Find a variable, adding it, unset, if it is not there */
+static struct var *insert(struct var_table *t, const char *name) {
+    struct var *v = lookup(t, name);
+    if (v) return v;
+
+    // Keep the load factor under 3/4
+    if ((t->used + 1) * 4 > t->size * 3 && grow(t) < 0) return NULL;
+    v = find_slot(t->slots, t->size, name);
+    if (!(v->name = strdup(name))) return NULL;
+    t->used++;
+    return v;
+}
+
+static void free_table(struct var_table *t);
+
+/* Free what a variable holds, leaving it an unset scalar */
+static void clear_var(struct var *v) {
+    free(v->value);
+    for (int i = 0; i < v->count; i++) free(v->items[i]);
+    free(v->items);
+    if (v->map) free_table(v->map);
+    free(v->map);
+    v->kind = VAR_SCALAR;
+    v->value = NULL;
+    v->items = NULL;
+    v->count = v->cap = 0;
+    v->map = NULL;
+}
+
+static void free_table(struct var_table *t) {
+    for (size_t i = 0; i < t->size; i++) {
+        if (!t->slots[i].name) continue;
+        clear_var(&t->slots[i]);
+        free(t->slots[i].name);
+    }
+    free(t->slots);
+    t->slots = NULL;
+    t->size = t->used = 0;
+}
+
+static void remove_var(struct var_table *t, struct var *v) {
+    clear_var(v);
+    free(v->name);
+    v->name = NULL;
+    t->used--;
+
+    /* Re-insert the rest of the probe run, so no entry after the hole
+     * becomes unreachable */
+    size_t i = (v - t->slots + 1) & (t->size - 1);
+    while (t->slots[i].name) {
+        struct var moved = t->slots[i];
+        t->slots[i].name = NULL;
+        *find_slot(t->slots, t->size, moved.name) = moved;
+        i = (i + 1) & (t->size - 1);
+    }
+}
+
+/* A variable changed; the environment only needs building again if it is
+ * in there */
+static void changed(const struct var *v) {
+    if (v->exported) environ_stale = true;
+}
+
+static int set_scalar(struct var *v, const char *value) {
+    char *copy = strdup(value);
+    if (!copy) return -ENOMEM;
+    free(v->value);
+    v->value = copy;
+    return 0;
+}
+
+/* Turn a key into the index of an element of an indexed array; a negative
+ * one counts back from the end.  Returns the index, or -errno. */
+static int parse_index(const struct var *v, const char *key) {
+    char *end;
+    long index = strtol(key, &end, 10);
+    if (end == key || *end) return -EINVAL;
+    if (index < 0) index += v->count;
+    if (index < 0) return -EINVAL;
+    return index >= VAR_MAX_INDEX ? -E2BIG : (int) index;
+}
+
+static int set_item(struct var *v, const char *key, const char *value) {
+    if (v->kind == VAR_ASSOC) {
+        struct var *e = insert(v->map, key);
+        return e ? set_scalar(e, value) : -ENOMEM;
+    }
+
+    int index = parse_index(v, key);
+    if (index < 0) return index;
+    if (index >= v->cap) {
+        int cap = v->cap ? v->cap : 8;
+        while (cap <= index) cap *= 2;
+        char **items = realloc(v->items, cap * sizeof(char *));
+        if (!items) return -ENOMEM;
+        memset(items + v->cap, 0, (cap - v->cap) * sizeof(char *));
+        v->items = items;
+        v->cap = cap;
+    }
+
+    char *copy = strdup(value);
+    if (!copy) return -ENOMEM;
+    free(v->items[index]);
+    v->items[index] = copy;
+    if (index >= v->count) v->count = index + 1;
+    return 0;
+}
+
+/* Turn a scalar into an indexed array, with its value at 0 */
+static int make_array(struct var *v) {
+    char *value = v->value;
+    v->value = NULL;
+    v->kind = VAR_ARRAY;
+    if (!value) return 0;
+    int rv = set_item(v, "0", value);
+    free(value);
+    return rv;
+}
+
+static const char *get_item(struct var *v, const char *key) {
+    if (v->kind == VAR_ASSOC) {
+        struct var *e = lookup(v->map, key);
+        return e ? e->value : NULL;
+    }
+    if (v->kind == VAR_SCALAR) return strcmp(key, "0") == 0 ? v->value : NULL;
+
+    int index = parse_index(v, key);
+    return index >= 0 && index < v->count ? v->items[index] : NULL;
+}
+
+int init_vars(char **envp) {
+    loaded = true;
+    for (int i = 0; envp && envp[i]; i++) {
+        const char *eq = strchr(envp[i], '=');
+        size_t len = var_name_length(envp[i]);
+        if (!len || eq != envp[i] + len) continue;
+
+        char name[len + 1];
+        memcpy(name, envp[i], len);
+        name[len] = '\0';
+        struct var *v = insert(&vars, name);
+        if (!v || set_scalar(v, eq + 1)) return -ENOMEM;
+        v->exported = true;
+    }
+    environ_stale = true;
+    return 0;
+}
+
+size_t var_name_length(const char *text) {
+    size_t len = 0;
+    if (!(text[0] == '_' || (text[0] >= 'a' && text[0] <= 'z') ||
+          (text[0] >= 'A' && text[0] <= 'Z')))
+        return 0;
+    while (text[len] == '_' || (text[len] >= 'a' && text[len] <= 'z') ||
+           (text[len] >= 'A' && text[len] <= 'Z') || (text[len] >= '0' && text[len] <= '9'))
+        len++;
+    return len;
+}
+
+/* Look up $0, $1 on, $#, $@ or $* */
+static const char *get_positional(const char *name) {
+    static char special[24];
+    static char *joined = NULL;
+    int count = 0;
+
+    while (positional && positional[count + 1]) count++;
+    if (name[0] == '#') {
+        snprintf(special, sizeof(special), "%d", count);
+        return special;
+    }
+    if (name[0] == '@' || name[0] == '*') {
+        size_t len = 0;
+        for (int i = 1; i <= count; i++) len += strlen(positional[i]) + 1;
+        char *bigger = realloc(joined, len + 1);
+        if (!bigger) return NULL;
+        joined = bigger;
+        joined[0] = '\0';
+        for (int i = 1, at = 0; i <= count; i++)
+            at += sprintf(joined + at, i > 1 ? " %s" : "%s", positional[i]);
+        return joined;
+    }
+
+    long n = strtol(name, NULL, 10);
+    if (n == 0) return "thsh";
+    return n <= count ? positional[n] : NULL;
+}
+
+const char *get_var(const char *name) {
+    static char special[24];
+
+    if ((name[0] >= '0' && name[0] <= '9') || (name[0] && strchr("#@*", name[0]) && !name[1]))
+        return get_positional(name);
+
+    if (strcmp(name, "?") == 0) {
+        snprintf(special, sizeof(special), "%d", last_status);
+        return special;
+    }
+    if (strcmp(name, "$") == 0) {
+        snprintf(special, sizeof(special), "%d", (int) getpid());
+        return special;
+    }
+
+    load();
+    struct var *v = lookup(&vars, name);
+    if (!v) return NULL;
+    return v->kind == VAR_SCALAR ? v->value : get_item(v, "0");
+}
+
+const char *get_var_element(const char *name, const char *key) {
+    load();
+    struct var *v = lookup(&vars, name);
+    return v ? get_item(v, key) : NULL;
+}
+
+int get_var_items(const char *name, bool keys, struct arena *arena, const char ***items) {
+    int count = 0;
+
+    load();
+    struct var *v = lookup(&vars, name);
+
+    *items = NULL;
+    if (!v || (v->kind == VAR_SCALAR && !v->value)) return 0;
+
+    int most = v->kind == VAR_ARRAY ? v->count : v->kind == VAR_ASSOC ? (int) v->map->used : 1;
+    const char **list = arena_alloc(arena, (most ?: 1) * sizeof(char *));
+    if (!list) return -ENOMEM;
+
+    if (v->kind == VAR_SCALAR) {
+        list[count++] = keys ? "0" : v->value;
+    } else if (v->kind == VAR_ASSOC) {
+        for (size_t i = 0; i < v->map->size; i++) {
+            struct var *e = &v->map->slots[i];
+            if (e->name) list[count++] = keys ? e->name : e->value;
+        }
+    } else {
+        for (int i = 0; i < v->count; i++) {
+            if (!v->items[i]) continue;
+            if (!keys) {
+                list[count++] = v->items[i];
+                continue;
+            }
+            char *key = arena_alloc(arena, 12);
+            if (!key) return -ENOMEM;
+            snprintf(key, 12, "%d", i);
+            list[count++] = key;
+        }
+    }
+    *items = list;
+    return count;
+}
+
+int set_var(const char *name, const char *value) {
+    load();
+    struct var *v = insert(&vars, name);
+    if (!v) return -ENOMEM;
+
+    int rv = v->kind == VAR_SCALAR ? set_scalar(v, value) : set_item(v, "0", value);
+    changed(v);
+    return rv;
+}
+
+int set_var_element(const char *name, const char *key, const char *value) {
+    load();
+    struct var *v = insert(&vars, name);
+    if (!v) return -ENOMEM;
+    if (v->kind == VAR_SCALAR && make_array(v) < 0) return -ENOMEM;
+
+    /* An element of an array is not exported, so nothing else changes */
+    return set_item(v, key, value);
+}
+
+int set_var_array(const char *name, char **values, int count) {
+    load();
+    struct var *v = insert(&vars, name);
+    if (!v) return -ENOMEM;
+
+    bool assoc = v->kind == VAR_ASSOC;
+    changed(v);
+    clear_var(v);
+    v->kind = assoc ? VAR_ASSOC : VAR_ARRAY;
+    if (assoc && !(v->map = calloc(1, sizeof(struct var_table)))) return -ENOMEM;
+
+    for (int i = 0, next = 0; i < count; i++) {
+        const char *close = values[i][0] == '[' ? strstr(values[i], "]=") : NULL;
+        int rv;
+        if (close) {
+            char key[close - values[i]];
+            memcpy(key, values[i] + 1, close - values[i] - 1);
+            key[close - values[i] - 1] = '\0';
+            rv = set_item(v, key, close + 2);
+            if (!assoc && rv == 0) next = parse_index(v, key) + 1;
+        } else if (assoc) {
+            rv = -EINVAL;
+        } else {
+            char key[12];
+            snprintf(key, sizeof(key), "%d", next++);
+            rv = set_item(v, key, values[i]);
+        }
+        if (rv < 0) return rv;
+    }
+    return 0;
+}
+
+int declare_var(const char *name, enum var_kind kind) {
+    load();
+    struct var *v = insert(&vars, name);
+    if (!v) return -ENOMEM;
+    if (v->kind == kind) return 0;
+    if (v->kind != VAR_SCALAR || (kind == VAR_ASSOC && v->value)) return -EINVAL;
+
+    changed(v);
+    if (kind == VAR_ARRAY) return make_array(v);
+    v->kind = VAR_ASSOC;
+    v->map = calloc(1, sizeof(struct var_table));
+    return v->map ? 0 : -ENOMEM;
+}
+
+int export_var(const char *name, bool exported) {
+    load();
+    struct var *v = insert(&vars, name);
+    if (!v) return -ENOMEM;
+    if (v->exported != exported) environ_stale = true;
+    v->exported = exported;
+    return 0;
+}
+
+int unset_var(const char *name) {
+    load();
+    struct var *v = lookup(&vars, name);
+    if (!v) return -ENOENT;
+    changed(v);
+    remove_var(&vars, v);
+    return 0;
+}
+
+int unset_var_element(const char *name, const char *key) {
+    load();
+    struct var *v = lookup(&vars, name);
+    if (!v) return -ENOENT;
+    if (v->kind == VAR_SCALAR) return strcmp(key, "0") == 0 ? unset_var(name) : -ENOENT;
+
+    if (v->kind == VAR_ASSOC) {
+        struct var *e = lookup(v->map, key);
+        if (!e) return -ENOENT;
+        remove_var(v->map, e);
+        return 0;
+    }
+
+    int index = parse_index(v, key);
+    if (index < 0 || index >= v->count || !v->items[index]) return -ENOENT;
+    free(v->items[index]);
+    v->items[index] = NULL;
+    while (v->count && !v->items[v->count - 1]) v->count--;
+    if (index == 0) changed(v);
+    return 0;
+}
+
+void set_last_status(int status) {
+    last_status = status;
+}
+
+char **set_positional(char **args) {
+    char **outer = positional;
+    positional = args;
+    return outer;
+}
+
+char **vars_environ(void) {
+    load();
+    if (!environ_stale) return environ_cache;
+
+    if (environ_cache) {
+        for (int i = 0; environ_cache[i]; i++) free(environ_cache[i]);
+        free(environ_cache);
+    }
+
+    int count = 0;
+    char **env = malloc((vars.used + 1) * sizeof(char *));
+    for (size_t i = 0; env && i < vars.size; i++) {
+        struct var *v = &vars.slots[i];
+        if (!v->name || !v->exported || v->kind != VAR_SCALAR || !v->value) continue;
+        if (asprintf(&env[count], "%s=%s", v->name, v->value) < 0) break;
+        count++;
+    }
+    if (env) env[count] = NULL;
+
+    /* Out of memory, the commands get what the shell started with */
+    environ_cache = env;
+    environ_stale = !env;
+    return env ? env : __environ;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp((*(struct var *const *) a)->name, (*(struct var *const *) b)->name);
+}
+
+/* Print a value between double quotes, escaping what bash would */
+static void print_quoted(int fd, const char *value) {
+    dprintf(fd, "\"");
+    for (const char *c = value; *c; c++)
+        dprintf(fd, strchr("\"\\$`", *c) ? "\\%c" : "%c", *c);
+    dprintf(fd, "\"");
+}
+
+void print_vars(int fd, bool exported_only) {
+    load();
+    struct var **sorted = malloc((vars.used + 1) * sizeof(struct var *));
+    size_t count = 0;
+    if (!sorted) return;
+
+    for (size_t i = 0; i < vars.size; i++)
+        if (vars.slots[i].name && (!exported_only || vars.slots[i].exported))
+            sorted[count++] = &vars.slots[i];
+    qsort(sorted, count, sizeof(*sorted), compare_names);
+
+    for (size_t i = 0; i < count; i++) {
+        struct var *v = sorted[i];
+        char flags[4] = "-", *f = flags + 1;
+        if (v->kind == VAR_ARRAY) *f++ = 'a';
+        if (v->kind == VAR_ASSOC) *f++ = 'A';
+        if (v->exported) *f++ = 'x';
+        *f = '\0';
+
+        dprintf(fd, "declare %s %s", f > flags + 1 ? flags : "--", v->name);
+        if (v->kind == VAR_SCALAR && v->value) {
+            dprintf(fd, "=");
+            print_quoted(fd, v->value);
+        } else if (v->kind == VAR_ARRAY) {
+            dprintf(fd, "=(");
+            for (int k = 0, first = 1; k < v->count; k++) {
+                if (!v->items[k]) continue;
+                dprintf(fd, "%s[%d]=", first ? "" : " ", k);
+                print_quoted(fd, v->items[k]);
+                first = 0;
+            }
+            dprintf(fd, ")");
+        } else if (v->kind == VAR_ASSOC) {
+            dprintf(fd, "=(");
+            for (size_t k = 0; k < v->map->size; k++) {
+                if (!v->map->slots[k].name) continue;
+                dprintf(fd, "[%s]=", v->map->slots[k].name);
+                print_quoted(fd, v->map->slots[k].value);
+                dprintf(fd, " ");
+            }
+            dprintf(fd, ")");
+        }
+        dprintf(fd, "\n");
+    }
+    free(sorted);
+}
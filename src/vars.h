@@ -0,0 +1,181 @@
+/*
+ *  The shell's variables: scalars, indexed arrays and associative arrays,
+ *  in an open-addressing hash table, and the environment the exported
+ *  ones make for the commands the shell starts.
+ */
+
+#ifndef VARS_H
+#define VARS_H
+
+#include "utils/arena.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * The highest index an indexed array takes, plus one.  The elements are
+ * kept in a plain array, so `a[1000000000]=x` fails with -E2BIG rather
+ * than allocating its way there.
+ */
+#define VAR_MAX_INDEX (1 << 20)
+
+/**
+ * What a variable holds.
+ */
+enum var_kind {
+    VAR_SCALAR,
+    VAR_ARRAY,  // Indexed by integers, from 0
+    VAR_ASSOC,  // Indexed by strings
+};
+
+/**
+ * Loads the variables of the environment the shell started with, all of
+ * them exported.  Whatever uses the variables first loads the one of the
+ * process otherwise.
+ *
+ * @param envp The environment, as main() gets it.
+ * @return 0 on success, or -ENOMEM.
+ */
+int init_vars(char **envp);
+
+/**
+ * @return The length of the variable name the text starts with: a letter
+ *         or '_', then letters, digits and '_'.  0 if it starts with none.
+ */
+size_t var_name_length(const char *text);
+
+/**
+ * Looks up the value of a variable, as $name expands to: a scalar's value,
+ * or element 0 (key "0") of an array.  The special parameters "?", the
+ * status of the last pipeline, "$", the pid of the shell, and the
+ * positional ones, "0" and on, "#", "@" and "*", are here too.
+ *
+ * @param name The name.
+ * @return The value, valid until the variable changes, or NULL if it is
+ *         unset.
+ */
+const char *get_var(const char *name);
+
+/**
+ * Looks up one element of an array, as ${name[key]} expands to.  The key
+ * of an indexed array is a decimal index; a negative one counts back from
+ * the end.  A scalar is an array of one element, at 0.
+ *
+ * @param name The name.
+ * @param key The index, or the key.
+ * @return The value, or NULL if it is unset.
+ */
+const char *get_var_element(const char *name, const char *key);
+
+/**
+ * Lists the elements of a variable, in index order for an indexed array,
+ * as ${name[@]} expands to, or their keys, as ${!name[@]} does.
+ *
+ * @param name The name.
+ * @param keys Whether to list the keys rather than the values.
+ * @param arena Where the list, and the keys of an indexed array, go.
+ * @param items Returns the list.
+ * @return The number of elements, 0 if it is unset, or -ENOMEM.
+ */
+int get_var_items(const char *name, bool keys, struct arena *arena, const char ***items);
+
+/**
+ * Sets a variable.  For an array, this sets element 0 (key "0"), as bash
+ * does.  The variable stays exported if it was.
+ *
+ * @param name The name, which must be valid.
+ * @param value The value, copied.
+ * @return 0 on success, or -ENOMEM.
+ */
+int set_var(const char *name, const char *value);
+
+/**
+ * Sets one element of an array, as name[key]=value does.  An unset
+ * variable becomes an indexed array, and a scalar becomes one with its
+ * value at index 0.
+ *
+ * @return 0 on success, -EINVAL for an index that is not a number or
+ *         before the first element, -E2BIG for one past VAR_MAX_INDEX, or
+ *         -ENOMEM.
+ */
+int set_var_element(const char *name, const char *key, const char *value);
+
+/**
+ * Replaces the elements of an array, as name=(value...) does.  An element
+ * written "[key]=value" goes at that key; any other goes after the
+ * previous one.  An associative array only takes the first form.
+ *
+ * @param name The name.
+ * @param values The elements.
+ * @param count The number of elements.
+ * @return 0 on success, or -errno as set_var_element() has it.
+ */
+int set_var_array(const char *name, char **values, int count);
+
+/**
+ * Makes a variable of the given kind, as declare -a or -A does, empty if
+ * it was unset.  A scalar becomes an indexed array with its value at 0.
+ *
+ * @return 0 on success, -EINVAL to turn an array into another kind of
+ *         array, or into a scalar, or -ENOMEM.
+ */
+int declare_var(const char *name, enum var_kind kind);
+
+/**
+ * Exports a variable, or stops exporting it.  An unset variable stays
+ * unset, but gets exported as soon as it is set.
+ *
+ * @return 0 on success, or -ENOMEM.
+ */
+int export_var(const char *name, bool exported);
+
+/**
+ * Unsets a variable, whatever its kind.
+ *
+ * @return 0 on success, or -ENOENT if it was not set.
+ */
+int unset_var(const char *name);
+
+/**
+ * Unsets one element of an array.
+ *
+ * @return 0 on success, or -ENOENT if it was not set.
+ */
+int unset_var_element(const char *name, const char *key);
+
+/**
+ * Sets the status the special parameter $? expands to.
+ */
+void set_last_status(int status);
+
+/**
+ * Sets the positional parameters, as a function call does: $1 on are its
+ * arguments, $# their number, and $@ and $* all of them.  $0 stays the
+ * shell's name.
+ *
+ * @param args The function's name and its arguments, NULL-terminated,
+ *        which must outlive the call, or NULL for none.
+ * @return The ones they replace, for the caller to put back.
+ */
+char **set_positional(char **args);
+
+/**
+ * The environment of the commands the shell starts: NAME=value for every
+ * exported scalar that is set.  It is kept from one call to the next, and
+ * only built again once an exported variable has changed, so the commands
+ * of a loop share it.
+ *
+ * @return The NULL-terminated array, valid until an exported variable
+ *         changes.
+ */
+char **vars_environ(void);
+
+/**
+ * Prints variables as declare commands that would recreate them, sorted
+ * by name.
+ *
+ * @param fd The file descriptor to print to.
+ * @param exported_only Whether to only print the exported ones.
+ */
+void print_vars(int fd, bool exported_only);
+
+#endif // VARS_H
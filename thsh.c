@@ -4,20 +4,30 @@
  * executing commands.
  */
 
+#define _GNU_SOURCE
+
+#include "src/exec.h"
 #include "src/jobs.h"
 #include "src/parse.h"
-#include "src/utils/constants.h"
 #include "src/utils/trie.h"
 #include "src/utils/path_manager.h"
+#include "src/utils/trace.h"
 #include "src/builtin.h"
+#include "src/bytecode.h"
 #include "src/history.h"
+#include "src/input_handler.h"
 #include "src/raw_mode.h"
+#include "src/script.h"
+#include "src/spawn.h"
+#include "src/subst.h"
+#include "src/vars.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -26,360 +36,325 @@
 #include <ctype.h>
 
 
-int main(int argc, char **argv, char **envp) {
-    // flag that the program should end
-    bool finished = 0;
-    int input_fd = 0; // Default to stdin
-    int ret = 0;
-    int debug = 0;
-    int time_counting = 0;
-    Trie *root = get_node();
+/* The arena every line is parsed into, reset once the line has run */
+static struct arena line_arena;
 
-    load_history();
+/* Run a parsed pipeline, and report it if it could not be run.  Returns
+ * true if a background job was started.  The exit status of the pipeline
+ * goes in *status, 127 if it did not get to run. */
+static bool run_parsed(struct pipeline *p, bool background, int *status) {
+    *status = 127;
+    int ret = run_pipeline(p, background, status);
 
-    /* Argument support:
-     * currently handles debug -d, and input file for non-interactive mode,
-     * which can be used to run scripts.
-     */
-    if (argc > 1) {
-        if (strcmp(argv[1], "-d") == 0) {
-            debug = 1;
-        } else if (strcmp(argv[1], "-t") == 0) {
-            time_counting = 1;
-        } else {
-            /* If a file is specified, open it in place for stdin. */
-            input_fd = open(argv[1], O_RDONLY);
-            if (input_fd < 0) {
-                dprintf(2, "Failed to open %s\n", argv[1]);
-                return input_fd;
-            }
+    // Do NOT change this if/printf - it is used by the autograder.
+    if (ret) {
+        char buf[100];
+        int rv = snprintf(buf, 100, "Failed to run command - error %d\n", ret);
+        if (rv > 0)
+            write(1, buf, strlen(buf));
+        else
+            dprintf(2,
+                    "Failed to format the output (%d).  This shouldn't happen...\n",
+                    rv);
+    }
+    return !ret && background;
+}
+
+static void report_parse_error(int pipeline_steps) {
+    // An arithmetic error was reported as it was found
+    if (pipeline_steps == -EDOM) return;
+    dprintf(2,
+            "Parsing error.  Cannot execute command. %d\n",
+            -pipeline_steps);
+}
+
+/* Run a list, each pipeline once the one before it lets it, and expanded
+ * only then.  With background set, the last pipeline is left running as a
+ * job even without a trailing `&`.  Returns the number of background jobs
+ * started. */
+static int run_list(struct pipeline *p, bool background) {
+    int started = 0, status = 0;
+
+    for (bool run = true; p; run = list_runs_next(p->op, status), p = p->next) {
+        if (!run) continue;
+
+        int steps = expand_pipeline(p);
+        if (steps < 0) {
+            report_parse_error(steps);
+            status = 1;
+        } else if (steps > 0) {
+            started += run_parsed(p, p->background || (background && !p->next), &status);
         }
+        set_last_status(status);
     }
-
-    ret = init_cwd();
-    if (ret) {
-        dprintf(2, "Error initializing the current working directory: %d\n", ret);
-        return ret;
+    return started;
+}
+
+/* Parse and run one line of input, and the lines that continue it.  The
+ * continuations and the bodies of here-documents are read from next.
+ * Returns the number of background jobs started. */
+static int run_line(char *cmd, size_t cmd_len, bool background, line_reader next,
+                    void *ctx) {
+    struct pipeline p;
+    int started = 0;
+
+    if (cmd[0] == '#') return 0;
+
+    // Pass it to the parser
+    int count = -ENOMEM;
+    if ((cmd = join_continued_lines(cmd, &cmd_len, next, ctx, &line_arena)))
+        count = tokenize_line(cmd, cmd_len, &p, &line_arena);
+
+    /* Even after an error, so the bodies do not run as commands */
+    if (cmd && read_here_docs(&p, next, ctx, &line_arena) < 0 && count >= 0)
+        count = -ENOMEM;
+
+    if (count < 0) report_parse_error(count);
+    else if (count > 0) started = run_list(&p, background);
+    arena_reset(&line_arena);
+    return started;
+}
+
+/* With -j, wait until fewer than max_jobs lines are running */
+static void wait_for_slot(int *running, int max_jobs) {
+    while (*running >= max_jobs)
+        *running = await_any_job(NULL) < 0 ? 0 : *running - 1;
+}
+
+static void wait_for_all(int *running) {
+    while (*running > 0 && await_any_job(NULL) > 0)
+        (*running)--;
+}
+
+/* Batch mode: run every line of a script in turn, or, with max_jobs above
+ * one, treat the lines as independent and keep up to max_jobs of them
+ * running at once. */
+static void run_batch(struct script *script, int max_jobs) {
+    char *line;
+    size_t len;
+    int running = 0;
+
+    for (;;) {
+        uint64_t trace_start = trace_now();
+        if (!(line = next_script_line(script, &len))) break;
+        trace_span("read", trace_start, NULL);
+
+        if (max_jobs <= 1) {
+            run_line(line, len, false, script_line_reader, script);
+            continue;
+        }
+        wait_for_slot(&running, max_jobs);
+        running += run_line(line, len, true, script_line_reader, script);
     }
-
-    ret = init_path();
-    if (ret) {
-        dprintf(2, "Error initializing the path table: %d\n", ret);
-        return ret;
+    wait_for_all(&running);
+}
+
+/* Batch mode for a compiled script: the same, but every list comes
+ * ready-made out of the bytecode */
+static void run_compiled(struct bytecode *bc, int max_jobs) {
+    size_t pc = 0;
+    int running = 0;
+
+    while (more_code(bc, pc)) {
+        struct pipeline p;
+
+        int count = next_list(bc, &pc, &p, &line_arena);
+        if (count < 0) {
+            report_parse_error(count);
+        } else if (max_jobs <= 1) {
+            run_list(&p, false);
+        } else {
+            wait_for_slot(&running, max_jobs);
+            running += run_list(&p, true);
+        }
+        arena_reset(&line_arena);
     }
+    wait_for_all(&running);
+}
 
-    char **paths = get_path_table();
-    char **builtins = get_builtin_names();
-    populate_trie(root, paths);
-    populate_trie(root, builtins);
+/* The line editor as a line_reader, for a continued line or the body of a
+ * here-document */
+struct terminal_reader {
+    char line[MAX_INPUT];
+    Trie *root;
+};
+
+static char *terminal_line_reader(void *ctx, size_t *len) {
+    struct terminal_reader *t = ctx;
+    int history_idx = get_history_length();
 
     enable_raw_mode();
+    write(STDOUT_FILENO, "> ", 2);
+    memset(t->line, 0, sizeof(t->line));
+    int n = read_input_line(STDIN_FILENO, t->line, &history_idx, t->root);
+    cleanup_input_handler();
+    if (n < 0) return NULL;
+
+    *len = n;
+    return t->line;
+}
+
+/* Interactive mode: read lines from the terminal with the line editor */
+static void run_interactive(void) {
+    Trie *root = get_node();
+    struct terminal_reader body = {.root = root};
+
+    load_history();
+    init_input_handler(root);
 
-    while (!finished) {
+    for (;;) {
         // Buffer to hold input
         char cmd[MAX_INPUT] = {0};
-        int cmd_len = 0;
-        char scratch[MAX_INPUT];
-        char *parsed_commands[MAX_PIPELINE][MAX_ARGS];
-        char *infile = NULL;
-        char *outfile = NULL;
-        int pipeline_steps;
         int history_idx = get_history_length();
 
-        if (!input_fd) {
-            ret = print_prompt();
-            if (ret <= 0) {
-                // if we printed 0 bytes, this call failed and the program
-                // should end -- this will likely never occur.
-                finished = true;
-                break;
-            }
-        }
-
-        // Reset memory from the last iteration
-        for (int i = 0; i < MAX_PIPELINE; i++) {
-            for (int j = 0; j < MAX_ARGS; j++) {
-                parsed_commands[i][j] = NULL;
-            }
+        // Report background jobs that finished in the meantime
+        notify_jobs();
+        enable_raw_mode();
+        if (print_prompt() <= 0) {
+            // if we printed 0 bytes, this call failed and the program
+            // should end -- this will likely never occur.
+            break;
         }
 
-        // Read a line of input
-        char c;
-        /*
-         *
-         * RAW INPUT HANDLING
-         *
-         */
-        while (read(input_fd, &c, 1) == 1) {
-            if (c == '\x1b') {
-                /*
-                 *  ESC handling -- for arrow keys
-                 */
-                char seq[3];
-                if (read(STDIN_FILENO, &seq[0], 1) != 1) break;
-                if (read(STDIN_FILENO, &seq[1], 1) != 1) break;
-
-                if (seq[0] == '[') {
-                    switch (seq[1]) {
-                        case 'A': {  // UP arrow key
-                            char *prev_cmd = get_prev_history_command(&history_idx);
-                            if (prev_cmd) {
-                                // clear current command
-                                while (cmd_len > 0) {
-                                    write(STDOUT_FILENO, "\b \b", 3);
-                                    cmd_len--;
-                                }
-                                // load previous command into cmd buffer
-                                strcpy(cmd, prev_cmd);
-                                cmd_len = strlen(cmd);
-                                write(STDOUT_FILENO, cmd, cmd_len);
-                            }
-                            break;
-                        }
-                        case 'B': {  // DOWN arrow key
-                            char *next_cmd = get_next_history_command(&history_idx);
-                            if (next_cmd) {
-                                // clear current command
-                                while (cmd_len > 0) {
-                                    write(STDOUT_FILENO, "\b \b", 3);
-                                    cmd_len--;
-                                }
-                                // load previous command into cmd buffer
-                                strcpy(cmd, next_cmd);
-                                cmd_len = strlen(cmd);
-                                write(STDOUT_FILENO, cmd, cmd_len);
-                            }
-                            break;
-                        }
-                    }
-                }
-                continue;
-            } else if (c == '\n' || c == '\r') {
-                /*
-                 * NEWLINE HANDLING
-                 */
-                printf("\n");
-                break;
-            } else if (c == '\t') {
-                /*
-                 * TAB HANDLING
-                 */
-                static int tab_count = 0;
-                tab_count++;
-
-                if (cmd_len <= 0) {
-                    tab_count = 0;
-                    continue; // No suggestions if no input
-                }
-                cmd[cmd_len] = '\0'; // Temporarily null-terminate current input
-
-                int num_suggestions = 0;
-                int suggestion_len;
-                char **suggestions = find_suggestion(root, cmd, &num_suggestions);
-
-                /* If there is only one suggestion, auto-complete the command.
-                 * If there are multiple suggestions, print them all out after
-                 * multiple tab spaces (ubuntu behavior)
-                 */
-                if (num_suggestions == 1) {
-                    suggestion_len = strlen(suggestions[0]);
-
-                    // Move cursor back and clear the current input
-                    for (int i = 0; i < cmd_len; i++) {
-                        write(STDOUT_FILENO, "\b \b", 3);
-                    }
-
-                    write(STDOUT_FILENO, suggestions[0], suggestion_len);
-
-                    // Update cmd and cmd_len to reflect the new command
-                    strcpy(cmd, suggestions[0]);
-                    cmd_len = suggestion_len;
-                } else if (num_suggestions > 1) {
-                    if (tab_count >= 2) {
-                        // Display all options
-                        printf("\n");
-                        for (int i = 0; i < num_suggestions; i++) {
-                            printf("%s\n", suggestions[i]);
-                        }
-                        printf("\n");
-                        ret = print_prompt();
-                        write(STDOUT_FILENO, cmd, cmd_len);
-                    }
-                }
-                free(suggestions);
-                continue;
-            } else if (c == '\x7f' || c == '\b') {
-                /*
-                 * BACKSPACE HANDLING
-                 */
-                if (cmd_len > 0) {
-                    cmd[--cmd_len] = '\0'; // Remove the last character from the buffer
-                    write(STDOUT_FILENO, "\b \b", 3); // Move back, write space, move back again
-                }
-                continue;
-            } else if (isprint(c)) {
-                /*
-                 * PRINTABLE CHARACTER HANDLING
-                 */
-                if (cmd_len < MAX_INPUT - 1) {
-                    cmd[cmd_len++] = c;
-                    write(STDOUT_FILENO, &c, 1); // Echo back the character
-                }
-            }
-        }
+        uint64_t trace_start = trace_now();
+        int cmd_len = read_input_line(STDIN_FILENO, cmd, &history_idx, root);
+        trace_span("read", trace_start, NULL);
 
-        cmd[cmd_len] = '\0'; // Null-terminate the command
+        // Commands get the terminal the way we found it
+        cleanup_input_handler();
+        if (cmd_len < 0) break;
 
         if (cmd[0] == '#') continue;
 
         // Add it to the history
         add_history_line(cmd);
 
-        // Pass it to the parser
-        pipeline_steps = parse_line(cmd,
-                                    cmd_len,
-                                    parsed_commands,
-                                    &infile,
-                                    &outfile,
-                                    scratch,
-                                    MAX_INPUT);
-
-        if (pipeline_steps < 0) {
-            dprintf(2,
-                    "Parsing error.  Cannot execute command. %d\n",
-                    -pipeline_steps);
-            continue;
-        }
+        run_line(cmd, cmd_len, false, terminal_line_reader, &body);
+    }
 
-        ret = 0;
-        int fd[2];
-        int in_fd = STDIN_FILENO;
-        int out_fd = STDOUT_FILENO;
-
-        /* Notes on the `open` function, for "<" redirection:
-         * `O_RDONLY`: This flag opens the file for reading only.
-         *
-         * Ensures that our input file is readable for workable input.
-         * */
-        if (infile) {
-            in_fd = open(infile, O_RDONLY);
-            if (in_fd < 0) {
-                perror("in_fd: error opening file");
-                exit(EXIT_FAILURE);
-            }
-        }
+    save_history();
+}
 
-        /* Notes on the `open` function, for ">" redirection:
-         * `O_CREAT`: This flag tells the `open` function to create the file if
-         *  it does not already exist.
-         * `O_WRONLY`: This flag opens the file for writing only.
-         * `S_IRUSR`: This flag gives the owner of the file read permission.
-         * `S_IWUSR`: This flag gives the owner of the file write permission.
-         * `S_IRGRP`: This flag gives the group of the file read permission.
-         * `S_IROTH`: This flag gives others read permission.
-         *
-         * Ensures that our output file has the correct permissions for
-         * workable output.
-        */
-        if (outfile) {
-            out_fd = open(outfile,
-                          O_CREAT | O_WRONLY,
-                          S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-            if (out_fd < 0) {
-                perror("out_fd: error opening file");
-                exit(EXIT_FAILURE);
-            }
-        }
+int main(int argc, char **argv, char **envp) {
+    int ret = 0;
+    int debug = 0;
+    int time_counting = 0;
+    int monitor = 0;
+    int place = 0;
+    int max_jobs = 1;
+    const char *command = NULL;
+    struct script script;
+    struct bytecode bc;
 
-        /*
-         * This loop is responsible for executing a series of parsed commands.
-         * It sets up piping between consecutive commands, ensuring the output
-         * of one command is passed as input to the next, enabling the chaining
-         * of commands.
-         *
-         * If it's the last command and an outfile is specified, the output is
-         * redirected to the given outfile.
-         */
-        for (int i = 0; parsed_commands[i][0] != NULL; i++) {
-            pipe(fd);
-
-            if (debug)
-                fprintf(stderr, "RUNNING: [%s]\n",
-                        parsed_commands[i][0]);
-
-            int next_in = fd[0];
-            int next_out = fd[1];
-
-            /* If it's the last command and outfile is specified, use out_fd as
-             * output, otherwise use STDOUT_FILENO == 1 */
-            if (parsed_commands[i + 1][0] == NULL) {
-                next_out = (outfile) ? out_fd : STDOUT_FILENO;
-            }
-
-            if (handle_builtin(parsed_commands[i], in_fd, next_out, &ret)) {
-                if (in_fd != STDIN_FILENO) {
-                    close(in_fd);
+    /* Argument support:
+     * currently handles core placement -a, debug -d, timing -t, pipe
+     * monitoring -p, the spawn backend -s, a command string -c, concurrent
+     * batch lines -j, a trace file -T, and an input file for non-interactive
+     * mode, which can be used to run scripts.
+     */
+    int opt;
+    while ((opt = getopt(argc, argv, "adtps:c:j:T:")) != -1) {
+        switch (opt) {
+            case 'a':
+                place = 1;
+                break;
+            case 'd':
+                debug = 1;
+                break;
+            case 't':
+                time_counting = 1;
+                break;
+            case 'p':
+                monitor = 1;
+                break;
+            case 's':
+                if (set_spawn_backend(optarg)) {
+                    dprintf(2, "Unknown spawn backend %s "
+                               "(expected fork, posix_spawn or vfork)\n", optarg);
+                    return 1;
                 }
-            } else {
-                struct timeval start_time, end_time;
-                struct rusage usage_start, usage_end;
-
-                if (time_counting) {
-                    gettimeofday(&start_time, NULL);
-                    getrusage(RUSAGE_CHILDREN, &usage_start);
+                break;
+            case 'c':
+                command = optarg;
+                break;
+            case 'T':
+                if (trace_start(optarg)) {
+                    dprintf(2, "Failed to create trace file %s\n", optarg);
+                    return 1;
                 }
+                break;
+            case 'j':
+                max_jobs = atoi(optarg);
+                if (max_jobs <= 0) {
+                    dprintf(2, "-j expects a positive number of jobs\n");
+                    return 1;
+                }
+                break;
+            default:
+                dprintf(2, "Usage: %s [-a] [-d] [-t] [-p] [-s backend] [-j jobs] [-T trace.json] "
+                           "[-c command | script]\n", argv[0]);
+                return 1;
+        }
+    }
 
-                ret = run_command(parsed_commands[i], in_fd, next_out, 0);
-
-                if (time_counting) {
-                    gettimeofday(&end_time, NULL);
-                    getrusage(RUSAGE_CHILDREN, &usage_end);
+    /* Anything but a terminal on stdin is a script, too */
+    bool interactive = !command && optind >= argc && isatty(STDIN_FILENO);
 
-                    // Calculate elapsed time, then print it
-                    long real_time = (end_time.tv_sec - start_time.tv_sec) * 1000 +
-                                     (end_time.tv_usec - start_time.tv_usec) / 1000;
-                    long user_time = (usage_end.ru_utime.tv_sec - usage_start.ru_utime.tv_sec) * 1000 +
-                                     (usage_end.ru_utime.tv_usec - usage_start.ru_utime.tv_usec) / 1000;
-                    long sys_time = (usage_end.ru_stime.tv_sec - usage_start.ru_stime.tv_sec) * 1000 +
-                                    (usage_end.ru_stime.tv_usec - usage_start.ru_stime.tv_usec) / 1000;
+    if (command) {
+        ret = open_script_string(&script, command);
+    } else if (optind < argc) {
+        /* Script files are compiled, or come straight from the cache */
+        ret = load_script(argv[optind], &bc);
+        if (ret) {
+            dprintf(2, "Failed to open %s\n", argv[optind]);
+            return ret;
+        }
+    } else if (!interactive) {
+        ret = open_script_fd(&script, STDIN_FILENO);
+    }
+    if (ret) {
+        dprintf(2, "Error reading the script: %d\n", ret);
+        return ret;
+    }
 
-                    printf("TIMES: real=%.1fs user=%.1fs sys=%.1fs\n",
-                           real_time / 1000.0, user_time / 1000.0, sys_time / 1000.0);
-                }
-            }
+    set_exec_flags((debug ? EXEC_DEBUG : 0) | (time_counting ? EXEC_TIME : 0) |
+                   (monitor ? EXEC_MONITOR : 0) | (place ? EXEC_PLACE : 0));
 
-            if (debug) {
-                fprintf(stderr, "ENDED: [%s] (ret=%d)\n",
-                        parsed_commands[i][0], ret);
-            }
+    ret = init_vars(envp);
+    if (ret) {
+        dprintf(2, "Error loading the environment: %d\n", ret);
+        return ret;
+    }
 
-            close(fd[1]);
-            in_fd = next_in;
-        }
+    ret = init_cwd();
+    if (ret) {
+        dprintf(2, "Error initializing the current working directory: %d\n", ret);
+        return ret;
+    }
 
-        /* We need to make sure to close any file descriptors that we opened
-         * for input and output redirection, if not already set to STDIN_FILENO
-         * and STDOUT_FILENO, respectively.
-         */
-        if (in_fd != STDIN_FILENO) close(in_fd);
-        if (out_fd != STDOUT_FILENO) close(out_fd);
+    ret = init_path();
+    if (ret) {
+        dprintf(2, "Error initializing the path table: %d\n", ret);
+        return ret;
+    }
 
+    ret = init_jobs(interactive);
+    if (ret) {
+        dprintf(2, "Error initializing job control: %d\n", ret);
+        return ret;
+    }
 
-        // Do NOT change this if/printf - it is used by the autograder.
-        if (ret) {
-            char buf[100];
-            int rv = snprintf(buf, 100, "Failed to run command - error %d\n", ret);
-            if (rv > 0)
-                write(1, buf, strlen(buf));
-            else
-                dprintf(2,
-                        "Failed to format the output (%d).  This shouldn't happen...\n",
-                        rv);
-        }
+    if (interactive) {
+        run_interactive();
+    } else if (!command && optind < argc) {
+        run_compiled(&bc, max_jobs);
+        free_bytecode(&bc);
+    } else {
+        run_batch(&script, max_jobs);
+        close_script(&script);
     }
 
-    save_history();
     // Only return a non-zero value from main() if the shell itself
     // has a bug.  Do not use this to indicate a failed command.
     return 0;
-}
\ No newline at end of file
+}